@@ -0,0 +1,903 @@
+// filename:    baosort.cpp
+// author:      baobaobear
+// create date: 2026-10-18
+// A sort command for newline-delimited text and fixed-width binary records, from the files or stdin to stdout.
+// The input is sorted in memory by the parallel engines, or in sorted runs merged from temporary files
+// when it is bigger than the memory limit
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "sortlib.hpp"
+#include "extsort.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace baosort
+{
+
+enum
+{
+    io_block_bytes = 1 << 22,
+    io_block_min_bytes = 1 << 12,
+    run_block_min_bytes = 1 << 16,
+    max_merge_ways = 512,
+    numeric_prefix_digits = 11
+};
+
+struct options
+{
+    size_t record_size;     // binary records of record_size bytes, 0 for lines of text
+    size_t key_beg;         // text: the first and the last key field from 1, binary: the key bytes
+    size_t key_end;
+    char separator;         // 0 for runs of blanks
+    bool numeric;
+    bool reverse;
+    bool stable;
+    size_t memory;
+    unsigned threads;
+    std::string temp_dir;
+    const char* output;
+    std::vector<const char*> inputs;
+};
+
+// a line without its newline, or a binary record. prefix orders the keys as far as it goes,
+// the key itself is only compared when the prefixes are equal
+struct record
+{
+    uint64_t prefix;
+    const char* data;
+    uint32_t len;
+    uint32_t key;      // offset of the key in data, for a number the integer digits without leading zeros
+    uint32_t key_len;
+    uint32_t frac_len; // the fraction digits of a number without trailing zeros, after the point behind the integer digits
+};
+
+inline bool is_blank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// the field from 1 begins after field - 1 separators, without -t a field begins at the blanks before it
+const char* field_begin(const char* p, const char* end, size_t field, char separator)
+{
+    for (size_t i = 1; i < field && p < end; ++i)
+    {
+        if (separator)
+        {
+            const char* q = (const char*)memchr(p, separator, end - p);
+            p = q ? q + 1 : end;
+        }
+        else
+        {
+            while (p < end && is_blank(*p))
+                ++p;
+            while (p < end && !is_blank(*p))
+                ++p;
+        }
+    }
+    return p;
+}
+
+const char* field_end(const char* p, const char* end, size_t field, char separator)
+{
+    p = field_begin(p, end, field, separator);
+    if (separator)
+    {
+        const char* q = (const char*)memchr(p, separator, end - p);
+        return q ? q : end;
+    }
+    while (p < end && is_blank(*p))
+        ++p;
+    while (p < end && !is_blank(*p))
+        ++p;
+    return p;
+}
+
+// numbers like sort -n: blanks, an optional minus, digits and an optional fraction, anything else is 0.
+// the prefix holds the sign in the top 2 bits, then the count of integer digits, then the first digits
+void make_numeric_key(record& r, const char* p, const char* end)
+{
+    while (p < end && is_blank(*p))
+        ++p;
+    bool negative = p < end && *p == '-';
+    if (negative)
+        ++p;
+    while (p < end && *p == '0')
+        ++p;
+    const char* int_beg = p;
+    while (p < end && is_digit(*p))
+        ++p;
+    const char* int_end = p, * frac_end = p;
+    if (p < end && *p == '.')
+    {
+        for (++p; p < end && is_digit(*p); ++p)
+        {
+            if (*p != '0')
+                frac_end = p + 1;
+        }
+    }
+    r.key = (uint32_t)(int_beg - r.data);
+    r.key_len = (uint32_t)(int_end - int_beg);
+    r.frac_len = frac_end > int_end ? (uint32_t)(frac_end - int_end - 1) : 0;
+    if (r.key_len == 0 && r.frac_len == 0)
+    {
+        r.prefix = (uint64_t)1 << 62;
+        return;
+    }
+
+    uint64_t prefix = std::min(r.key_len, (uint32_t)0xffff);
+    for (size_t i = 0; i < numeric_prefix_digits; ++i)
+    {
+        size_t d = 0;
+        if (i < r.key_len)
+            d = int_beg[i] - '0';
+        else if (i < (size_t)r.key_len + r.frac_len)
+            d = int_end[1 + i - r.key_len] - '0';
+        prefix = prefix << 4 | d;
+    }
+    prefix <<= 62 - 16 - numeric_prefix_digits * 4;
+    r.prefix = negative ? ~prefix & (((uint64_t)1 << 62) - 1) : (uint64_t)2 << 62 | prefix;
+}
+
+void make_record(record& r, const char* data, size_t len, const options& opt)
+{
+    r.data = data;
+    r.len = (uint32_t)len;
+    r.frac_len = 0;
+    const char* key_beg = data, * key_end = data + len;
+    if (opt.record_size)
+    {
+        key_beg = data + opt.key_beg;
+        key_end = key_beg + opt.key_end;
+        if (opt.numeric)
+        {
+            r.prefix = 0;
+            for (const char* p = key_end; p-- > key_beg; )
+                r.prefix = r.prefix << 8 | (unsigned char)*p;
+            r.key = (uint32_t)opt.key_beg;
+            r.key_len = 0;
+            return;
+        }
+    }
+    else
+    {
+        if (opt.key_beg)
+            key_beg = field_begin(data, key_end, opt.key_beg, opt.separator);
+        if (opt.key_end)
+            key_end = std::max(key_beg, field_end(data, key_end, opt.key_end, opt.separator));
+        if (opt.numeric)
+        {
+            make_numeric_key(r, key_beg, key_end);
+            return;
+        }
+    }
+    r.key = (uint32_t)(key_beg - data);
+    r.key_len = (uint32_t)(key_end - key_beg);
+    r.prefix = 0;
+    for (size_t i = 0; i < 8; ++i)
+        r.prefix = r.prefix << 8 | (i < r.key_len ? (unsigned char)key_beg[i] : 0);
+}
+
+int compare_bytes(const char* a, size_t a_len, const char* b, size_t b_len)
+{
+    int c = memcmp(a, b, std::min(a_len, b_len));
+    if (c != 0)
+        return c;
+    return a_len < b_len ? -1 : a_len > b_len;
+}
+
+// the prefixes are equal, so are the signs. more integer digits, then the digits, then the fraction
+int compare_numeric(const record& a, const record& b)
+{
+    int c = a.key_len < b.key_len ? -1 : a.key_len > b.key_len;
+    if (c == 0)
+        c = memcmp(a.data + a.key, b.data + b.key, a.key_len);
+    if (c == 0)
+        c = compare_bytes(a.data + a.key + a.key_len + 1, a.frac_len, b.data + b.key + b.key_len + 1, b.frac_len);
+    return a.prefix >> 62 == 0 ? -c : c;
+}
+
+struct record_less
+{
+    const options* opt;
+
+    explicit record_less(const options& _opt)
+        : opt(&_opt)
+    {
+    }
+
+    // the whole record decides between equal keys, unless the sort is stable, like sort -s
+    bool operator()(const record& a, const record& b) const
+    {
+        int c = 0;
+        if (a.prefix != b.prefix)
+            c = a.prefix < b.prefix ? -1 : 1;
+        else if (opt->numeric && !opt->record_size)
+            c = compare_numeric(a, b);
+        else if (!opt->numeric)
+            c = compare_bytes(a.data + a.key, a.key_len, b.data + b.key, b.key_len);
+        if (c == 0 && !opt->stable)
+            c = compare_bytes(a.data, a.len, b.data, b.len);
+        return opt->reverse ? c > 0 : c < 0;
+    }
+};
+
+// the inputs one after the other, a text file that does not end with a newline gets one
+class input_reader
+{
+public:
+    input_reader(const options& opt)
+        : m_opt(opt), m_next(0), m_file(NULL), m_last('\n'), m_error(false)
+    {
+    }
+
+    ~input_reader()
+    {
+        close();
+    }
+
+    size_t read(char* buf, size_t size)
+    {
+        size_t total = 0;
+        while (total < size)
+        {
+            if (!m_file && !open_next())
+                break;
+            size_t n = fread(buf + total, 1, size - total, m_file);
+            if (n > 0)
+            {
+                total += n;
+                m_last = buf[total - 1];
+                continue;
+            }
+            if (ferror(m_file))
+            {
+                fprintf(stderr, "baosort: read error\n");
+                m_error = true;
+            }
+            close();
+            if (!m_opt.record_size && m_last != '\n')
+            {
+                buf[total++] = m_last = '\n';
+            }
+        }
+        return total;
+    }
+
+    bool error() const
+    {
+        return m_error;
+    }
+
+private:
+    bool open_next()
+    {
+        while (m_next < m_opt.inputs.size() && !m_error)
+        {
+            const char* path = m_opt.inputs[m_next++];
+            m_file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+            if (m_file)
+                return true;
+            fprintf(stderr, "baosort: cannot read %s\n", path);
+            m_error = true;
+        }
+        return false;
+    }
+
+    void close()
+    {
+        if (m_file && m_file != stdin)
+            fclose(m_file);
+        m_file = NULL;
+    }
+
+    const options& m_opt;
+    size_t m_next;
+    FILE* m_file;
+    char m_last;
+    bool m_error;
+};
+
+// large writes of whole blocks
+class output_writer
+{
+public:
+    output_writer()
+        : m_file(NULL), m_fill(0), m_error(false)
+    {
+    }
+
+    bool open(FILE* file)
+    {
+        m_file = file;
+        m_buf.resize(io_block_bytes);
+        m_fill = 0;
+        m_error = !file;
+        return !m_error;
+    }
+
+    void write(const char* data, size_t len)
+    {
+        if (m_fill + len > m_buf.size())
+        {
+            flush();
+            if (len > m_buf.size())
+            {
+                m_error = m_error || fwrite(data, 1, len, m_file) != len;
+                return;
+            }
+        }
+        memcpy(&m_buf[m_fill], data, len);
+        m_fill += len;
+    }
+
+    void put(char c)
+    {
+        if (m_fill == m_buf.size())
+            flush();
+        m_buf[m_fill++] = c;
+    }
+
+    void flush()
+    {
+        m_error = m_error || fwrite(&m_buf[0], 1, m_fill, m_file) != m_fill;
+        m_fill = 0;
+    }
+
+    bool close()
+    {
+        flush();
+        bool ok = !m_error && fflush(m_file) == 0;
+        if (m_file != stdout)
+            ok = fclose(m_file) == 0 && ok;
+        m_file = NULL;
+        return ok;
+    }
+
+private:
+    FILE* m_file;
+    std::vector<char> m_buf;
+    size_t m_fill;
+    bool m_error;
+};
+
+void write_record(output_writer& out, const record& r, const options& opt)
+{
+    out.write(r.data, r.len);
+    if (!opt.record_size)
+        out.put('\n');
+}
+
+// output iterator for merge_ranges
+class record_output_iterator
+{
+public:
+    typedef std::output_iterator_tag iterator_category;
+    typedef void value_type;
+    typedef void difference_type;
+    typedef void pointer;
+    typedef void reference;
+
+    record_output_iterator(output_writer& out, const options& opt)
+        : m_out(&out), m_opt(&opt)
+    {
+    }
+
+    record_output_iterator& operator=(const record& r)
+    {
+        write_record(*m_out, r, *m_opt);
+        return *this;
+    }
+
+    record_output_iterator& operator*()
+    {
+        return *this;
+    }
+
+    record_output_iterator& operator++()
+    {
+        return *this;
+    }
+
+    record_output_iterator operator++(int)
+    {
+        return *this;
+    }
+
+private:
+    output_writer* m_out;
+    const options* m_opt;
+};
+
+// reads a sorted run by blocks, top is the current record, its data stays in the block until pop
+class run_reader
+{
+public:
+    run_reader()
+        : m_opt(NULL), m_file(NULL), m_pos(0), m_end(0), m_eof(false), m_error(false)
+    {
+    }
+
+    ~run_reader()
+    {
+        close();
+    }
+
+    bool open(const char* path, size_t block, const options& opt)
+    {
+        m_opt = &opt;
+        m_file = baobao::internal::external_sort_open(path, "rb");
+        m_buf.resize(block);
+        m_pos = m_end = 0;
+        m_eof = false;
+        m_error = !m_file;
+        return m_file && pop();
+    }
+
+    void close()
+    {
+        if (m_file)
+            fclose(m_file);
+        m_file = NULL;
+    }
+
+    const record& top() const
+    {
+        return m_cur;
+    }
+
+    // moves to the next record, false at the end of the run
+    bool pop()
+    {
+        while (true)
+        {
+            size_t len = 0;
+            if (m_opt->record_size)
+            {
+                if (m_end - m_pos >= m_opt->record_size)
+                    len = m_opt->record_size;
+            }
+            else
+            {
+                const char* nl = (const char*)memchr(&m_buf[0] + m_pos, '\n', m_end - m_pos);
+                if (nl)
+                    len = nl - &m_buf[0] - m_pos + 1;
+            }
+            if (len > 0)
+            {
+                make_record(m_cur, &m_buf[0] + m_pos, m_opt->record_size ? len : len - 1, *m_opt);
+                m_pos += len;
+                return true;
+            }
+            if (m_eof || !fill())
+                return false;
+        }
+    }
+
+    bool error() const
+    {
+        return m_error;
+    }
+
+private:
+    // keeps the part of a record at the end of the block, and grows the block for a record longer than it
+    bool fill()
+    {
+        memmove(&m_buf[0], &m_buf[0] + m_pos, m_end - m_pos);
+        m_end -= m_pos;
+        m_pos = 0;
+        if (m_end == m_buf.size())
+            m_buf.resize(m_buf.size() * 2);
+        size_t n = fread(&m_buf[0] + m_end, 1, m_buf.size() - m_end, m_file);
+        m_end += n;
+        if (n == 0)
+        {
+            m_eof = true;
+            m_error = m_error || ferror(m_file) || m_end > 0;
+        }
+        return n > 0;
+    }
+
+    const options* m_opt;
+    FILE* m_file;
+    std::vector<char> m_buf;
+    size_t m_pos;
+    size_t m_end;
+    bool m_eof;
+    bool m_error;
+    record m_cur;
+};
+
+// input iterator over a run, the end iterator has no reader
+class run_iterator
+{
+public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef record value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const record* pointer;
+    typedef const record& reference;
+
+    explicit run_iterator(run_reader* reader = NULL)
+        : m_reader(reader)
+    {
+    }
+
+    const record& operator*() const
+    {
+        return m_reader->top();
+    }
+
+    run_iterator& operator++()
+    {
+        if (!m_reader->pop())
+            m_reader = NULL;
+        return *this;
+    }
+
+    run_iterator operator++(int)
+    {
+        run_iterator it = *this;
+        ++*this;
+        return it;
+    }
+
+    bool operator==(const run_iterator& it) const
+    {
+        return m_reader == it.m_reader;
+    }
+
+    bool operator!=(const run_iterator& it) const
+    {
+        return m_reader != it.m_reader;
+    }
+
+private:
+    run_reader* m_reader;
+};
+
+void sort_records(std::vector<record>& records, const options& opt)
+{
+    if (records.empty())
+        return;
+    if (opt.stable)
+        baobao::sort::parallel_merge_sort(records.begin(), records.end(), record_less(opt), opt.threads);
+    else
+        baobao::sort::parallel_sample_sort(records.begin(), records.end(), record_less(opt), opt.threads);
+}
+
+bool write_records(const std::vector<record>& records, FILE* file, const options& opt)
+{
+    output_writer out;
+    if (!out.open(file))
+        return false;
+    for (size_t i = 0; i < records.size(); ++i)
+        write_record(out, records[i], opt);
+    return out.close();
+}
+
+FILE* open_output(const options& opt)
+{
+    if (!opt.output)
+        return stdout;
+    FILE* file = fopen(opt.output, "wb");
+    if (!file)
+        fprintf(stderr, "baosort: cannot write %s\n", opt.output);
+    return file;
+}
+
+void remove_runs(const std::vector<baobao::internal::external_sort_run>& runs, size_t beg, size_t end)
+{
+    for (size_t i = beg; i < end; ++i)
+        remove(runs[i].path);
+}
+
+// the input is read in chunks of data and records up to the memory limit, a chunk ends at the last
+// whole record, the rest is moved to the front for the next one. a single chunk goes straight to the output
+bool make_runs(const options& opt, std::vector<baobao::internal::external_sort_run>& runs, bool& done)
+{
+    input_reader in(opt);
+    std::vector<char> data;
+    std::vector<record> records;
+    size_t filled = 0, block = std::max(std::min(opt.memory / 8, (size_t)io_block_bytes), (size_t)io_block_min_bytes);
+    data.reserve(opt.memory + block);
+    bool end = false;
+    done = false;
+    while (!end)
+    {
+        // the rest of the last chunk holds no whole record
+        size_t count = 0, scan = filled;
+        while (filled + count * sizeof(record) < opt.memory || count == 0)
+        {
+            data.resize(filled + block);
+            size_t n = in.read(&data[filled], block);
+            if (n == 0)
+            {
+                end = true;
+                break;
+            }
+            filled += n;
+            if (opt.record_size)
+            {
+                count = filled / opt.record_size;
+            }
+            else
+            {
+                for (const char* p = &data[0] + scan; (p = (const char*)memchr(p, '\n', &data[0] + filled - p)) != NULL; ++p)
+                    ++count;
+                scan = filled;
+            }
+        }
+        if (in.error())
+            return false;
+
+        size_t whole = 0;
+        records.clear();
+        records.reserve(count);
+        while (whole < filled)
+        {
+            size_t len;
+            if (opt.record_size)
+            {
+                if (filled - whole < opt.record_size)
+                    break;
+                len = opt.record_size;
+            }
+            else
+            {
+                const char* nl = (const char*)memchr(&data[0] + whole, '\n', filled - whole);
+                if (!nl)
+                    break;
+                len = nl - &data[0] - whole;
+                if (len > 0xffffffffu)
+                {
+                    fprintf(stderr, "baosort: line too long\n");
+                    return false;
+                }
+            }
+            records.push_back(record());
+            make_record(records.back(), &data[0] + whole, len, opt);
+            whole += opt.record_size ? len : len + 1;
+        }
+        if (end && whole < filled)
+        {
+            fprintf(stderr, "baosort: the input is not a whole number of records\n");
+            return false;
+        }
+        sort_records(records, opt);
+
+        if (end && runs.empty())
+        {
+            done = true;
+            FILE* file = open_output(opt);
+            return file && write_records(records, file, opt);
+        }
+        baobao::internal::external_sort_run run;
+        run.count = records.size();
+        FILE* file = baobao::internal::external_sort_create_temp(run.path, opt.temp_dir.c_str());
+        if (!file)
+        {
+            fprintf(stderr, "baosort: cannot create a temporary file in %s\n", opt.temp_dir.c_str());
+            return false;
+        }
+        runs.push_back(run);
+        if (!write_records(records, file, opt))
+            return false;
+        memmove(&data[0], &data[0] + whole, filled - whole);
+        filled -= whole;
+    }
+    return true;
+}
+
+bool merge_runs(const std::vector<baobao::internal::external_sort_run>& runs, size_t beg, size_t end, FILE* file, const options& opt)
+{
+    size_t k = end - beg;
+    size_t block = std::max(opt.memory / (k + 1), (size_t)run_block_min_bytes);
+    std::vector<run_reader> readers(k);
+    std::vector<std::pair<run_iterator, run_iterator> > ranges(k);
+    bool ok = true;
+    for (size_t i = 0; i < k; ++i)
+    {
+        if (readers[i].open(runs[beg + i].path, block, opt))
+            ranges[i].first = run_iterator(&readers[i]);
+        ok = ok && !readers[i].error();
+    }
+    output_writer out;
+    if (!out.open(file))
+        return false;
+    if (ok)
+        baobao::sort::merge_ranges(ranges.begin(), k, record_output_iterator(out, opt), record_less(opt));
+    for (size_t i = 0; i < k; ++i)
+        ok = ok && !readers[i].error();
+    return out.close() && ok;
+}
+
+// merges neighbouring groups of runs level by level, so equal keys keep the order of the input
+bool sort_input(const options& opt)
+{
+    std::vector<baobao::internal::external_sort_run> runs;
+    bool done = false;
+    bool ok = make_runs(opt, runs, done);
+    size_t ways = std::min(std::max(opt.memory / run_block_min_bytes, (size_t)2), (size_t)max_merge_ways);
+    while (ok && !done)
+    {
+        std::vector<baobao::internal::external_sort_run> merged_runs;
+        for (size_t first = 0; ok && first < runs.size(); first += ways)
+        {
+            size_t last = std::min(first + ways, runs.size());
+            if (runs.size() <= ways)
+            {
+                FILE* file = open_output(opt);
+                ok = file && merge_runs(runs, first, last, file, opt);
+                done = true;
+                break;
+            }
+            baobao::internal::external_sort_run merged;
+            FILE* file = baobao::internal::external_sort_create_temp(merged.path, opt.temp_dir.c_str());
+            ok = file != NULL;
+            if (file)
+                merged_runs.push_back(merged);
+            ok = ok && merge_runs(runs, first, last, file, opt);
+        }
+        remove_runs(runs, 0, runs.size());
+        runs.swap(merged_runs);
+    }
+    remove_runs(runs, 0, runs.size());
+    return ok;
+}
+
+bool parse_size(const char* s, size_t& size)
+{
+    char* end;
+    double v = strtod(s, &end);
+    double unit = 1;
+    switch (*end)
+    {
+    case 'k': case 'K': unit = 1024.0; ++end; break;
+    case 'm': case 'M': unit = 1024.0 * 1024; ++end; break;
+    case 'g': case 'G': unit = 1024.0 * 1024 * 1024; ++end; break;
+    case 'b': case 'B': ++end; break;
+    }
+    size = (size_t)(v * unit);
+    return end != s && *end == 0 && v >= 0;
+}
+
+bool parse_key(const char* s, size_t& beg, size_t& end)
+{
+    char* p;
+    beg = strtoul(s, &p, 10);
+    end = 0;
+    if (*p == ',')
+        end = strtoul(p + 1, &p, 10);
+    return *p == 0 && p != s;
+}
+
+void usage()
+{
+    fprintf(stderr,
+        "usage: baosort [options] [file...]\n"
+        "sorts the lines of the files, or stdin, to stdout\n"
+        "  -k F1[,F2]  the key is from field F1 to the end of field F2, or of the line, fields count from 1\n"
+        "  -t C        fields are separated by C, not by runs of blanks\n"
+        "  -n          numeric keys: blanks, an optional minus, digits and a fraction\n"
+        "  -r          reverse the order\n"
+        "  -s          stable, equal keys keep the input order instead of comparing the whole lines\n"
+        "  -w SIZE     binary records of SIZE bytes instead of lines, -k OFFSET[,LENGTH] is then\n"
+        "              the key in bytes from 0, and -n reads it as a little endian unsigned integer\n"
+        "  -S SIZE     memory limit, with the suffix K, M or G, default 1G\n"
+        "  -T DIR      directory of the temporary files, default $TMPDIR or /tmp\n"
+        "  -j N        threads, default all\n"
+        "  -o FILE     write to FILE, which may be one of the inputs\n");
+}
+
+bool parse_options(int argc, char* argv[], options& opt)
+{
+    opt.record_size = 0;
+    opt.key_beg = opt.key_end = 0;
+    opt.separator = 0;
+    opt.numeric = opt.reverse = opt.stable = false;
+    opt.memory = (size_t)1 << 30;
+    opt.threads = 0;
+    const char* tmp = getenv("TMPDIR");
+    opt.temp_dir = tmp && *tmp ? tmp : "/tmp";
+    opt.output = NULL;
+    const char* key = NULL;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        if (arg[0] != '-' || arg[1] == 0)
+        {
+            opt.inputs.push_back(arg);
+            continue;
+        }
+        if (strcmp(arg, "--") == 0)
+        {
+            for (++i; i < argc; ++i)
+                opt.inputs.push_back(argv[i]);
+            break;
+        }
+        for (const char* p = arg + 1; *p; ++p)
+        {
+            char c = *p;
+            if (c == 'n' || c == 'r' || c == 's')
+            {
+                (c == 'n' ? opt.numeric : c == 'r' ? opt.reverse : opt.stable) = true;
+                continue;
+            }
+            if (strchr("ktwSTjo", c) == NULL)
+            {
+                usage();
+                return false;
+            }
+            const char* value = p[1] ? p + 1 : i + 1 < argc ? argv[++i] : NULL;
+            if (!value)
+            {
+                usage();
+                return false;
+            }
+            bool ok = true;
+            size_t size = 0;
+            switch (c)
+            {
+            case 'k': key = value; break;
+            case 't': opt.separator = value[0]; ok = value[0] && !value[1]; break;
+            case 'w': ok = parse_size(value, opt.record_size) && opt.record_size > 0; break;
+            case 'S': ok = parse_size(value, opt.memory); break;
+            case 'T': opt.temp_dir = value; break;
+            case 'j': ok = parse_size(value, size); opt.threads = (unsigned)size; break;
+            case 'o': opt.output = value; break;
+            }
+            if (!ok)
+            {
+                fprintf(stderr, "baosort: invalid -%c %s\n", c, value);
+                return false;
+            }
+            break;
+        }
+    }
+    if (opt.inputs.empty())
+        opt.inputs.push_back("-");
+
+    if (key && !parse_key(key, opt.key_beg, opt.key_end))
+    {
+        fprintf(stderr, "baosort: invalid -k %s\n", key);
+        return false;
+    }
+    if (opt.record_size)
+    {
+        if (opt.key_beg < opt.record_size && opt.key_end == 0)
+            opt.key_end = opt.record_size - opt.key_beg;
+        if (opt.key_beg + opt.key_end > opt.record_size || opt.key_end == 0 || (opt.numeric && opt.key_end > 8))
+        {
+            fprintf(stderr, "baosort: invalid key for records of %lu bytes\n", (unsigned long)opt.record_size);
+            return false;
+        }
+    }
+    else if (key && (opt.key_beg == 0 || (opt.key_end && opt.key_end < opt.key_beg)))
+    {
+        fprintf(stderr, "baosort: invalid -k %s\n", key);
+        return false;
+    }
+    return true;
+}
+
+} // namespace baosort
+
+int main(int argc, char* argv[])
+{
+    baosort::options opt;
+    if (!baosort::parse_options(argc, argv, opt))
+        return 2;
+    return baosort::sort_input(opt) ? 0 : 2;
+}
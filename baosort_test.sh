@@ -0,0 +1,90 @@
+#!/bin/sh
+# filename:    baosort_test.sh
+# author:      baobaobear
+# create date: 2026-10-18
+# Checks the output of baosort against LC_ALL=C sort on generated text, sorted in memory and through
+# the external merge of -S, and binary records of -w against the order built from a hex dump of them.
+# usage: sh baosort_test.sh [path of baosort]
+
+BAOSORT=${1:-./baosort}
+LC_ALL=C
+export LC_ALL
+dir=$(mktemp -d "${TMPDIR:-/tmp}/baosort_test.XXXXXX") || exit 1
+trap 'rm -rf "$dir"' EXIT
+trap 'exit 2' HUP INT PIPE TERM
+mkdir "$dir/temp"
+failed=0
+
+# name, expected file, actual file. the temporary directory of -T has to be empty again
+check()
+{
+    if ! cmp -s "$2" "$3"; then
+        echo "FAIL: $1"
+        failed=1
+    elif [ -n "$(ls "$dir/temp")" ]; then
+        echo "FAIL: $1 left temporary files"
+        rm -f "$dir/temp"/*
+        failed=1
+    fi
+}
+
+# lines of words with ties, bytes above 0x7f, and numbers with signs, leading zeros and fractions
+awk 'BEGIN {
+    srand(1);
+    split("a A b ~ \303 ab aA", letters, " ");
+    for (i = 0; i < 20000; ++i) {
+        w1 = letters[int(rand() * 7) + 1] letters[int(rand() * 7) + 1];
+        w2 = rand() < 0.1 ? "" : letters[int(rand() * 7) + 1];
+        n1 = (rand() < 0.3 ? "-" : "") (rand() < 0.2 ? "00" : "") int(rand() * 100) (rand() < 0.3 ? "." int(rand() * 100) : "");
+        n2 = rand() < 0.1 ? "x" : int(rand() * 1000) - 500;
+        printf "%s %s\t%s,%s %s\n", w1, n1, w2, n2, (rand() < 0.05 ? "" : w1);
+    }
+}' > "$dir/text"
+
+for opts in "" "-r" "-s" "-k2" "-k2,2 -n" "-k2,2 -n -r" "-t, -k2" "-t, -k2,2 -n -s" "-k3,3 -s" "-k1,1 -r -s" "-n"; do
+    sort $opts "$dir/text" > "$dir/expect"
+    "$BAOSORT" $opts "$dir/text" > "$dir/out"
+    check "text $opts" "$dir/expect" "$dir/out"
+    "$BAOSORT" $opts -S 64K -T "$dir/temp" "$dir/text" > "$dir/out"
+    check "text $opts -S 64K" "$dir/expect" "$dir/out"
+    "$BAOSORT" $opts -j 1 -o "$dir/out" "$dir/text"
+    check "text $opts -j 1 -o" "$dir/expect" "$dir/out"
+done
+
+# records of 12 bytes out of 0x00, 0x01, 0x80 and 0xff, so the keys have ties and bytes above 0x7f
+awk 'BEGIN { srand(2); for (i = 0; i < 30000 * 12; ++i) printf "%d", int(rand() * 4) }' | tr '0123' '\000\001\200\377' > "$dir/bin"
+
+# one line of hex per record of $1 bytes
+to_hex()
+{
+    od -An -v -tx1 | awk -v size="$1" '{ for (i = 1; i <= NF; ++i) { line = line $i; if (++n == size) { print line; line = ""; n = 0 } } }'
+}
+
+# the key bytes in hex in front of every record, reversed for a little endian number, then sort
+# orders them like memcmp of the key and of the whole record on ties
+sort_hex()
+{
+    to_hex 12 < "$dir/bin" | awk -v off="$1" -v len="$2" -v le="$3" '{
+        k = substr($0, 2 * off + 1, 2 * len);
+        if (le) { r = ""; for (i = len - 1; i >= 0; --i) r = r substr(k, 2 * i + 1, 2); k = r }
+        print k " " $0
+    }' | sort $4 | cut -d' ' -f2
+}
+
+for key in "0 12 0 :" "0 12 0 :-r" "3 4 0 :" "3 2 0 :-s" "0 2 0 :-r -s" "2 4 1 :-n" "2 4 1 :-n -r" "5 3 1 :-n -s"; do
+    set -- ${key%%:*}
+    opts=${key#*:}
+    ref=
+    case "$opts" in *-r*) ref="-r" ;; esac
+    case "$opts" in *-s*) ref="$ref -s -k1,1" ;; esac
+    sort_hex "$1" "$2" "$3" "$ref" > "$dir/expect"
+    "$BAOSORT" -w 12 -k "$1,$2" $opts "$dir/bin" | to_hex 12 > "$dir/out"
+    check "binary -k $1,$2 $opts" "$dir/expect" "$dir/out"
+    "$BAOSORT" -w 12 -k "$1,$2" $opts -S 64K -T "$dir/temp" "$dir/bin" | to_hex 12 > "$dir/out"
+    check "binary -k $1,$2 $opts -S 64K" "$dir/expect" "$dir/out"
+done
+
+if [ $failed -eq 0 ]; then
+    echo "baosort matches sort"
+fi
+exit $failed
@@ -0,0 +1,983 @@
+// filename:    extsort.hpp
+// author:      baobaobear
+// create date: 2026-10-18
+// External sort of fixed-size records, for files larger than the memory
+// and the in place sort of a file of records through mmap
+// This library is compatible with C++03, the I/O overlaps the sorting with C++11
+
+#ifndef _BAOBAO_EXTSORT_HPP_
+#define _BAOBAO_EXTSORT_HPP_
+#pragma once
+
+#include "sortlib.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#ifdef BAO_SORT_LIB_PARALLEL
+    #include <future>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define BAO_SORT_LIB_MMAP
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#elif defined(_WIN32)
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <io.h>
+    #include <sys/stat.h>
+#endif
+
+namespace baobao
+{
+enum
+{
+    external_sort_min_block_bytes = 1 << 20,
+    external_sort_max_path = 4096,
+    sort_file_insertion_sort_threshold = 32,
+    sort_file_block_bytes = 32768,
+    sort_file_scratch_bytes = 1 << 26
+};
+
+namespace internal
+{
+
+// a temporary file of sorted records, removed with its name when the run is closed. an empty path is
+// the run written straight to the output, which is never removed
+struct external_sort_run
+{
+    char path[external_sort_max_path];
+    size_t count;
+};
+
+inline FILE* external_sort_open(const char* path, const char* mode)
+{
+    FILE* file = fopen(path, mode);
+    if (file)
+        setvbuf(file, NULL, _IONBF, 0); // every read and write is a whole block
+    return file;
+}
+
+// creates a new temporary file in temp_dir open for writing, its name goes to path. the file is made
+// with O_EXCL, so a file or a symlink planted under the name is never followed or truncated
+inline FILE* external_sort_create_temp(char* path, const char* temp_dir)
+{
+    size_t len = strlen(temp_dir);
+    if (len + 64 >= (size_t)external_sort_max_path)
+        return NULL;
+    FILE* file = NULL;
+#if defined(__unix__) || defined(__APPLE__)
+    sprintf(path, "%s/baosort_XXXXXX", temp_dir);
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return NULL;
+    file = fdopen(fd, "wb");
+    if (!file)
+    {
+        close(fd);
+        remove(path);
+        return NULL;
+    }
+#else
+    // no mkstemp, a name that is taken is skipped to the next serial
+#ifdef BAO_SORT_LIB_PARALLEL
+    static std::atomic<unsigned long> serial(0);
+#else
+    static unsigned long serial = 0;
+#endif
+    for (int attempt = 0; !file && attempt < 100; ++attempt)
+    {
+        sprintf(path, "%s/baosort_%lx_%lx.run", temp_dir, (unsigned long)time(NULL), (unsigned long)++serial);
+        int fd = _open(path, _O_CREAT | _O_EXCL | _O_WRONLY | _O_BINARY, _S_IREAD | _S_IWRITE);
+        if (fd < 0)
+        {
+            if (errno != EEXIST)
+                return NULL;
+            continue;
+        }
+        file = _fdopen(fd, "wb");
+        if (!file)
+        {
+            _close(fd);
+            remove(path);
+            return NULL;
+        }
+    }
+    if (!file)
+        return NULL;
+#endif
+    setvbuf(file, NULL, _IONBF, 0);
+    return file;
+}
+
+template <class T>
+size_t external_sort_read(FILE* file, T* buf, size_t count)
+{
+    size_t total = 0;
+    while (total < count)
+    {
+        size_t got = fread(buf + total, sizeof(T), count - total, file);
+        if (got == 0)
+            break;
+        total += got;
+    }
+    return total;
+}
+
+template <class T>
+bool external_sort_write(FILE* file, const T* buf, size_t count)
+{
+    return fwrite(buf, sizeof(T), count, file) == count;
+}
+
+// reads a run by blocks, the next block is read in the background while the current one is merged
+template <class T>
+class external_sort_reader
+{
+public:
+    external_sort_reader()
+        : m_file(NULL), m_left(0), m_loading(0), m_pos(NULL), m_end(NULL), m_error(false)
+    {
+    }
+
+    ~external_sort_reader()
+    {
+        close();
+    }
+
+    bool open(const char* path, size_t count, size_t block)
+    {
+        m_file = external_sort_open(path, "rb");
+        m_left = count;
+        m_block[0].resize(block);
+        m_block[1].resize(block);
+        if (!m_file)
+            return false;
+        start(m_loading = 0);
+        return next();
+    }
+
+    void close()
+    {
+#ifdef BAO_SORT_LIB_PARALLEL
+        if (m_pending.valid())
+            m_pending.wait();
+#endif
+        if (m_file)
+            fclose(m_file);
+        m_file = NULL;
+    }
+
+    // switches to the block read ahead, and reads the one after it into the block done with
+    bool next()
+    {
+        size_t got = finish();
+        if (got == 0)
+            return false;
+        m_pos = &m_block[m_loading][0];
+        m_end = m_pos + got;
+        start(m_loading = 1 - m_loading);
+        return true;
+    }
+
+    bool error() const
+    {
+        return m_error;
+    }
+
+    const T& top() const
+    {
+        return *m_pos;
+    }
+
+    // false once the run is used up
+    bool pop()
+    {
+        return ++m_pos < m_end || next();
+    }
+
+private:
+    size_t load(int b)
+    {
+        size_t want = std::min(m_left, m_block[b].size());
+        size_t got = external_sort_read(m_file, &m_block[b][0], want);
+        if (got != want)
+            m_error = true;
+        m_left -= want;
+        return got;
+    }
+
+#ifdef BAO_SORT_LIB_PARALLEL
+    void start(int b)
+    {
+        if (m_left > 0)
+            m_pending = std::async(std::launch::async, &external_sort_reader::load, this, b);
+    }
+
+    size_t finish()
+    {
+        return m_pending.valid() ? m_pending.get() : 0;
+    }
+
+    std::future<size_t> m_pending;
+#else
+    void start(int b)
+    {
+        m_loaded = load(b);
+    }
+
+    size_t finish()
+    {
+        return m_loaded;
+    }
+
+    size_t m_loaded;
+#endif
+
+    FILE* m_file;
+    size_t m_left;
+    std::vector<T> m_block[2];
+    int m_loading;
+    T* m_pos;
+    T* m_end;
+    bool m_error;
+};
+
+// input iterator over a reader, the end iterator has no reader
+template <class T>
+class external_sort_reader_iterator
+{
+public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef T value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const T* pointer;
+    typedef const T& reference;
+
+    explicit external_sort_reader_iterator(external_sort_reader<T>* reader = NULL)
+        : m_reader(reader)
+    {
+    }
+
+    const T& operator*() const
+    {
+        return m_reader->top();
+    }
+
+    external_sort_reader_iterator& operator++()
+    {
+        if (!m_reader->pop())
+            m_reader = NULL;
+        return *this;
+    }
+
+    external_sort_reader_iterator operator++(int)
+    {
+        external_sort_reader_iterator it = *this;
+        ++*this;
+        return it;
+    }
+
+    bool operator==(const external_sort_reader_iterator& it) const
+    {
+        return m_reader == it.m_reader;
+    }
+
+    bool operator!=(const external_sort_reader_iterator& it) const
+    {
+        return m_reader != it.m_reader;
+    }
+
+private:
+    external_sort_reader<T>* m_reader;
+};
+
+// writes by blocks, a full block is written in the background while the other one fills
+template <class T>
+class external_sort_writer
+{
+public:
+    external_sort_writer()
+        : m_file(NULL), m_fill(0), m_count(0), m_error(false)
+    {
+    }
+
+    ~external_sort_writer()
+    {
+        close();
+    }
+
+    // takes over file, it is closed by close
+    bool open(FILE* file, size_t block)
+    {
+        m_file = file;
+        m_block[0].resize(block);
+        m_block[1].resize(block);
+        m_fill = m_count = 0;
+        m_current = 0;
+        return m_file != NULL;
+    }
+
+    void push(const T& val)
+    {
+        m_block[m_current][m_fill++] = val;
+        if (m_fill == m_block[m_current].size())
+            flush();
+    }
+
+    // false if any write failed
+    bool close()
+    {
+        if (m_file)
+        {
+            flush();
+            finish();
+            if (fclose(m_file) != 0)
+                m_error = true;
+            m_file = NULL;
+        }
+        return !m_error;
+    }
+
+    size_t count() const
+    {
+        return m_count + m_fill;
+    }
+
+private:
+    void flush()
+    {
+        finish();
+        if (m_fill > 0)
+        {
+            start(m_current, m_fill);
+            m_count += m_fill;
+            m_current = 1 - m_current;
+            m_fill = 0;
+        }
+    }
+
+    bool store(int b, size_t count)
+    {
+        return external_sort_write(m_file, &m_block[b][0], count);
+    }
+
+#ifdef BAO_SORT_LIB_PARALLEL
+    void start(int b, size_t count)
+    {
+        m_pending = std::async(std::launch::async, &external_sort_writer::store, this, b, count);
+    }
+
+    void finish()
+    {
+        if (m_pending.valid() && !m_pending.get())
+            m_error = true;
+    }
+
+    std::future<bool> m_pending;
+#else
+    void start(int b, size_t count)
+    {
+        if (!store(b, count))
+            m_error = true;
+    }
+
+    void finish()
+    {
+    }
+#endif
+
+    FILE* m_file;
+    std::vector<T> m_block[2];
+    size_t m_fill;
+    size_t m_count;
+    int m_current;
+    bool m_error;
+};
+
+// output iterator into a writer
+template <class T>
+class external_sort_writer_iterator
+{
+public:
+    typedef std::output_iterator_tag iterator_category;
+    typedef void value_type;
+    typedef void difference_type;
+    typedef void pointer;
+    typedef void reference;
+
+    explicit external_sort_writer_iterator(external_sort_writer<T>* writer)
+        : m_writer(writer)
+    {
+    }
+
+    external_sort_writer_iterator& operator=(const T& val)
+    {
+        m_writer->push(val);
+        return *this;
+    }
+
+    external_sort_writer_iterator& operator*()
+    {
+        return *this;
+    }
+
+    external_sort_writer_iterator& operator++()
+    {
+        return *this;
+    }
+
+    external_sort_writer_iterator operator++(int)
+    {
+        return *this;
+    }
+
+private:
+    external_sort_writer<T>* m_writer;
+};
+
+template <class T, class Comp>
+void external_sort_chunk(T* beg, T* end, Comp compare, bool stable)
+{
+    if (stable)
+        tim_sort_buffer<false, timsort_policy>(beg, end, (size_t)(end - beg), compare);
+    else
+        quick_sort<false>(beg, end, compare);
+}
+
+inline void external_sort_remove(std::vector<external_sort_run>& runs, size_t beg, size_t end)
+{
+    for (size_t i = beg; i < end; ++i)
+        remove(runs[i].path);
+}
+
+// cuts the input into sorted runs of chunk records, the next chunk is read in the background while
+// the current one is sorted and written, a single chunk goes straight to output_path
+template <class T, class Comp>
+bool external_sort_make_runs(FILE* input, const char* output_path, const char* temp_dir, size_t chunk, Comp compare, bool stable, std::vector<external_sort_run>& runs)
+{
+    std::vector<T> cur(chunk), ahead(chunk);
+    size_t count = external_sort_read(input, &cur[0], chunk);
+    bool ok = !ferror(input);
+    while (ok && (count > 0 || runs.empty()))
+    {
+#ifdef BAO_SORT_LIB_PARALLEL
+        std::future<size_t> pending;
+        if (count == chunk)
+            pending = std::async(std::launch::async, &external_sort_read<T>, input, &ahead[0], chunk);
+#endif
+        external_sort_chunk(&cur[0], &cur[0] + count, compare, stable);
+
+        size_t next = 0;
+#ifdef BAO_SORT_LIB_PARALLEL
+        if (pending.valid())
+            next = pending.get();
+#else
+        if (count == chunk)
+            next = external_sort_read(input, &ahead[0], chunk);
+#endif
+        ok = !ferror(input);
+
+        external_sort_run run;
+        run.count = count;
+        FILE* file;
+        if (runs.empty() && next == 0)
+        {
+            run.path[0] = '\0';
+            file = external_sort_open(output_path, "wb");
+        }
+        else
+        {
+            file = external_sort_create_temp(run.path, temp_dir);
+        }
+        if (!file)
+        {
+            ok = false;
+            break;
+        }
+        runs.push_back(run);
+        ok = ok && external_sort_write(file, &cur[0], count);
+        ok = fclose(file) == 0 && ok;
+        cur.swap(ahead);
+        count = next;
+    }
+    return ok;
+}
+
+// merges runs [beg, end) into file with a loser tree over the readers, each of them reads ahead in the background,
+// file is closed at the end
+template <class T, class Comp>
+bool external_sort_merge(std::vector<external_sort_run>& runs, size_t beg, size_t end, FILE* file, size_t block, Comp compare, size_t& count)
+{
+    size_t k = end - beg;
+    std::vector<external_sort_reader<T> > readers(k);
+    std::vector<external_sort_reader_iterator<T> > cur(k), last(k);
+    bool ok = true;
+    for (size_t i = 0; ok && i < k; ++i)
+    {
+        ok = readers[i].open(runs[beg + i].path, runs[beg + i].count, block);
+        cur[i] = external_sort_reader_iterator<T>(&readers[i]);
+    }
+    external_sort_writer<T> writer;
+    if (!writer.open(file, block))
+        return false;
+    if (ok)
+        merge_loser_tree(&cur[0], &last[0], k, external_sort_writer_iterator<T>(&writer), compare);
+    for (size_t i = 0; i < k; ++i)
+    {
+        readers[i].close();
+        ok = ok && !readers[i].error();
+    }
+    count = writer.count();
+    return writer.close() && ok;
+}
+
+// stable if stable is true, runs of memory_bytes / 2 are sorted by tim_sort (stable) or quick_sort,
+// then merged with as many ways as blocks of external_sort_min_block_bytes fit in memory_bytes
+template <class T, class Comp>
+bool external_sort(const char* input_path, const char* output_path, const char* temp_dir, size_t memory_bytes, Comp compare, bool stable)
+{
+    FILE* input = external_sort_open(input_path, "rb");
+    if (!input)
+        return false;
+
+    std::vector<external_sort_run> runs;
+    size_t chunk = std::max(memory_bytes / 2 / sizeof(T), (size_t)1);
+    bool ok = external_sort_make_runs<T>(input, output_path, temp_dir, chunk, compare, stable, runs);
+    fclose(input);
+    if (!ok || runs.size() == 1)
+    {
+        if (runs.size() > 1 || (!ok && !runs.empty() && runs[0].path[0] != '\0'))
+            external_sort_remove(runs, 0, runs.size());
+        return ok;
+    }
+
+    // every reader and the writer take two blocks. a pass merges neighbouring groups of runs,
+    // and keeps the merged runs in the order of the input, so equal keys stay in order
+    size_t ways = std::max(memory_bytes / external_sort_min_block_bytes / 2, (size_t)3) - 1;
+    while (ok && runs.size() > 1)
+    {
+        std::vector<external_sort_run> merged_runs;
+        size_t first = 0;
+        for (; ok && first < runs.size(); first += ways)
+        {
+            size_t last = std::min(first + ways, runs.size());
+            if (last - first == 1)
+            {
+                merged_runs.push_back(runs[first]);
+                continue;
+            }
+            size_t block = std::max(memory_bytes / (2 * (last - first + 1)) / sizeof(T), (size_t)1);
+            external_sort_run merged;
+            FILE* file = runs.size() <= ways ? external_sort_open(output_path, "wb") : external_sort_create_temp(merged.path, temp_dir);
+            if (!file)
+                ok = false;
+            if (ok)
+            {
+                ok = external_sort_merge<T>(runs, first, last, file, block, compare, merged.count);
+                if (ok && runs.size() > ways)
+                    merged_runs.push_back(merged);
+                else if (runs.size() > ways)
+                    remove(merged.path);
+            }
+            external_sort_remove(runs, first, last);
+        }
+        if (!ok)
+        {
+            external_sort_remove(runs, first, runs.size());
+            external_sort_remove(merged_runs, 0, merged_runs.size());
+        }
+        runs.swap(merged_runs);
+    }
+    return ok;
+}
+
+// records of record_size bytes, ordered by the key_len bytes at key_offset like memcmp
+struct sort_file_records
+{
+    size_t record_size;
+    size_t key_offset;
+    size_t key_len;
+    unsigned char* tmp;
+
+    unsigned char key(const unsigned char* record, size_t depth) const
+    {
+        return record[key_offset + depth];
+    }
+
+    bool less(const unsigned char* a, const unsigned char* b, size_t depth) const
+    {
+        return memcmp(a + key_offset + depth, b + key_offset + depth, key_len - depth) < 0;
+    }
+
+    void swap(unsigned char* a, unsigned char* b) const
+    {
+        memcpy(tmp, a, record_size);
+        memcpy(a, b, record_size);
+        memcpy(b, tmp, record_size);
+    }
+};
+
+inline void sort_file_insert_sort(unsigned char* beg, unsigned char* end, const sort_file_records& rec, size_t depth)
+{
+    for (unsigned char* i = beg + rec.record_size; i < end; i += rec.record_size)
+    {
+        if (!rec.less(i, i - rec.record_size, depth))
+            continue;
+        unsigned char* j = i - rec.record_size;
+        memcpy(rec.tmp, i, rec.record_size);
+        while (j > beg && rec.less(rec.tmp, j - rec.record_size, depth))
+            j -= rec.record_size;
+        memmove(j + rec.record_size, j, (size_t)(i - j));
+        memcpy(j, rec.tmp, rec.record_size);
+    }
+}
+
+// moves every record to the bucket of its key byte at depth, bucket i is [split_iter[i], split_iter[i + 1])
+inline void sort_file_permute(unsigned char* const* split_iter, const sort_file_records& rec, size_t depth)
+{
+    unsigned char* sort_iter[256];
+    memcpy(sort_iter, split_iter, sizeof(sort_iter));
+    for (size_t i = 0; i < 256; ++i)
+    {
+        for (unsigned char* cur = sort_iter[i]; cur < split_iter[i + 1]; cur = sort_iter[i])
+        {
+            size_t index = rec.key(cur, depth);
+            while (index != i)
+            {
+                rec.swap(cur, sort_iter[index]);
+                sort_iter[index] += rec.record_size;
+                index = rec.key(cur, depth);
+            }
+            sort_iter[i] += rec.record_size;
+        }
+    }
+}
+
+// american flag sort, the in place msd radix sort of radix_sort_msd_in_place on the key byte at depth,
+// a level where all of the records fall in one bucket goes on to the next byte without recursion
+inline void sort_file_radix_sort(unsigned char* beg, unsigned char* end, const sort_file_records& rec, size_t depth)
+{
+    size_t counter[256];
+    unsigned char* _split_iter[257], ** split_iter = &_split_iter[1];
+    for (; depth < rec.key_len; ++depth)
+    {
+        if ((size_t)(end - beg) < sort_file_insertion_sort_threshold * rec.record_size)
+        {
+            sort_file_insert_sort(beg, end, rec, depth);
+            return;
+        }
+        memset(counter, 0, sizeof(counter));
+        for (unsigned char* i = beg; i < end; i += rec.record_size)
+            counter[rec.key(i, depth)]++;
+        if (counter[rec.key(beg, depth)] * rec.record_size < (size_t)(end - beg))
+            break;
+    }
+    if (depth >= rec.key_len)
+        return;
+
+    _split_iter[0] = beg;
+    for (size_t i = 0; i < 256; ++i)
+        split_iter[i] = split_iter[i - 1] + counter[i] * rec.record_size;
+    sort_file_permute(_split_iter, rec, depth);
+    for (size_t i = 0; i < 256; ++i)
+    {
+        if (counter[i] > 1)
+            sort_file_radix_sort(split_iter[i - 1], split_iter[i], rec, depth + 1);
+    }
+}
+
+// american flag sort on the key byte at depth with a buffer of block records per bucket, a full buffer is
+// written to the front of its bucket at once, after the records there have been read onto the stack.
+// every record is written once where it belongs, so a page of the file is only dirtied once
+struct sort_file_distribution
+{
+    unsigned char* beg;
+    size_t len;
+    size_t block;
+    size_t depth;
+    const sort_file_records& rec;
+    std::vector<unsigned char> out;   // the records bound for a bucket, block of them per bucket
+    std::vector<unsigned char> stack; // the records read from the file, not yet put in a buffer
+    size_t stack_len;
+    size_t fill[256];
+    size_t bucket_beg[257];
+    size_t head[256];   // the next place to write in the bucket
+    size_t unread[256]; // the next record of the bucket that has not been read
+
+    sort_file_distribution(unsigned char* _beg, size_t _len, size_t _depth, const sort_file_records& _rec, size_t memory_bytes)
+        : beg(_beg)
+        , len(_len)
+        , block(std::max(std::max(memory_bytes / 514, (size_t)sort_file_block_bytes) / _rec.record_size, (size_t)1))
+        , depth(_depth)
+        , rec(_rec)
+        , stack_len(0)
+    {
+    }
+
+    unsigned char* at(size_t pos) const
+    {
+        return beg + pos * rec.record_size;
+    }
+
+    void count()
+    {
+        size_t counter[256] = { 0 };
+        for (size_t i = 0; i < len; ++i)
+            counter[rec.key(at(i), depth)]++;
+        bucket_beg[0] = 0;
+        for (size_t b = 0; b < 256; ++b)
+        {
+            bucket_beg[b + 1] = bucket_beg[b] + counter[b];
+            head[b] = unread[b] = bucket_beg[b];
+            fill[b] = 0;
+        }
+    }
+
+    void read(size_t b)
+    {
+        size_t n = std::min(block, bucket_beg[b + 1] - unread[b]);
+        memcpy(&stack[stack_len * rec.record_size], at(unread[b]), n * rec.record_size);
+        unread[b] += n;
+        stack_len += n;
+    }
+
+    // all of the records bound for b are either in its buffer or unread, so after one read there is room
+    void flush(size_t b)
+    {
+        if (unread[b] - head[b] < fill[b])
+            read(b);
+        memcpy(at(head[b]), &out[b * block * rec.record_size], fill[b] * rec.record_size);
+        head[b] += fill[b];
+        fill[b] = 0;
+    }
+
+    // the buffers are only taken here, count alone may show that there is nothing to move
+    void run()
+    {
+        out.resize(block * 256 * rec.record_size);
+        stack.resize(block * 258 * rec.record_size);
+        for (size_t b = 0; b < 256; ++b)
+        {
+            while (unread[b] < bucket_beg[b + 1] || stack_len > 0)
+            {
+                if (stack_len == 0)
+                    read(b);
+                const unsigned char* cur = &stack[--stack_len * rec.record_size];
+                size_t d = rec.key(cur, depth);
+                memcpy(&out[(d * block + fill[d]++) * rec.record_size], cur, rec.record_size);
+                if (fill[d] == block)
+                    flush(d);
+            }
+        }
+        for (size_t b = 0; b < 256; ++b)
+        {
+            if (fill[b] > 0)
+                flush(b);
+        }
+    }
+};
+
+#ifdef BAO_SORT_LIB_MMAP
+// madvise takes a page aligned start, the hints are only hints, so errors are ignored
+inline void sort_file_advise(unsigned char* beg, unsigned char* end, int advice)
+{
+    unsigned char* first = beg - (size_t)beg % (size_t)sysconf(_SC_PAGESIZE);
+    madvise(first, (size_t)(end - first), advice);
+}
+#endif
+
+// a quarter of the physical memory, at least sort_file_scratch_bytes
+inline size_t sort_file_scratch_limit()
+{
+    size_t limit = (size_t)sort_file_scratch_bytes;
+#ifdef BAO_SORT_LIB_MMAP
+    long pages = sysconf(_SC_PHYS_PAGES), page = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && page > 0 && (size_t)pages / 4 > limit / (size_t)page)
+        limit = (size_t)pages / 4 * (size_t)page;
+#endif
+    return limit;
+}
+
+// a range that fits in the scratch memory is copied there, sorted and copied back, so every page of it
+// is dirtied once, which matters as soon as the dirty pages of the file run into the writeback limits
+// of the kernel. a bigger one is counted in order, distributed on the key byte at depth through 256
+// cursors that each walk forward, then the buckets are sorted one by one, the next bucket is read in
+// ahead of time while the current one is sorted
+inline void sort_file_blocks(unsigned char* beg, size_t len, size_t depth, const sort_file_records& rec, std::vector<unsigned char>& scratch, size_t scratch_limit)
+{
+    size_t bucket_beg[257];
+    for (; depth < rec.key_len; ++depth)
+    {
+        if (len * rec.record_size <= scratch_limit)
+        {
+            scratch.resize(std::max(scratch.size(), len * rec.record_size));
+            memcpy(&scratch[0], beg, len * rec.record_size);
+            sort_file_radix_sort(&scratch[0], &scratch[0] + len * rec.record_size, rec, depth);
+            memcpy(beg, &scratch[0], len * rec.record_size);
+            return;
+        }
+
+        std::vector<unsigned char>().swap(scratch); // the buffers of the distribution take its memory
+        sort_file_distribution part(beg, len, depth, rec, scratch_limit);
+#ifdef BAO_SORT_LIB_MMAP
+        sort_file_advise(beg, part.at(len), MADV_SEQUENTIAL);
+        part.count();
+        sort_file_advise(beg, part.at(len), MADV_NORMAL);
+#else
+        part.count();
+#endif
+        // a level where all of the records fall in one bucket goes on to the next byte without moving them
+        size_t first = rec.key(beg, depth);
+        if (part.bucket_beg[first + 1] - part.bucket_beg[first] == len)
+            continue;
+        part.run();
+        memcpy(bucket_beg, part.bucket_beg, sizeof(bucket_beg));
+        break;
+    }
+    if (depth + 1 >= rec.key_len)
+        return;
+    for (size_t b = 0; b < 256; ++b)
+    {
+#ifdef BAO_SORT_LIB_MMAP
+        if (b + 1 < 256 && bucket_beg[b + 2] > bucket_beg[b + 1])
+            sort_file_advise(beg + bucket_beg[b + 1] * rec.record_size, beg + bucket_beg[b + 2] * rec.record_size, MADV_WILLNEED);
+#endif
+        if (bucket_beg[b + 1] - bucket_beg[b] > 1)
+            sort_file_blocks(beg + bucket_beg[b] * rec.record_size, bucket_beg[b + 1] - bucket_beg[b], depth + 1, rec, scratch, scratch_limit);
+    }
+}
+
+#ifdef BAO_SORT_LIB_MMAP
+// a file that fits the scratch memory is read whole, sorted and written back, plain reads and writes
+// are cheaper than faulting the pages of a mapping in one by one and copying them out and back
+inline bool sort_file_in_memory(int fd, size_t size, const sort_file_records& rec)
+{
+    unsigned char* data = (unsigned char*)malloc(size);
+    if (!data)
+        return false;
+    bool ok = true;
+    for (size_t done = 0; ok && done < size;)
+    {
+        ssize_t got = pread(fd, data + done, size - done, (off_t)done);
+        ok = got > 0;
+        done += ok ? (size_t)got : 0;
+    }
+    if (ok)
+        sort_file_radix_sort(data, data + size, rec, 0);
+    for (size_t done = 0; ok && done < size;)
+    {
+        ssize_t put = pwrite(fd, data + done, size - done, (off_t)done);
+        ok = put > 0;
+        done += ok ? (size_t)put : 0;
+    }
+    free(data);
+    return ok;
+}
+#endif
+
+// unstable, the file is sorted where it is, through a shared mapping if there is mmap, or else read into memory and written back
+inline bool sort_file(const char* path, size_t record_size, size_t key_offset, size_t key_len)
+{
+    if (record_size == 0 || key_offset > record_size || key_len > record_size - key_offset)
+        return false;
+    std::vector<unsigned char> tmp(record_size);
+    sort_file_records rec;
+    rec.record_size = record_size;
+    rec.key_offset = key_offset;
+    rec.key_len = key_len;
+    rec.tmp = &tmp[0];
+
+#ifdef BAO_SORT_LIB_MMAP
+    int fd = open(path, O_RDWR);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size % record_size != 0)
+    {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    if (size / record_size < 2 || key_len == 0)
+        return close(fd) == 0;
+    size_t scratch_limit = sort_file_scratch_limit();
+    if (size <= scratch_limit)
+    {
+        bool ok = sort_file_in_memory(fd, size, rec);
+        return close(fd) == 0 && ok;
+    }
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+    std::vector<unsigned char> scratch;
+    sort_file_blocks((unsigned char*)map, size / record_size, 0, rec, scratch, scratch_limit);
+    // like a write, the pages go to the file through the page cache, munmap does not wait for the disk
+    bool ok = munmap(map, size) == 0;
+    return close(fd) == 0 && ok;
+#else
+    FILE* file = fopen(path, "r+b");
+    if (!file)
+        return false;
+    std::vector<unsigned char> data;
+    unsigned char block[65536];
+    size_t count;
+    while ((count = fread(block, 1, sizeof(block), file)) > 0)
+        data.insert(data.end(), block, block + count);
+    bool ok = !ferror(file) && data.size() % record_size == 0;
+    if (ok && data.size() / record_size > 1 && key_len > 0)
+    {
+        sort_file_radix_sort(&data[0], &data[0] + data.size(), rec, 0);
+        ok = fseek(file, 0, SEEK_SET) == 0 && fwrite(&data[0], 1, data.size(), file) == data.size();
+    }
+    return fclose(file) == 0 && ok;
+#endif
+}
+
+} // namespace internal
+
+namespace sort
+{
+
+// sorts the file of T records at input_path into output_path, which may be the same file. it needs about
+// memory_bytes of memory, and temporary files in temp_dir of the size of the input. returns false on an I/O error
+template <class T, class Comp>
+bool external_sort(const char* input_path, const char* output_path, const char* temp_dir, size_t memory_bytes, Comp compare, bool stable)
+{
+    return internal::external_sort<T>(input_path, output_path, temp_dir, memory_bytes, compare, stable);
+}
+
+// stable sort
+template <class T, class Comp>
+bool external_sort(const char* input_path, const char* output_path, const char* temp_dir, size_t memory_bytes, Comp compare)
+{
+    return internal::external_sort<T>(input_path, output_path, temp_dir, memory_bytes, compare, true);
+}
+
+// stable sort
+template <class T>
+bool external_sort(const char* input_path, const char* output_path, const char* temp_dir, size_t memory_bytes)
+{
+    return internal::external_sort<T>(input_path, output_path, temp_dir, memory_bytes, std::less<T>(), true);
+}
+
+// sorts the file of records of record_size bytes at path in place by the key_len bytes at key_offset,
+// compared as unsigned bytes like memcmp, so an integer key has to be stored big endian. unstable,
+// returns false on an I/O error or if the size of the file is not a multiple of record_size
+inline bool sort_file(const char* path, size_t record_size, size_t key_offset, size_t key_len)
+{
+    return internal::sort_file(path, record_size, key_offset, key_len);
+}
+
+} // namespace sort
+
+} // namespace baobao
+
+#endif
@@ -10,6 +10,11 @@
 #include <cstddef>
 #include <iterator>
 #include <algorithm>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <new>
+#include <vector>
 
 #include <cmath>
 #include <ctime>
@@ -18,9 +23,44 @@
 #if __cplusplus >= 201103L || _MSC_VER >= 1600
     #include <cstdint>
     #include <type_traits>
+    #include <utility>
+    #define BAO_MOVE(x) std::move(x)
 #else
     typedef unsigned int uint32_t;
     typedef int int32_t;
+    #define BAO_MOVE(x) (x)
+#endif
+
+#if __cplusplus >= 201103L || _MSC_VER >= 1700
+    #define BAO_SORT_LIB_PARALLEL
+    #include <atomic>
+    #include <condition_variable>
+    #include <deque>
+    #include <exception>
+    #include <mutex>
+    #include <thread>
+#endif
+
+#if !defined(BAO_SORT_LIB_NO_SIMD) && (defined(__AVX512F__) || defined(__AVX2__))
+    #define BAO_SORT_LIB_SIMD
+    #include <immintrin.h>
+#endif
+
+#ifdef BAO_SORT_LIB_SCRATCH_CACHE
+    // the blocks are kept per thread, without thread_local every thread would share one
+    #if __cplusplus >= 201103L || _MSC_VER >= 1900
+        #include <atomic>
+    #else
+        #error "BAO_SORT_LIB_SCRATCH_CACHE needs C++11 thread_local"
+    #endif
+#endif
+
+#if !defined(BAO_SORT_LIB_PARALLEL)
+    #define BAO_SORT_THREAD_LOCAL
+#elif defined(_MSC_VER) && _MSC_VER < 1900
+    #define BAO_SORT_THREAD_LOCAL __declspec(thread)
+#else
+    #define BAO_SORT_THREAD_LOCAL thread_local
 #endif
 
 namespace baobao
@@ -28,19 +68,45 @@ namespace baobao
 enum
 {
     qsort_insertion_sort_threshold = 40,
+    qsort_block_size = 64,
+    pdqsort_ninther_threshold = 128,
     shellsort_insertion_sort_threshold = 32,
 
     find_swap_bound_optimize_threshold = 256,
 
     merge_insertion_sort_threshold = 32,
     merge_2_part_insertion_sort_threshold = 32,
+    merge_min_gallop = 7,
 
     timsort_last_run_threshold = 64,
     timsort_min_run = 32,
     timsort_insert_gap = 8,
+    timsort_chunk_edge_scan = 256,
 
     merge_sort_alloc_buffer = 1,
-    merge_sort_stack_buffer_size = 16384
+    merge_sort_stack_buffer_size = 16384,
+
+    scratch_cache_trim_period = 64,
+    scratch_cache_limit_bytes = 1 << 28,
+
+    parallel_qsort_task_threshold = 16384,
+    parallel_merge_task_threshold = 16384,
+
+    samplesort_block_bytes = 2048,
+    samplesort_max_buckets = 256,
+    samplesort_min_buckets = 8,
+    samplesort_classify_unroll = 8,
+    parallel_samplesort_stripe_threshold = 65536,
+    parallel_samplesort_task_threshold = 16384,
+
+    radixsort_lsd_wide_digit_threshold = 65536,
+    parallel_radix_lsd_threshold = 65536,
+
+    simd_network_max_size = 64,
+
+    auto_sort_sample_threshold = 16384,
+    auto_sort_sample_windows = 16,
+    auto_sort_sample_window = 64
 };
 
 namespace util
@@ -172,6 +238,48 @@ struct is_scalar
 {
 };
 
+template< class T, class U >
+struct is_same
+    : baobao::util::value_constant<bool, false>
+{
+};
+
+template< class T >
+struct is_same<T, T>
+    : baobao::util::value_constant<bool, true>
+{
+};
+
+// a class whose move is cheap and cannot throw, like std::string or std::unique_ptr
+#if __cplusplus >= 201103L || _MSC_VER >= 1900
+template< class T >
+struct is_nothrow_movable_class
+    : baobao::util::value_constant<bool, std::is_nothrow_move_constructible<T>::value && !std::is_scalar<T>::value>
+{
+};
+#else
+template< class T >
+struct is_nothrow_movable_class
+    : baobao::util::value_constant<bool, false>
+{
+};
+#endif
+
+// memcpy can stand in for the copy, without the trait only scalars are known to allow it
+#if __cplusplus >= 201103L || _MSC_VER >= 1900
+template< class T >
+struct is_trivially_copyable
+    : baobao::util::value_constant<bool, std::is_trivially_copyable<T>::value>
+{
+};
+#else
+template< class T >
+struct is_trivially_copyable
+    : baobao::util::is_scalar<T>
+{
+};
+#endif
+
 template<class T, class Comp>
 inline void make_mid_pivot(T& l, T& mid, T& r, Comp compare)
 {
@@ -231,7 +339,8 @@ inline bool object_equal(const T& a, const T& b, Comp compare)
 
 uint32_t fake_rand_simple()
 {
-    static uint32_t s_rnd = 0xfffffff;
+    // per thread, so that parallel sorts neither race nor share the cache line
+    static BAO_SORT_THREAD_LOCAL uint32_t s_rnd = 0xfffffff;
     return ++s_rnd;
 }
 
@@ -373,10 +482,432 @@ uint32_t rand_uint32(int32_t n)
     return (uint32_t)dis.distribution(n);
 }
 
+#ifdef BAO_SORT_LIB_SCRATCH_CACHE
+// a block per thread that merge_sort, tim_sort, merge_sort_buffer and indirect_qsort take their
+// scratch from instead of malloc, a bigger one is kept when released. The block is freed when it is
+// bigger than all the requests of the last scratch_cache_trim_period sorts, and all threads together
+// hold at most limit() bytes
+class scratch_cache
+{
+public:
+    static void* acquire(size_t bytes)
+    {
+        slot& s = local();
+        if (!s.busy && s.ptr != NULL && s.size >= bytes)
+        {
+            s.busy = true;
+            return s.ptr;
+        }
+        return malloc(bytes);
+    }
+
+    static void release(void* p, size_t bytes)
+    {
+        slot& s = local();
+        if (p == s.ptr)
+            s.busy = false;
+        else if (s.busy || !adopt(s, p, bytes))
+            free(p);
+
+        if (s.high < bytes)
+            s.high = bytes;
+        if (++s.releases >= scratch_cache_trim_period)
+        {
+            if (!s.busy && s.size > s.high)
+                drop(s);
+            s.releases = 0;
+            s.high = 0;
+        }
+    }
+
+    // frees the block of this thread
+    static void trim()
+    {
+        slot& s = local();
+        if (!s.busy)
+            drop(s);
+    }
+
+    static size_t limit()
+    {
+        return limit_bytes();
+    }
+
+    // a released block is only kept while all threads hold at most bytes
+    static void set_limit(size_t bytes)
+    {
+        limit_bytes() = bytes;
+    }
+
+    // bytes held by all threads
+    static size_t held()
+    {
+        return held_bytes();
+    }
+
+private:
+    struct slot
+    {
+        void* ptr;
+        size_t size;
+        size_t high;
+        unsigned releases;
+        bool busy;
+
+        slot() : ptr(NULL), size(0), high(0), releases(0), busy(false) { }
+        ~slot() { drop(*this); }
+    };
+
+    static slot& local()
+    {
+        static thread_local slot s;
+        return s;
+    }
+
+    static std::atomic<size_t>& held_bytes()
+    {
+        static std::atomic<size_t> held(0);
+        return held;
+    }
+
+    static std::atomic<size_t>& limit_bytes()
+    {
+        static std::atomic<size_t> limit(scratch_cache_limit_bytes);
+        return limit;
+    }
+
+    // replaces the block of s with p if it is bigger and the total stays under the limit
+    static bool adopt(slot& s, void* p, size_t bytes)
+    {
+        if (bytes <= s.size)
+            return false;
+        size_t held = (held_bytes() += bytes - s.size);
+        if (held > limit_bytes())
+        {
+            held_bytes() -= bytes - s.size;
+            return false;
+        }
+        free(s.ptr);
+        s.ptr = p;
+        s.size = bytes;
+        return true;
+    }
+
+    static void drop(slot& s)
+    {
+        if (s.ptr != NULL)
+        {
+            free(s.ptr);
+            held_bytes() -= s.size;
+            s.ptr = NULL;
+            s.size = 0;
+        }
+    }
+};
+#endif
+
+#ifdef BAO_SORT_LIB_PARALLEL
+
+// tasks spawned together, the first exception thrown by one of them is rethrown by task_pool::wait
+struct task_group
+{
+    std::atomic<size_t> pending;
+    std::exception_ptr error;
+    std::mutex error_lock;
+    task_group() : pending(0) { }
+};
+
+// work-stealing pool, every thread owns a deque, pops its newest task from the back
+// and steals the oldest (usually the biggest) task from the front of the others
+class task_pool
+{
+public:
+    typedef std::function<void()> task_type;
+
+    explicit task_pool(unsigned threads)
+        : m_queues(threads > 1 ? threads : 1)
+        , m_queued(0)
+        , m_stop(false)
+    {
+        m_ids.push_back(std::this_thread::get_id());
+        for (size_t i = 1; i < m_queues.size(); ++i)
+        {
+            m_threads.push_back(std::thread(&task_pool::worker_loop, this, i));
+            m_ids.push_back(m_threads.back().get_id());
+        }
+    }
+
+    ~task_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_sleep_lock);
+            m_stop = true;
+        }
+        m_wakeup.notify_all();
+        for (size_t i = 0; i < m_threads.size(); ++i)
+        {
+            m_threads[i].join();
+        }
+    }
+
+    static unsigned thread_count(unsigned threads)
+    {
+        if (threads == 0)
+        {
+            threads = std::thread::hardware_concurrency();
+        }
+        return threads > 0 ? threads : 1;
+    }
+
+    size_t size() const
+    {
+        return m_queues.size();
+    }
+
+    // 0 for the thread owning the pool, and for threads outside the pool
+    size_t thread_index() const
+    {
+        std::thread::id id = std::this_thread::get_id();
+        for (size_t i = 1; i < m_ids.size(); ++i)
+        {
+            if (m_ids[i] == id)
+                return i;
+        }
+        return 0;
+    }
+
+    void spawn(task_group& group, const task_type& task)
+    {
+        if (m_threads.empty())
+        {
+            run_task(task, group);
+            return;
+        }
+        group.pending.fetch_add(1);
+        m_queued.fetch_add(1);
+        worker_queue& queue = m_queues[thread_index()];
+        {
+            std::lock_guard<std::mutex> lock(queue.lock);
+            queue.tasks.push_back(task_item(task, &group));
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_sleep_lock);
+        }
+        m_wakeup.notify_one();
+    }
+
+    // the waiting thread keeps running tasks, so nested waits never block the pool, and sleeps
+    // while there is nothing to steal until the group is done or a task is spawned
+    void wait(task_group& group)
+    {
+        size_t self = thread_index();
+        while (group.pending.load() != 0)
+        {
+            if (run_one(self))
+            {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(m_sleep_lock);
+            if (group.pending.load() != 0 && m_queued.load() == 0)
+            {
+                m_wakeup.wait(lock);
+            }
+        }
+        if (group.error)
+        {
+            std::exception_ptr error = group.error;
+            group.error = std::exception_ptr();
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    struct task_item
+    {
+        task_type task;
+        task_group* group;
+        task_item() : group(NULL) { }
+        task_item(const task_type& t, task_group* g) : task(t), group(g) { }
+    };
+
+    struct worker_queue
+    {
+        std::mutex lock;
+        std::deque<task_item> tasks;
+    };
+
+    task_pool(const task_pool&);
+    task_pool& operator=(const task_pool&);
+
+    bool pop(size_t self, task_item& item)
+    {
+        {
+            worker_queue& queue = m_queues[self];
+            std::lock_guard<std::mutex> lock(queue.lock);
+            if (!queue.tasks.empty())
+            {
+                item = queue.tasks.back();
+                queue.tasks.pop_back();
+                m_queued.fetch_sub(1);
+                return true;
+            }
+        }
+        for (size_t i = 1; i < m_queues.size(); ++i)
+        {
+            worker_queue& queue = m_queues[(self + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(queue.lock);
+            if (!queue.tasks.empty())
+            {
+                item = queue.tasks.front();
+                queue.tasks.pop_front();
+                m_queued.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // keeps the first exception in the group
+    static void run_task(const task_type& task, task_group& group)
+    {
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(group.error_lock);
+            if (!group.error)
+                group.error = std::current_exception();
+        }
+    }
+
+    bool run_one(size_t self)
+    {
+        task_item item;
+        if (!pop(self, item))
+        {
+            return false;
+        }
+        run_task(item.task, *item.group);
+        if (item.group->pending.fetch_sub(1) == 1)
+        {
+            // the waiter may sleep on m_wakeup
+            {
+                std::lock_guard<std::mutex> lock(m_sleep_lock);
+            }
+            m_wakeup.notify_all();
+        }
+        return true;
+    }
+
+    void worker_loop(size_t self)
+    {
+        while (true)
+        {
+            if (run_one(self))
+            {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(m_sleep_lock);
+            if (m_stop)
+            {
+                return;
+            }
+            if (m_queued.load() == 0)
+            {
+                m_wakeup.wait(lock);
+            }
+        }
+    }
+
+    std::vector<worker_queue> m_queues;
+    std::vector<std::thread> m_threads;
+    std::vector<std::thread::id> m_ids;
+    std::atomic<size_t> m_queued;
+    bool m_stop;
+    std::mutex m_sleep_lock;
+    std::condition_variable m_wakeup;
+};
+
+#endif
+
 } // namespace util
 
 namespace internal
 {
+// raw scratch of the sequential sorts, from the thread's scratch_cache if it is enabled
+inline void* scratch_alloc(size_t bytes)
+{
+#ifdef BAO_SORT_LIB_SCRATCH_CACHE
+    return util::scratch_cache::acquire(bytes);
+#else
+    return malloc(bytes);
+#endif
+}
+
+inline void scratch_free(void* p, size_t bytes)
+{
+#ifdef BAO_SORT_LIB_SCRATCH_CACHE
+    util::scratch_cache::release(p, bytes);
+#else
+    (void)bytes;
+    free(p);
+#endif
+}
+
+// copies src into the slots
+template <bool move>
+struct safe_buffer_construct
+{
+    template <class T, class RandomAccessIterator>
+    static void run(T* buf, RandomAccessIterator src, size_t n)
+    {
+        std::uninitialized_copy(src, src + n, buf);
+    }
+};
+
+// moves src in and back, which leaves the slots moved-from without copying a heap-owning class
+template <>
+struct safe_buffer_construct<true>
+{
+    template <class T, class RandomAccessIterator>
+    static void run(T* buf, RandomAccessIterator src, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i, ++src)
+        {
+            ::new (static_cast<void*>(buf + i)) T(BAO_MOVE(*src));
+            *src = BAO_MOVE(buf[i]);
+        }
+    }
+};
+
+// scratch of n elements for the safe copy versions, raw storage whose slots are constructed
+// from src, so value_type is never default constructed only to be assigned over
+template <class T, class RandomAccessIterator>
+T* safe_buffer_alloc(RandomAccessIterator src, size_t n)
+{
+    T* buf = static_cast<T*>(::operator new(n * sizeof(T)));
+    try
+    {
+        safe_buffer_construct<util::is_nothrow_movable_class<T>::value>::run(buf, src, n);
+    }
+    catch (...)
+    {
+        ::operator delete(buf);
+        throw;
+    }
+    return buf;
+}
+
+template <class T>
+void safe_buffer_free(T* buf, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        buf[i].~T();
+    ::operator delete(buf);
+}
+
 // stable sort
 template <class RandomAccessIterator, class Comp>
 void insert_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
@@ -385,14 +916,14 @@ void insert_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compar
     {
         if (compare(*i, *(i - 1)))
         {
-            typename std::iterator_traits<RandomAccessIterator>::value_type val = *i;
+            typename std::iterator_traits<RandomAccessIterator>::value_type val = BAO_MOVE(*i);
             RandomAccessIterator j = i - 1;
-            *i = *j;
+            *i = BAO_MOVE(*j);
             for (;j != beg && compare(val, *(j - 1)); --j)
             {
-                *j = *(j - 1);
+                *j = BAO_MOVE(*(j - 1));
             }
-            *j = val;
+            *j = BAO_MOVE(val);
         }
     }
 }
@@ -405,14 +936,14 @@ inline void unguarded_insert_sort(RandomAccessIterator beg, RandomAccessIterator
     {
         if (compare(*i, *(i - 1)))
         {
-            typename std::iterator_traits<RandomAccessIterator>::value_type val = *i;
+            typename std::iterator_traits<RandomAccessIterator>::value_type val = BAO_MOVE(*i);
             RandomAccessIterator j = i - 1;
-            *i = *j;
+            *i = BAO_MOVE(*j);
             for (;compare(val, *(j - 1)); --j)
             {
-                *j = *(j - 1);
+                *j = BAO_MOVE(*(j - 1));
             }
-            *j = val;
+            *j = BAO_MOVE(val);
         }
     }
 }
@@ -434,14 +965,14 @@ void q_insert_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp comp
     {
         if (compare(*i, *(i - 1)))
         {
-            typename std::iterator_traits<RandomAccessIterator>::value_type val = *i;
+            typename std::iterator_traits<RandomAccessIterator>::value_type val = BAO_MOVE(*i);
             RandomAccessIterator j = i - 1;
-            *i = *j;
+            *i = BAO_MOVE(*j);
             for (;j != beg && compare(val, *(j - 1)); --j)
             {
-                *j = *(j - 1);
+                *j = BAO_MOVE(*(j - 1));
             }
-            *j = val;
+            *j = BAO_MOVE(val);
         }
     }
 }
@@ -463,14 +994,14 @@ void unguarded_q_insert_sort(RandomAccessIterator beg, RandomAccessIterator end,
     {
         if (compare(*i, *(i - 1)))
         {
-            typename std::iterator_traits<RandomAccessIterator>::value_type val = *i;
+            typename std::iterator_traits<RandomAccessIterator>::value_type val = BAO_MOVE(*i);
             RandomAccessIterator j = i - 1;
-            *i = *j;
+            *i = BAO_MOVE(*j);
             for (; compare(val, *(j - 1)); --j)
             {
-                *j = *(j - 1);
+                *j = BAO_MOVE(*(j - 1));
             }
-            *j = val;
+            *j = BAO_MOVE(val);
         }
     }
 }
@@ -483,14 +1014,14 @@ inline void insert_sort_part(RandomAccessIterator beg, RandomAccessIterator mid,
     {
         if (compare(*i, *(i - 1)))
         {
-            typename std::iterator_traits<RandomAccessIterator>::value_type val = *i;
+            typename std::iterator_traits<RandomAccessIterator>::value_type val = BAO_MOVE(*i);
             RandomAccessIterator j = i - 1;
-            *i = *j;
+            *i = BAO_MOVE(*j);
             for (;j != beg && compare(val, *(j - 1)); --j)
             {
-                *j = *(j - 1);
+                *j = BAO_MOVE(*(j - 1));
             }
-            *j = val;
+            *j = BAO_MOVE(val);
         }
     }
 }
@@ -503,14 +1034,14 @@ inline void insert_sort_part_rev(RandomAccessIterator beg, RandomAccessIterator
     {
         if (!compare(*i, *(i - 1)))
         {
-            typename std::iterator_traits<RandomAccessIterator>::value_type val = *i;
+            typename std::iterator_traits<RandomAccessIterator>::value_type val = BAO_MOVE(*i);
             RandomAccessIterator j = i - 1;
-            *i = *j;
+            *i = BAO_MOVE(*j);
             for (;j != beg && !compare(val, *(j - 1)); --j)
             {
-                *j = *(j - 1);
+                *j = BAO_MOVE(*(j - 1));
             }
-            *j = val;
+            *j = BAO_MOVE(val);
         }
     }
 }
@@ -521,14 +1052,14 @@ inline void unguarded_insert_single(RandomAccessIterator i, Comp compare)
 {
     if (compare(*i, *(i - 1)))
     {
-        typename std::iterator_traits<RandomAccessIterator>::value_type val = *i;
+        typename std::iterator_traits<RandomAccessIterator>::value_type val = BAO_MOVE(*i);
         RandomAccessIterator j = i - 1;
-        *i = *j;
+        *i = BAO_MOVE(*j);
         for (; compare(val, *(j - 1)); --j)
         {
-            *j = *(j - 1);
+            *j = BAO_MOVE(*(j - 1));
         }
-        *j = val;
+        *j = BAO_MOVE(val);
     }
 }
 
@@ -538,14 +1069,14 @@ inline void unguarded_insert_single_rev(RandomAccessIterator i, Comp compare)
 {
     if (!compare(*i, *(i - 1)))
     {
-        typename std::iterator_traits<RandomAccessIterator>::value_type val = *i;
+        typename std::iterator_traits<RandomAccessIterator>::value_type val = BAO_MOVE(*i);
         RandomAccessIterator j = i - 1;
-        *i = *j;
+        *i = BAO_MOVE(*j);
         for (; !compare(val, *(j - 1)); --j)
         {
-            *j = *(j - 1);
+            *j = BAO_MOVE(*(j - 1));
         }
-        *j = val;
+        *j = BAO_MOVE(val);
     }
 }
 
@@ -559,19 +1090,19 @@ RandomAccessIterator insert_sort_limit(RandomAccessIterator beg, RandomAccessIte
             ++limit;
             continue;
         }
-        typename std::iterator_traits<RandomAccessIterator>::value_type val = *i;
+        typename std::iterator_traits<RandomAccessIterator>::value_type val = BAO_MOVE(*i);
         RandomAccessIterator j = i - 1;
-        *i = *j;
+        *i = BAO_MOVE(*j);
         for (;j != beg && compare(val, *(j - 1)); --j)
         {
             if (--limit <= 0)
             {
-                *j = val;
+                *j = BAO_MOVE(val);
                 return i;
             }
-            *j = *(j - 1);
+            *j = BAO_MOVE(*(j - 1));
         }
-        *j = val;
+        *j = BAO_MOVE(val);
     }
     return end;
 }
@@ -586,1413 +1117,5275 @@ RandomAccessIterator unguarded_insert_sort_limit(RandomAccessIterator beg, Rando
             ++limit;
             continue;
         }
-        typename std::iterator_traits<RandomAccessIterator>::value_type val = *i;
+        typename std::iterator_traits<RandomAccessIterator>::value_type val = BAO_MOVE(*i);
         RandomAccessIterator j = i - 1;
-        *i = *j;
+        *i = BAO_MOVE(*j);
         for (; compare(val, *(j - 1)); --j)
         {
             if (--limit <= 0)
             {
-                *j = val;
+                *j = BAO_MOVE(val);
                 return i;
             }
-            *j = *(j - 1);
+            *j = BAO_MOVE(*(j - 1));
         }
-        *j = val;
+        *j = BAO_MOVE(val);
     }
     return end;
 }
 
-template <class RandomAccessIterator, class Comp>
-void shell_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+#ifdef BAO_SORT_LIB_SIMD
+// vectorized partition for arithmetic keys under std::less / std::greater,
+// AVX-512 uses compress-store, AVX2 a permutation table indexed by the compare mask
+inline unsigned simd_bit_count(unsigned v)
 {
-    if (end - beg > shellsort_insertion_sort_threshold)
-    {
-        typedef typename std::iterator_traits<RandomAccessIterator>::difference_type diff_type;
-        typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
-        diff_type len = end - beg;
-        diff_type incre_list[61] = { 0, 9, 34, 182, 836, 4025, 19001, 90358, 428481, 2034035, 9651787, 45806244, 217378076, 1031612713 };
-        const double incre_factor = 2.9; // simple and fast enought
+#if defined(__POPCNT__)
+    return (unsigned)_mm_popcnt_u32(v);
+#else
+    v = v - ((v >> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+    return (((v + (v >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24;
+#endif
+}
 
-        if (!util::is_scalar<value_type>::value)
+struct simd_perm_table
+{
+    // byte indices for _mm256_permutevar8x32, the selected lanes first and the others after them
+    unsigned char lane32[256][8];
+    unsigned char lane64[16][8];
+
+    simd_perm_table()
+    {
+        for (unsigned m = 0; m < 256; ++m)
         {
-            incre_list[1] = 10;
+            unsigned n = 0;
+            for (unsigned i = 0; i < 8; ++i)
+                if (m >> i & 1)
+                    lane32[m][n++] = (unsigned char)i;
+            for (unsigned i = 0; i < 8; ++i)
+                if (!(m >> i & 1))
+                    lane32[m][n++] = (unsigned char)i;
         }
-        diff_type incre_index = 0;
-        for (diff_type i = 1; i < 60; ++i)
+        for (unsigned m = 0; m < 16; ++m)
         {
-            diff_type mul = incre_list[i];
-            if (mul * incre_factor >= len)
-            {
-                incre_index = i;
-                break;
-            }
-            if (!util::is_scalar<value_type>::value || incre_list[i + 1] == 0)
-            {
-                incre_list[i + 1] = (diff_type)(mul * incre_factor);
-            }
-        }
-
-        for (; incre_index > 0; --incre_index)
-        {
-            bool swaped = false;
-            diff_type incre = incre_list[incre_index];
-            for (diff_type i = incre; i < len; i++)
-            {
-                if (compare(*(beg + i), *(beg + i - incre)))
-                {
-                    value_type val = *(beg + i);
-                    *(beg + i) = *(beg + i - incre);
-                    diff_type pos = i - incre;
-                    for (; pos >= incre && compare(val, *(beg + pos - incre)); pos -= incre)
-                    {
-                        *(beg + pos) = *(beg + pos - incre);
-                    }
-                    *(beg + pos) = val;
-                    swaped = true;
-                }
-            }
-            if (!swaped)
-            {
-                RandomAccessIterator last = insert_sort_limit(beg, end, compare, 1);
-                if (last == end)
+            unsigned n = 0;
+            for (unsigned i = 0; i < 4; ++i)
+                if (m >> i & 1)
                 {
-                    return;
+                    lane64[m][n++] = (unsigned char)(i * 2);
+                    lane64[m][n++] = (unsigned char)(i * 2 + 1);
                 }
-                if (last - beg >= incre << 1)
+            for (unsigned i = 0; i < 4; ++i)
+                if (!(m >> i & 1))
                 {
-                    beg += ((last - beg) / incre - 1) * incre;
-                    len = end - beg;
+                    lane64[m][n++] = (unsigned char)(i * 2);
+                    lane64[m][n++] = (unsigned char)(i * 2 + 1);
                 }
-            }
         }
-
-        insert_sort(beg, beg + incre_list[1], compare);
-        unguarded_insert_sort(beg + incre_list[1], end, compare);
     }
-    else
+
+    static const simd_perm_table& instance()
     {
-        insert_sort(beg, end, compare);
+        static const simd_perm_table table;
+        return table;
     }
-}
+};
 
-template <class RandomAccessIterator, class Comp>
-void max_heapify_p(RandomAccessIterator first, RandomAccessIterator target, RandomAccessIterator last, Comp compare)
+#if defined(__AVX512F__)
+
+template <class T, int kind>
+struct simd_ops_512;
+
+// kind 0: signed integer, 1: unsigned integer, 2: floating point
+template <class T>
+struct simd_ops_512<T, 0>
 {
-    typename std::iterator_traits<RandomAccessIterator>::value_type temp = *target;
-    --first;
-    RandomAccessIterator son;
-    for (; (son = target + (target - first)) <= last; target = son)
+    typedef __m512i reg;
+    enum { lanes = 64 / sizeof(T) };
+
+    static reg load(const T* p) { return _mm512_loadu_si512((const void*)p); }
+    static void store(T* p, reg v) { _mm512_storeu_si512((void*)p, v); }
+    static reg set1(T v) { return sizeof(T) == 4 ? _mm512_set1_epi32((int)v) : _mm512_set1_epi64((long long)v); }
+    static unsigned less(reg a, reg b)
     {
-        if (son < last && compare(*son, *(son + 1)))
-            ++son;
-        if (compare(temp, *son))
-            *target = *son;
+        return sizeof(T) == 4 ? (unsigned)_mm512_cmplt_epi32_mask(a, b) : (unsigned)_mm512_cmplt_epi64_mask(a, b);
+    }
+    static void compress_store(T* p, unsigned mask, reg v)
+    {
+        if (sizeof(T) == 4)
+            _mm512_mask_compressstoreu_epi32((void*)p, (__mmask16)mask, v);
         else
-            break;
+            _mm512_mask_compressstoreu_epi64((void*)p, (__mmask8)mask, v);
     }
-    *target = temp;
-}
+};
 
-template <class RandomAccessIterator, class Comp>
-void heap_sort_p(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+template <class T>
+struct simd_ops_512<T, 1> : simd_ops_512<T, 0>
 {
-    if (end - beg > 1)
+    typedef __m512i reg;
+
+    static unsigned less(reg a, reg b)
     {
-        for (RandomAccessIterator i = beg + (end - beg) / 2; i >= beg; --i)
-            max_heapify_p(beg, i, end - 1, compare);
-        for (--end; end > beg; )
-        {
-            std::swap(*beg, *end--);
-            max_heapify_p(beg, beg, end, compare);
-        }
+        return sizeof(T) == 4 ? (unsigned)_mm512_cmplt_epu32_mask(a, b) : (unsigned)_mm512_cmplt_epu64_mask(a, b);
     }
-}
+};
 
-template <class RandomAccessIterator, class Comp>
-void max_heapify_1(RandomAccessIterator arr, size_t index, size_t last, Comp compare)
+template <>
+struct simd_ops_512<float, 2>
 {
-    typename std::iterator_traits<RandomAccessIterator>::value_type temp = arr[index];
-    size_t child;
-    for (; (child = index << 1) <= last; index = child)
+    typedef __m512 reg;
+    enum { lanes = 16 };
+
+    static reg load(const float* p) { return _mm512_loadu_ps(p); }
+    static void store(float* p, reg v) { _mm512_storeu_ps(p, v); }
+    static reg set1(float v) { return _mm512_set1_ps(v); }
+    static unsigned less(reg a, reg b) { return (unsigned)_mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static void compress_store(float* p, unsigned mask, reg v) { _mm512_mask_compressstoreu_ps(p, (__mmask16)mask, v); }
+};
+
+template <>
+struct simd_ops_512<double, 2>
+{
+    typedef __m512d reg;
+    enum { lanes = 8 };
+
+    static reg load(const double* p) { return _mm512_loadu_pd(p); }
+    static void store(double* p, reg v) { _mm512_storeu_pd(p, v); }
+    static reg set1(double v) { return _mm512_set1_pd(v); }
+    static unsigned less(reg a, reg b) { return (unsigned)_mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+    static void compress_store(double* p, unsigned mask, reg v) { _mm512_mask_compressstoreu_pd(p, (__mmask8)mask, v); }
+};
+
+template <class T, int kind>
+struct simd_ops : simd_ops_512<T, kind>
+{
+    typedef simd_ops_512<T, kind> base;
+    typedef typename base::reg reg;
+
+    // the selected lanes go to left, the others end at right
+    static void partition_store(const simd_perm_table&, reg v, unsigned mask, T*& left, T*& right)
     {
-        if (child < last && compare(*(arr + child), *(arr + child + 1)))
-            ++child;
-        if (compare(temp, *(arr + child)))
-            *(arr + index) = *(arr + child);
-        else
-            break;
+        unsigned n = simd_bit_count(mask);
+        base::compress_store(left, mask, v);
+        right -= base::lanes - n;
+        base::compress_store(right, ~mask & ((1U << base::lanes) - 1), v);
+        left += n;
     }
-    *(arr + index) = temp;
-}
+};
 
-template <class RandomAccessIterator, class Comp>
-void heap_sort_1(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+#else // AVX2
+
+template <class T, int kind>
+struct simd_ops_256;
+
+template <class T>
+struct simd_ops_256<T, 0>
 {
-    if (end - beg > 1)
+    typedef __m256i reg;
+    enum { lanes = 32 / sizeof(T) };
+
+    static reg load(const T* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static void store(T* p, reg v) { _mm256_storeu_si256((__m256i*)p, v); }
+    static reg set1(T v) { return sizeof(T) == 4 ? _mm256_set1_epi32((int)v) : _mm256_set1_epi64x((long long)v); }
+    static unsigned less(reg a, reg b)
     {
-        size_t length = (size_t)(end - beg);
-        RandomAccessIterator parr = beg - 1;
-        for (size_t i = length / 2; i > 0; --i)
-            max_heapify_1(parr, i, length, compare);
-        for (size_t i = length - 1; i > 0; --i)
-        {
-            std::swap(*beg, *(beg + i));
-            max_heapify_1(parr, 1, i, compare);
-        }
+        if (sizeof(T) == 4)
+            return (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(b, a)));
+        return (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(b, a)));
     }
-}
+    static reg permute(const simd_perm_table& table, reg v, unsigned mask)
+    {
+        const unsigned char* index = sizeof(T) == 4 ? table.lane32[mask] : table.lane64[mask];
+        return _mm256_permutevar8x32_epi32(v, _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)index)));
+    }
+};
 
-// stable sort
-template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
-void merge_2_part_force(RandomAccessBufferIterator buf, RandomAccessIterator beg, RandomAccessIterator mid, RandomAccessIterator end, Comp compare)
+// AVX2 has only signed compares, flipping the sign bit keeps the order
+template <class T>
+struct simd_ops_256<T, 1> : simd_ops_256<T, 0>
 {
-    if (mid - beg <= end - mid)
-    {
-        if (safecopy)
-        {
-            RandomAccessBufferIterator t = buf;
-            for (RandomAccessIterator s = beg; s != mid; ++s, ++t)
-            {
-                *t = *s;
-            }
-        }
-        else
-            memcpy((char*)buf, (char*)&*beg, (char*)&*mid - (char*)&*beg);
+    typedef __m256i reg;
 
-        RandomAccessBufferIterator start1 = buf, start1_end = buf + (mid - beg);
-        RandomAccessIterator start2 = mid, k = beg;
-        if (start1 < start1_end && start2 < end)
-        {
-            while (true)
-            {
-                if (compare(*start2, *start1))
-                {
-                    *k++ = *start2++;
-                    if (start2 >= end)
-                        break;
-                }
-                else
-                {
-                    *k++ = *start1++;
-                    if (start1 >= start1_end)
-                        break;
-                }
-            }
-        }
-        while (start1 < start1_end)
-        {
-            *k++ = *start1++;
-        }
+    static unsigned less(reg a, reg b)
+    {
+        reg sign = sizeof(T) == 4 ? _mm256_set1_epi32((int)0x80000000) : _mm256_set1_epi64x((long long)1 << 63);
+        return simd_ops_256<T, 0>::less(_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign));
     }
-    else
+};
+
+template <>
+struct simd_ops_256<float, 2>
+{
+    typedef __m256 reg;
+    enum { lanes = 8 };
+
+    static reg load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, reg v) { _mm256_storeu_ps(p, v); }
+    static reg set1(float v) { return _mm256_set1_ps(v); }
+    static unsigned less(reg a, reg b) { return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+    static reg permute(const simd_perm_table& table, reg v, unsigned mask)
     {
-        if (safecopy)
-        {
-            RandomAccessBufferIterator t = buf;
-            for (RandomAccessIterator s = mid; s != end; ++s, ++t)
-            {
-                *t = *s;
-            }
-        }
-        else
-            memcpy((char*)buf, (char*)&*mid, (char*)&*end - (char*)&*mid);
+        return _mm256_permutevar8x32_ps(v, _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)table.lane32[mask])));
+    }
+};
 
-        RandomAccessBufferIterator start1 = buf + (end - mid) - 1, start1_end = buf;
-        RandomAccessIterator start2 = mid - 1, k = end;
-        if (start1 >= start1_end && start2 >= beg)
-        {
-            while (true)
-            {
-                if (compare(*start1, *start2))
-                {
-                    *--k = *start2--;
-                    if (start2 < beg)
-                        break;
-                }
-                else
-                {
-                    *--k = *start1--;
-                    if (start1 < start1_end)
-                        break;
-                }
-            }
-        }
-        while (start1 >= start1_end)
-        {
-            *--k = *start1--;
-        }
+template <>
+struct simd_ops_256<double, 2>
+{
+    typedef __m256d reg;
+    enum { lanes = 4 };
+
+    static reg load(const double* p) { return _mm256_loadu_pd(p); }
+    static void store(double* p, reg v) { _mm256_storeu_pd(p, v); }
+    static reg set1(double v) { return _mm256_set1_pd(v); }
+    static unsigned less(reg a, reg b) { return (unsigned)_mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_LT_OQ)); }
+    static reg permute(const simd_perm_table& table, reg v, unsigned mask)
+    {
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)table.lane64[mask]));
+        return _mm256_castps_pd(_mm256_permutevar8x32_ps(_mm256_castpd_ps(v), index));
     }
-}
+};
 
-// stable sort
-template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
-void merge_2_part(RandomAccessBufferIterator buf, RandomAccessIterator beg, RandomAccessIterator mid, RandomAccessIterator end, Comp compare)
+template <class T, int kind>
+struct simd_ops : simd_ops_256<T, kind>
 {
-    if (!compare(*mid, *(mid - 1)))
+    typedef simd_ops_256<T, kind> base;
+    typedef typename base::reg reg;
+
+    // the permuted vector is stored at both ends, each end keeps its own lanes
+    static void partition_store(const simd_perm_table& table, reg v, unsigned mask, T*& left, T*& right)
     {
-        return;
+        unsigned n = simd_bit_count(mask);
+        reg p = base::permute(table, v, mask);
+        base::store(left, p);
+        base::store(right - base::lanes, p);
+        left += n;
+        right -= base::lanes - n;
     }
-    while (beg < mid && !compare(*mid, *beg))
+};
+
+#endif
+
+// 0 signed integer, 1 unsigned integer, 2 floating point, -1 for types without a kernel
+template <class T, bool integral, bool floating>
+struct simd_key_kind_helper
+{
+    enum { value = -1 };
+};
+
+template <class T>
+struct simd_key_kind_helper<T, true, false>
+{
+    enum { value = sizeof(T) == 4 || sizeof(T) == 8 ? ((T)(-1) < (T)0 ? 0 : 1) : -1 };
+};
+
+template <class T>
+struct simd_key_kind_helper<T, false, true>
+{
+    enum { value = sizeof(T) == 4 || sizeof(T) == 8 ? 2 : -1 };
+};
+
+template <class T>
+struct simd_key_kind
+    : simd_key_kind_helper<T, util::is_integral<T>::value, util::is_floating_point<T>::value>
+{
+};
+
+template <class Comp, class T>
+struct simd_compare
+{
+    enum { value = 0 };
+};
+
+template <class T>
+struct simd_compare<std::less<T>, T>
+{
+    enum { value = 1 };
+};
+
+template <class T>
+struct simd_compare<std::greater<T>, T>
+{
+    enum { value = 2 };
+};
+
+// [first, last) is split into the elements before the pivot and the rest, the split point is returned
+template <class T, int kind, bool greater>
+T* simd_partition(T* first, T* last, T pivot)
+{
+    typedef simd_ops<T, kind> ops;
+    typedef typename ops::reg reg;
+    const size_t lanes = ops::lanes;
+    if ((size_t)(last - first) < lanes * 2)
     {
-        ++beg;
+        T* l = first;
+        for (T* i = first; i < last; ++i)
+        {
+            if (greater ? pivot < *i : *i < pivot)
+                std::swap(*l++, *i);
+        }
+        return l;
     }
-    if (beg < mid)
+
+    const simd_perm_table& table = simd_perm_table::instance();
+    reg p = ops::set1(pivot);
+    reg save_l = ops::load(first), save_r = ops::load(last - lanes);
+    T* left = first, *right = last, *read_l = first + lanes, *read_r = last - lanes;
+    // read from the end with less room, so both ends have room for a whole vector
+    while ((size_t)(read_r - read_l) >= lanes)
     {
-        RandomAccessIterator mid_last = mid - 1, last = end - 1;
-        while (mid_last < last && !compare(*last, *mid_last))
+        reg v;
+        if (read_l - left <= right - read_r)
         {
-            --last;
+            v = ops::load(read_l);
+            read_l += lanes;
         }
-        if (mid_last == last)
+        else
         {
-            return;
+            read_r -= lanes;
+            v = ops::load(read_r);
         }
-        end = last + 1;
-    }
-    else
-    {
-        return;
+        ops::partition_store(table, v, greater ? ops::less(p, v) : ops::less(v, p), left, right);
     }
 
-    if (end - beg < merge_2_part_insertion_sort_threshold)
+    // the tail and the two saved vectors fill the gap [left, right) exactly
+    T rest[lanes * 3];
+    size_t n = 0;
+    for (T* i = read_l; i < read_r; ++i)
+        rest[n++] = *i;
+    ops::store(rest + n, save_l);
+    n += lanes;
+    ops::store(rest + n, save_r);
+    n += lanes;
+    for (size_t i = 0; i < n; ++i)
     {
-        insert_sort_part(beg, mid, end, compare);
-        return;
+        if (greater ? pivot < rest[i] : rest[i] < pivot)
+            *left++ = rest[i];
+        else
+            *--right = rest[i];
     }
-
-    merge_2_part_force<safecopy>(buf, beg, mid, end, compare);
+    return left;
 }
 
-template <class RandomAccessIterator>
-void swap_2_part_with_same_length(RandomAccessIterator beg, RandomAccessIterator mid)
+template <class RandomAccessIterator, class Comp, bool simd_key>
+struct simd_partition_enabled_helper
+    : util::value_constant<bool, false>
 {
-    for (RandomAccessIterator l = beg, r = mid; l < mid; ++l, ++r)
+};
+
+template <class RandomAccessIterator, class Comp>
+struct simd_partition_enabled_helper<RandomAccessIterator, Comp, true>
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    static const bool value = simd_compare<Comp, value_type>::value != 0
+        && (util::is_pointer<RandomAccessIterator>::value
+            || util::is_same<RandomAccessIterator, typename std::vector<value_type>::iterator>::value);
+};
+
+template <class RandomAccessIterator, class Comp>
+struct simd_partition_enabled
+    : simd_partition_enabled_helper<RandomAccessIterator, Comp,
+        simd_key_kind<typename std::iterator_traits<RandomAccessIterator>::value_type>::value >= 0>
+{
+};
+
+// bitonic sorting network for the small ranges, the keys are sorted as integers:
+// floats are mapped to integers of the same order and std::greater inverts the bits
+template <int bytes, bool sign>
+struct simd_network_int;
+
+template <>
+struct simd_network_int<4, true> { typedef int32_t type; };
+
+template <>
+struct simd_network_int<4, false> { typedef uint32_t type; };
+
+template <>
+struct simd_network_int<8, true> { typedef long long type; };
+
+template <>
+struct simd_network_int<8, false> { typedef unsigned long long type; };
+
+template <class T, int kind, bool greater>
+struct simd_network_key
+{
+    typedef typename simd_network_int<sizeof(T), kind != 1>::type key;
+
+    static key to_key(T v)
     {
-        std::swap(*l, *r);
+        key k;
+        memcpy(&k, &v, sizeof(k));
+        if (kind == 2)
+            k ^= (k >> (sizeof(key) * 8 - 1)) & std::numeric_limits<key>::max();
+        return greater ? ~k : k;
+    }
+    static T from_key(key k)
+    {
+        T v;
+        if (greater)
+            k = ~k;
+        if (kind == 2)
+            k ^= (k >> (sizeof(key) * 8 - 1)) & std::numeric_limits<key>::max();
+        memcpy(&v, &k, sizeof(v));
+        return v;
     }
+};
+
+template <int bytes>
+inline unsigned long long simd_lane0(__m128i v)
+{
+    unsigned long long low = (unsigned)_mm_cvtsi128_si32(v);
+    return bytes == 4 ? low : low | (unsigned long long)(unsigned)_mm_extract_epi32(v, 1) << 32;
 }
 
-template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator>
-RandomAccessIterator swap_2_part_with_buffer(RandomAccessBufferIterator buf, size_t bufsize, RandomAccessIterator beg, RandomAccessIterator mid, RandomAccessIterator end)
+#if defined(__AVX512F__)
+
+// the maskz forms with a full mask, GCC 12 warns about the unmasked ones under -Wall
+template <int bytes, bool sign>
+struct simd_network_minmax;
+
+template <>
+struct simd_network_minmax<4, true>
 {
-    RandomAccessIterator ret = beg + (end - mid);
-    while (true)
-    {
-        if (mid - beg <= end - mid)
+    static void run(__m512i& a, __m512i& b) { __m512i t = a; a = _mm512_maskz_min_epi32((__mmask16)-1, a, b); b = _mm512_maskz_max_epi32((__mmask16)-1, t, b); }
+};
+
+template <>
+struct simd_network_minmax<4, false>
+{
+    static void run(__m512i& a, __m512i& b) { __m512i t = a; a = _mm512_maskz_min_epu32((__mmask16)-1, a, b); b = _mm512_maskz_max_epu32((__mmask16)-1, t, b); }
+};
+
+template <>
+struct simd_network_minmax<8, true>
+{
+    static void run(__m512i& a, __m512i& b) { __m512i t = a; a = _mm512_maskz_min_epi64((__mmask8)-1, a, b); b = _mm512_maskz_max_epi64((__mmask8)-1, t, b); }
+};
+
+template <>
+struct simd_network_minmax<8, false>
+{
+    static void run(__m512i& a, __m512i& b) { __m512i t = a; a = _mm512_maskz_min_epu64((__mmask8)-1, a, b); b = _mm512_maskz_max_epu64((__mmask8)-1, t, b); }
+};
+
+template <int bytes, bool sign>
+struct simd_network_ops : simd_network_minmax<bytes, sign>
+{
+    typedef __m512i reg;
+    enum { words = 16, lanes = 64 / bytes };
+
+    static reg load(const void* p) { return _mm512_loadu_si512(p); }
+    static void store(void* p, reg v) { _mm512_storeu_si512(p, v); }
+    static reg permute(reg v, const int32_t* index) { return _mm512_maskz_permutexvar_epi32((__mmask16)-1, _mm512_loadu_si512((const void*)index), v); }
+    static reg blend(reg lo, reg hi, const int32_t*, unsigned bits) { return _mm512_mask_blend_epi32((__mmask16)bits, lo, hi); }
+    static reg invert(reg v) { return _mm512_xor_si512(v, _mm512_set1_epi32(-1)); }
+    static unsigned long long lane0(reg v) { return simd_lane0<bytes>(_mm512_maskz_extracti32x4_epi32((__mmask8)-1, v, 0)); }
+};
+
+#else // AVX2
+
+template <int bytes, bool sign>
+struct simd_network_minmax;
+
+template <>
+struct simd_network_minmax<4, true>
+{
+    static void run(__m256i& a, __m256i& b) { __m256i t = a; a = _mm256_min_epi32(a, b); b = _mm256_max_epi32(t, b); }
+};
+
+template <>
+struct simd_network_minmax<4, false>
+{
+    static void run(__m256i& a, __m256i& b) { __m256i t = a; a = _mm256_min_epu32(a, b); b = _mm256_max_epu32(t, b); }
+};
+
+// AVX2 has no 64-bit min and max
+template <>
+struct simd_network_minmax<8, true>
+{
+    static void run(__m256i& a, __m256i& b)
+    {
+        __m256i gt = _mm256_cmpgt_epi64(a, b), t = a;
+        a = _mm256_blendv_epi8(a, b, gt);
+        b = _mm256_blendv_epi8(b, t, gt);
+    }
+};
+
+template <>
+struct simd_network_minmax<8, false>
+{
+    static void run(__m256i& a, __m256i& b)
+    {
+        __m256i sign = _mm256_set1_epi64x((long long)1 << 63);
+        __m256i gt = _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign)), t = a;
+        a = _mm256_blendv_epi8(a, b, gt);
+        b = _mm256_blendv_epi8(b, t, gt);
+    }
+};
+
+template <int bytes, bool sign>
+struct simd_network_ops : simd_network_minmax<bytes, sign>
+{
+    typedef __m256i reg;
+    enum { words = 8, lanes = 32 / bytes };
+
+    static reg load(const void* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static void store(void* p, reg v) { _mm256_storeu_si256((__m256i*)p, v); }
+    static reg permute(reg v, const int32_t* index) { return _mm256_permutevar8x32_epi32(v, load(index)); }
+    static reg blend(reg lo, reg hi, const int32_t* mask, unsigned) { return _mm256_blendv_epi8(lo, hi, load(mask)); }
+    static reg invert(reg v) { return _mm256_xor_si256(v, _mm256_set1_epi32(-1)); }
+    static unsigned long long lane0(reg v) { return simd_lane0<bytes>(_mm256_castsi256_si128(v)); }
+};
+
+#endif
+
+template <int bytes>
+struct simd_network_table
+{
+    enum { words = simd_network_ops<bytes, true>::words, lanes = simd_network_ops<bytes, true>::lanes };
+    // index[x] moves lane i ^ x to lane i, upper[j] selects the lanes with bit j set
+    int32_t index[lanes][words];
+    int32_t upper[lanes][words];
+    unsigned upper_bits[lanes];
+
+    simd_network_table()
+    {
+        const int w = bytes / 4;
+        for (int x = 0; x < lanes; ++x)
         {
-            if (mid - beg > 0)
+            upper_bits[x] = 0;
+            for (int i = 0; i < words; ++i)
             {
-                if ((size_t)(mid - beg) > bufsize)
-                {
-                    swap_2_part_with_same_length(beg, mid);
-                    RandomAccessIterator m = mid;
-                    mid += mid - beg;
-                    beg = m;
-                }
-                else
-                {
-                    if (safecopy)
-                    {
-                        RandomAccessBufferIterator t = buf;
-                        for (RandomAccessIterator s = beg; s != mid; ++s, ++t)
-                        {
-                            *t = *s;
-                        }
-                        RandomAccessIterator m = beg;
-                        for (RandomAccessIterator s = mid; s < end; ++s, ++m)
-                        {
-                            *m = *s;
-                        }
-                        for (RandomAccessBufferIterator it = buf; it < t; ++m, ++it)
-                        {
-                            *m = *it;
-                        }
-                    }
-                    else
-                    {
-                        memcpy((char*)buf, (char*)&*beg, (char*)&*mid - (char*)&*beg);
-                        memmove((char*)&*beg, (char*)&*mid, (char*)&*end - (char*)&*mid);
-                        memcpy((char*)&*(beg + (end - mid)), (char*)buf, (char*)&*mid - (char*)&*beg);
-                    }
-                    return ret;
-                }
+                index[x][i] = (i / w ^ x) * w + i % w;
+                upper[x][i] = i / w & x ? -1 : 0;
+                upper_bits[x] |= (unsigned)(i / w & x ? 1 : 0) << i;
             }
-            else
-                return ret;
         }
-        else
+    }
+
+    static const simd_network_table& instance()
+    {
+        static const simd_network_table table;
+        return table;
+    }
+};
+
+template <class Key, int regs>
+struct simd_network
+{
+    typedef simd_network_ops<sizeof(Key), ((Key)(-1) < (Key)0)> ops;
+    typedef typename ops::reg reg;
+    typedef simd_network_table<sizeof(Key)> table_type;
+    enum { lanes = ops::lanes, size = lanes * regs };
+
+    // elements i and i ^ x are ordered, the lanes with bit j set take the bigger one
+    static reg exchange(const table_type& table, reg v, int x, int j)
+    {
+        reg lo = v, hi = ops::permute(v, table.index[x]);
+        ops::run(lo, hi);
+        return ops::blend(lo, hi, table.upper[j], table.upper_bits[j]);
+    }
+
+    static void sort(Key* buf)
+    {
+        const table_type& table = table_type::instance();
+        reg v[regs];
+        for (int r = 0; r < regs; ++r)
+            v[r] = ops::load(buf + r * lanes);
+        // each block of b is made bitonic by ordering i against i ^ (b - 1), then half cleaned down to pairs
+        for (int b = 2; b <= size; b *= 2)
         {
-            if (end - mid > 0)
+            if (b <= lanes)
             {
-                if ((size_t)(end - mid) > bufsize)
+                for (int r = 0; r < regs; ++r)
+                    v[r] = exchange(table, v[r], b - 1, b / 2);
+            }
+            else
+            {
+                int rb = b / lanes;
+                for (int r = 0; r < regs; ++r)
                 {
-                    swap_2_part_with_same_length(mid - (end - mid), mid);
-                    RandomAccessIterator m = mid;
-                    mid -= end - mid;
-                    end = m;
+                    if (r & rb / 2)
+                        continue;
+                    int p = r ^ (rb - 1);
+                    reg t = ops::permute(v[p], table.index[lanes - 1]);
+                    ops::run(v[r], t);
+                    v[p] = ops::permute(t, table.index[lanes - 1]);
+                }
+            }
+            for (int j = b / 4; j > 0; j /= 2)
+            {
+                if (j < lanes)
+                {
+                    for (int r = 0; r < regs; ++r)
+                        v[r] = exchange(table, v[r], j, j);
                 }
                 else
                 {
-                    if (safecopy)
-                    {
-                        RandomAccessBufferIterator t = buf;
-                        for (RandomAccessIterator s = mid; s != end; ++s, ++t)
-                        {
-                            *t = *s;
-                        }
-                        RandomAccessIterator m = end - 1;
-                        for (RandomAccessIterator s = mid - 1; s >= beg; --s, --m)
-                        {
-                            *m = *s;
-                        }
-                        for (--t; t >= buf; --m, --t)
-                        {
-                            *m = *t;
-                        }
-                    }
-                    else
+                    int rj = j / lanes;
+                    for (int r = 0; r < regs; ++r)
                     {
-                        memcpy((char*)buf, (char*)&*mid, (char*)&*end - (char*)&*mid);
-                        memmove((char*)&*(end - (mid - beg)), (char*)&*beg, (char*)&*mid - (char*)&*beg);
-                        memcpy((char*)&*beg, (char*)buf, (char*)&*end - (char*)&*mid);
+                        if (!(r & rj))
+                            ops::run(v[r], v[r + rj]);
                     }
-                    return ret;
                 }
             }
-            else
-                return ret;
         }
+        for (int r = 0; r < regs; ++r)
+            ops::store(buf + r * lanes, v[r]);
     }
-}
+};
 
-template <class RandomAccessIterator, class Comp>
-std::pair<RandomAccessIterator, RandomAccessIterator> find_swap_bound(RandomAccessIterator beg, RandomAccessIterator mid, RandomAccessIterator end, Comp compare)
+// sorts n <= simd_network_max_size elements, padded with the biggest key to a power of two
+template <class T, int kind, bool greater>
+void simd_small_sort(T* first, size_t n)
 {
-    if (end - beg < find_swap_bound_optimize_threshold)
+    typedef simd_network_key<T, kind, greater> convert;
+    typedef typename convert::key key;
+    enum { lanes = simd_network<key, 1>::lanes, max_regs = simd_network_max_size / lanes };
+    key buf[simd_network_max_size];
+    size_t size = (size_t)lanes;
+    while (size < n)
+        size *= 2;
+    for (size_t i = 0; i < n; ++i)
+        buf[i] = convert::to_key(first[i]);
+    for (size_t i = n; i < size; ++i)
+        buf[i] = std::numeric_limits<key>::max();
+    switch (size / lanes)
     {
-        RandomAccessIterator pivot_r = mid + (end - mid) / 2 + 1;
-        RandomAccessIterator pivot_l = std::upper_bound(beg, mid, *pivot_r, compare);
-
-        pivot_r = std::lower_bound(pivot_r, end, *pivot_l, compare);
-
-        return std::make_pair(pivot_l, pivot_r);
+    case 1: simd_network<key, 1>::sort(buf); break;
+    case 2: simd_network<key, 2>::sort(buf); break;
+    case 4: simd_network<key, 4>::sort(buf); break;
+    case 8: simd_network<key, (max_regs < 8 ? max_regs : 8)>::sort(buf); break;
+    default: simd_network<key, max_regs>::sort(buf); break;
     }
-    else
-    {
-        typedef typename std::iterator_traits<RandomAccessIterator>::difference_type diff_type;
+    for (size_t i = 0; i < n; ++i)
+        first[i] = convert::from_key(buf[i]);
+}
 
-        RandomAccessIterator pivot_l = beg;
-        RandomAccessIterator pivot_l_map = std::lower_bound(mid, end, *pivot_l, compare);
+// the stable sorts take only integers, equal floats like 0.0 and -0.0 can be told apart
+template <class RandomAccessIterator, class Comp, bool stable>
+struct simd_network_enabled
+{
+    static const bool value = simd_partition_enabled<RandomAccessIterator, Comp>::value
+        && !(stable && simd_key_kind<typename std::iterator_traits<RandomAccessIterator>::value_type>::value == 2);
+};
 
-        if (pivot_l_map - mid > (end - mid) / 2 || mid - pivot_l <= pivot_l_map - mid)
+// merges two sorted integer runs a block of lanes at a time: the new block and the kept upper block
+// are merged by a bitonic network, the lower half is written out; backward runs are read from their ends
+template <class T, bool greater>
+struct simd_merge
+{
+    typedef simd_network_ops<sizeof(T), ((T)(-1) < (T)0)> ops;
+    typedef typename ops::reg reg;
+    typedef simd_network_table<sizeof(T)> table_type;
+    enum { lanes = ops::lanes };
+
+    // the keys are ascending in the merge order
+    template <bool backward>
+    static reg fetch(const table_type& table, const T*& p)
+    {
+        reg v;
+        if (backward)
         {
-            return std::make_pair(pivot_l, pivot_l_map);
+            p -= lanes;
+            v = ops::permute(ops::load(p), table.index[lanes - 1]);
         }
-
-        RandomAccessIterator pivot_r = std::lower_bound(beg, mid, *(end - 1), compare);
-        RandomAccessIterator pivot_r_map = std::lower_bound(mid, end, *pivot_r, compare);
-
-        if (mid - pivot_r > (mid - beg) / 2 || mid - pivot_r >= pivot_r_map - mid)
+        else
         {
-            return std::make_pair(pivot_r, pivot_r_map);
+            v = ops::load(p);
+            p += lanes;
         }
+        return greater != backward ? ops::invert(v) : v;
+    }
 
-        do
+    template <bool backward>
+    static void put(const table_type& table, T*& p, reg v)
+    {
+        if (greater != backward)
+            v = ops::invert(v);
+        if (backward)
         {
-            RandomAccessIterator pivot_m = pivot_l + (pivot_r - pivot_l) / 2;
-            pivot_m = std::lower_bound(pivot_l, pivot_r, *pivot_m, compare);
-            if (pivot_m == pivot_l)
-            {
-                pivot_m = std::upper_bound(pivot_l, pivot_r, *pivot_m, compare);
-                if (pivot_m == pivot_r)
-                {
-                    {
-                        diff_type pivot_m_diff = (mid - pivot_l) - (pivot_l_map - mid);
-                        if (pivot_l + pivot_m_diff <= pivot_r)
-                        {
-                            return std::make_pair(pivot_l + pivot_m_diff, pivot_l_map);
-                        }
-                    }
-                    {
-                        diff_type pivot_m_diff = (mid - pivot_r) - (pivot_r_map - mid);
-                        if (pivot_l_map - pivot_m_diff <= pivot_r_map)
-                        {
-                            return std::make_pair(pivot_r, pivot_r_map + pivot_m_diff);
-                        }
-                    }
-                    return std::make_pair(pivot_l, pivot_l_map);
-                }
-            }
-            RandomAccessIterator pivot_m_map = std::lower_bound(pivot_l_map, pivot_r_map, *pivot_m, compare);
-            diff_type pivot_m_diff = (mid - pivot_m) - (pivot_m_map - mid);
-            if (pivot_m_diff > 0)
-            {
-                pivot_l = pivot_m;
-                pivot_l_map = pivot_m_map;
-            }
-            else if (pivot_m_diff < 0)
-            {
-                pivot_r = pivot_m;
-                pivot_r_map = pivot_m_map;
-            }
-            else
-            {
-                return std::make_pair(pivot_m, pivot_m_map);
-            }
-        } while (true);
-
-        return std::make_pair(pivot_l, pivot_l_map);
+            p -= lanes;
+            ops::store(p, ops::permute(v, table.index[lanes - 1]));
+        }
+        else
+        {
+            ops::store(p, v);
+            p += lanes;
+        }
     }
-}
 
-// stable sort
-template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
-void merge_2_part_with_buffer(RandomAccessBufferIterator buf, size_t bufsize, RandomAccessIterator beg, RandomAccessIterator mid, RandomAccessIterator end, Comp compare)
-{
-    if (!compare(*mid, *(mid - 1)))
+    // the key of the last element of the next block
+    template <bool backward>
+    static T block_last(const T* p)
     {
-        return;
+        T v = backward ? *(p - lanes) : *(p + lanes - 1);
+        return greater != backward ? ~v : v;
     }
-    while (beg < mid && !compare(*mid, *beg))
+
+    template <bool backward>
+    static bool head_before(const T* a, const T* b)
     {
-        ++beg;
+        return backward ? (greater ? !(b[-1] < a[-1]) : !(a[-1] < b[-1])) : (greater ? !(a[0] < b[0]) : !(b[0] < a[0]));
     }
-    if (beg < mid)
+
+    // lo and hi are sorted, afterwards lo holds the lower half of both and hi the upper
+    static void merge(const table_type& table, reg& lo, reg& hi)
     {
-        RandomAccessIterator mid_last = mid - 1, last = end - 1;
-        while (mid_last < last && !compare(*last, *mid_last))
+        hi = ops::permute(hi, table.index[lanes - 1]);
+        ops::run(lo, hi);
+        for (int j = lanes / 2; j > 0; j /= 2)
         {
-            --last;
-        }
-        if (mid_last < last)
-        {
-            end = last + 1;
+            lo = simd_network<T, 1>::exchange(table, lo, j, j);
+            hi = simd_network<T, 1>::exchange(table, hi, j, j);
         }
-        else
+    }
+
+    // runs until the run with the lower head has less than a block left, the kept block goes to rest
+    template <bool backward>
+    static void run(const T*& a, size_t& na, const T*& b, size_t& nb, T*& out, T* rest)
+    {
+        const table_type& table = table_type::instance();
+        reg lo = fetch<backward>(table, a), hi = fetch<backward>(table, b);
+        na -= lanes;
+        nb -= lanes;
+        merge(table, lo, hi);
+        put<backward>(table, out, lo);
+        while (true)
         {
-            return;
+            bool take_a = nb == 0 || (na != 0 && head_before<backward>(a, b));
+            const T*& p = take_a ? a : b;
+            size_t& n = take_a ? na : nb;
+            if (n < (size_t)lanes)
+                break;
+            T last = block_last<backward>(p);
+            lo = fetch<backward>(table, p);
+            n -= lanes;
+            // a block below the kept one goes out as it is, which is common on presorted or clustered input
+            if (!((T)ops::lane0(hi) < last))
+            {
+                put<backward>(table, out, lo);
+                continue;
+            }
+            merge(table, lo, hi);
+            put<backward>(table, out, lo);
         }
+        T* p = backward ? rest + lanes : rest;
+        put<backward>(table, p, hi);
     }
-    else
+};
+#else
+template <class RandomAccessIterator, class Comp>
+struct simd_partition_enabled
+    : util::value_constant<bool, false>
+{
+};
+
+template <class RandomAccessIterator, class Comp, bool stable>
+struct simd_network_enabled
+    : util::value_constant<bool, false>
+{
+};
+#endif
+
+// sorts ranges of at most simd_network_max_size elements, returns false to leave the range to the caller,
+// run_reverse sorts them backwards for the descending runs of timsort
+template <bool simd>
+struct small_sort_kernel
+{
+    template <class RandomAccessIterator, class Comp>
+    static bool run(RandomAccessIterator, RandomAccessIterator, Comp)
     {
-        return;
+        return false;
     }
 
-    if (end - beg < merge_2_part_insertion_sort_threshold || end - mid < 3 || mid - beg < 3)
+    template <class RandomAccessIterator, class Comp>
+    static bool run_reverse(RandomAccessIterator, RandomAccessIterator, Comp)
     {
-        insert_sort_part(beg, mid, end, compare);
-        return;
+        return false;
     }
+};
 
-    if ((size_t)(end - mid) <= bufsize || (size_t)(mid - beg) <= bufsize)
+#ifdef BAO_SORT_LIB_SIMD
+template <>
+struct small_sort_kernel<true>
+{
+    template <class RandomAccessIterator, class Comp>
+    static bool run(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
     {
-        merge_2_part_force<safecopy>(buf, beg, mid, end, compare);
-        return;
+        if (end - beg > simd_network_max_size)
+            return false;
+        // nearly sorted ranges are cheaper by insertion, which gives up after a few moves
+        if (insert_sort_limit(beg, end, compare, 1) != end)
+            sort<false>(beg, end, compare);
+        return true;
     }
 
-    std::pair<RandomAccessIterator, RandomAccessIterator> pair = find_swap_bound(beg, mid, end, compare);
+    template <class RandomAccessIterator, class Comp>
+    static bool run_reverse(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+    {
+        if (end - beg > simd_network_max_size)
+            return false;
+        sort<true>(beg, end, compare);
+        return true;
+    }
 
-    RandomAccessIterator swap_mid = swap_2_part_with_buffer<safecopy>(buf, bufsize, pair.first, mid, pair.second);
-    if (beg < pair.first)
-        merge_2_part_with_buffer<safecopy>(buf, bufsize, beg, pair.first, swap_mid, compare);
-    if (pair.second < end)
-        merge_2_part_with_buffer<safecopy>(buf, bufsize, swap_mid, pair.second, end, compare);
-}
-
-// stable sort
-template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
-void merge_sort_recursive(RandomAccessBufferIterator buf, RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
-{
-    size_t len = end - beg;
-    if (len < merge_insertion_sort_threshold)
+    template <bool reverse, class RandomAccessIterator, class Comp>
+    static void sort(RandomAccessIterator beg, RandomAccessIterator end, Comp)
     {
-        insert_sort(beg, end, compare);
-        return;
+        typedef typename std::iterator_traits<RandomAccessIterator>::value_type T;
+        if (end - beg > 1)
+            simd_small_sort<T, simd_key_kind<T>::value, (simd_compare<Comp, T>::value == 2) != reverse>(&*beg, end - beg);
     }
-    RandomAccessIterator mid = beg + (len >> 1);
-    merge_sort_recursive<safecopy>(buf, beg, mid, compare);
-    merge_sort_recursive<safecopy>(buf, mid, end, compare);
-    merge_2_part<safecopy>(buf, beg, mid, end, compare);
-}
+};
+#endif
 
-// stable sort
-template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
-void merge_sort_recursive_with_buffer(RandomAccessBufferIterator buf, size_t bufsize, RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+// finishes merge_2_part_force once the shorter run is in buf, returns false to leave it to the caller
+template <bool simd>
+struct merge_2_part_kernel
 {
-    size_t len = end - beg;
-    if (len < merge_insertion_sort_threshold)
+    template <bool backward, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+    static bool run(RandomAccessBufferIterator, RandomAccessIterator, RandomAccessIterator, RandomAccessIterator, Comp)
     {
-        insert_sort(beg, end, compare);
-        return;
+        return false;
     }
-    RandomAccessIterator mid = beg + (len >> 1);
-    merge_sort_recursive_with_buffer<safecopy>(buf, bufsize, beg, mid, compare);
-    merge_sort_recursive_with_buffer<safecopy>(buf, bufsize, mid, end, compare);
-    merge_2_part_with_buffer<safecopy>(buf, bufsize, beg, mid, end, compare);
-}
+};
 
-// stable sort
-template <bool safecopy, class RandomAccessIterator, class Comp>
-void merge_sort_with_buffer(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, bool buffered)
+#ifdef BAO_SORT_LIB_SIMD
+template <>
+struct merge_2_part_kernel<true>
 {
-    if (end - beg > 1)
+    // buf holds [beg, mid), or [mid, end) for the backward merge
+    template <bool backward, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+    static bool run(RandomAccessBufferIterator buf, RandomAccessIterator beg, RandomAccessIterator mid, RandomAccessIterator end, Comp compare)
     {
-        typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
-        if (buffered)
+        typedef typename std::iterator_traits<RandomAccessIterator>::value_type T;
+        typedef simd_merge<T, simd_compare<Comp, T>::value == 2> merger;
+        const size_t lanes = merger::lanes;
+        size_t na = backward ? end - mid : mid - beg, nb = backward ? mid - beg : end - mid;
+        if (na < lanes || nb < lanes)
+            return false;
+        T* first = &*beg;
+        const T* a = backward ? &*buf + na : &*buf;
+        const T* b = backward ? first + nb : first + na;
+        T* out = backward ? first + na + nb : first;
+        T rest[merger::lanes], tmp[merger::lanes * 2];
+        merger::template run<backward>(a, na, b, nb, out, rest);
+
+        // the kept block takes the shorter leftover, the in-place leftover of b is merged last or copied out first
+        if (!backward)
         {
-            if ((end - beg) / 2 * sizeof(value_type) <= merge_sort_stack_buffer_size)
-            {
-                value_type buf[merge_sort_stack_buffer_size / sizeof(value_type)];
-                merge_sort_recursive<safecopy>(buf, beg, end, compare);
-            }
-            else if (merge_sort_alloc_buffer)
-            {
-                size_t bufsize = (size_t)sqrt(end - beg + 0.1);
-                value_type * buf = new value_type[bufsize];
-                merge_sort_recursive_with_buffer<safecopy>(buf, bufsize, beg, end, compare);
-                delete[] buf;
-            }
+            if (na < lanes)
+                merge_to(tmp, merge_to(rest, lanes, a, na, tmp, compare), b, nb, out, compare);
             else
-            {
-                // not really in-place, uses a fixed size of buffer in stack
-                value_type buf[merge_sort_stack_buffer_size / sizeof(value_type)];
-                merge_sort_recursive_with_buffer<safecopy>(buf, sizeof(buf) / sizeof(value_type), beg, end, compare);
-            }
+                merge_to(a, na, tmp, merge_to(rest, lanes, b, nb, tmp, compare), out, compare);
         }
         else
         {
-            merge_sort_recursive_with_buffer<false>((value_type*)NULL, 0, beg, end, compare);
+            if (na < lanes)
+                merge_back(tmp, merge_to(rest, lanes, a - na, na, tmp, compare), first, nb, out, compare);
+            else
+                merge_to(a - na, na, tmp, merge_to(rest, lanes, b - nb, nb, tmp, compare), first, compare);
         }
+        return true;
     }
-}
 
-template <class RandomAccessIterator, class Comp>
-RandomAccessIterator quick_sort_partition(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, bool& swaped)
-{
-    typedef typename std::iterator_traits<RandomAccessIterator>::difference_type diff_type;
-    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
-    RandomAccessIterator l = beg, r = end - 1;
-    uint32_t rnd = util::fake_rand_simple();
-    diff_type n = end - beg, h = (n - 1) / 2;
-    if (util::is_scalar<value_type>::value)
+    template <class T, class Comp>
+    static size_t merge_to(const T* a, size_t na, const T* b, size_t nb, T* out, Comp compare)
     {
-        diff_type w = h;
-        util::make_mid_pivot(*(beg + rnd % w), *r, *(beg + h + rnd % w), compare);
+        const T* a_end = a + na, *b_end = b + nb;
+        while (a < a_end && b < b_end)
+            *out++ = compare(*b, *a) ? *b++ : *a++;
+        while (a < a_end)
+            *out++ = *a++;
+        while (b < b_end)
+            *out++ = *b++;
+        return na + nb;
     }
-    else
+
+    // [first, first + nb) is in place at the start of the output, which ends at out
+    template <class T, class Comp>
+    static void merge_back(const T* a, size_t na, T* first, size_t nb, T* out, Comp compare)
     {
-        if (n < 1 << 14)
+        const T* a_end = a + na;
+        T* b_end = first + nb;
+        while (a < a_end && first < b_end)
+            *--out = compare(*(a_end - 1), *(b_end - 1)) ? *--b_end : *--a_end;
+        while (a < a_end)
+            *--out = *--a_end;
+    }
+};
+#endif
+
+template <class RandomAccessIterator, class Comp>
+void shell_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    if (end - beg > shellsort_insertion_sort_threshold)
+    {
+        typedef typename std::iterator_traits<RandomAccessIterator>::difference_type diff_type;
+        typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+        diff_type len = end - beg;
+        diff_type incre_list[61] = { 0, 9, 34, 182, 836, 4025, 19001, 90358, 428481, 2034035, 9651787, 45806244, 217378076, 1031612713 };
+        const double incre_factor = 2.9; // simple and fast enought
+
+        if (!util::is_scalar<value_type>::value)
         {
-            diff_type w = h;
-            util::make_mid_pivot(*(beg + rnd % w), *r, *(beg + h + rnd % w), compare);
+            incre_list[1] = 10;
         }
-        else
+        diff_type incre_index = 0;
+        for (diff_type i = 1; i < 60; ++i)
         {
-            diff_type w = h - 3;
-            util::make_mid_pivot(*(beg), *(r), *(beg + h + 1), compare);
-            util::make_mid_pivot(*(beg + 1), *(beg + h - 1), *(r - 1), compare);
-            util::make_mid_pivot(*(beg + 2 + rnd % w), *(beg + h), *(r - 2 - rnd % w), compare);
-            util::make_mid_pivot(*(beg + h - 1), *(r), *(beg + h), compare);
+            diff_type mul = incre_list[i];
+            if (mul * incre_factor >= len)
+            {
+                incre_index = i;
+                break;
+            }
+            if (!util::is_scalar<value_type>::value || incre_list[i + 1] == 0)
+            {
+                incre_list[i + 1] = (diff_type)(mul * incre_factor);
+            }
         }
-    }
-
-    value_type pivot = *r;
 
-    while (compare(*l, pivot))
-        ++l;
-    while (l < r && !compare(*r, pivot))
-        --r;
-    if (l < r)
-    {
-        std::swap(*l++, *r--);
-        swaped = true;
-        while (1)
+        for (; incre_index > 0; --incre_index)
         {
-            while (compare(*l, pivot))
-                ++l;
-            while (!compare(*r, pivot))
-                --r;
-            if (l >= r)
-                break;
-            std::swap(*l++, *r--);
+            bool swaped = false;
+            diff_type incre = incre_list[incre_index];
+            for (diff_type i = incre; i < len; i++)
+            {
+                if (compare(*(beg + i), *(beg + i - incre)))
+                {
+                    value_type val = BAO_MOVE(*(beg + i));
+                    *(beg + i) = BAO_MOVE(*(beg + i - incre));
+                    diff_type pos = i - incre;
+                    for (; pos >= incre && compare(val, *(beg + pos - incre)); pos -= incre)
+                    {
+                        *(beg + pos) = BAO_MOVE(*(beg + pos - incre));
+                    }
+                    *(beg + pos) = BAO_MOVE(val);
+                    swaped = true;
+                }
+            }
+            if (!swaped)
+            {
+                RandomAccessIterator last = insert_sort_limit(beg, end, compare, 1);
+                if (last == end)
+                {
+                    return;
+                }
+                if (last - beg >= incre << 1)
+                {
+                    beg += ((last - beg) / incre - 1) * incre;
+                    len = end - beg;
+                }
+            }
         }
+
+        insert_sort(beg, beg + incre_list[1], compare);
+        unguarded_insert_sort(beg + incre_list[1], end, compare);
+    }
+    else
+    {
+        insert_sort(beg, end, compare);
     }
-    std::swap(*l, *(end - 1));
-    return l;
 }
 
 template <class RandomAccessIterator, class Comp>
-void quick_sort_loop(RandomAccessIterator beg, RandomAccessIterator end, int deep, Comp compare, bool leftmost)
+void max_heapify_p(RandomAccessIterator first, RandomAccessIterator target, RandomAccessIterator last, Comp compare)
 {
-    if (end - beg <= qsort_insertion_sort_threshold)
+    typename std::iterator_traits<RandomAccessIterator>::value_type temp = BAO_MOVE(*target);
+    --first;
+    RandomAccessIterator son;
+    for (; (son = target + (target - first)) <= last; target = son)
     {
-        if (leftmost)
-        {
-            q_insert_sort(beg, end, compare);
-        }
+        if (son < last && compare(*son, *(son + 1)))
+            ++son;
+        if (compare(temp, *son))
+            *target = BAO_MOVE(*son);
         else
-        {
-            unguarded_q_insert_sort(beg, end, compare);
-        }
-        return;
-    }
-    if (deep <= 0)
-    {
-        shell_sort(beg, end, compare);
-        return;
+            break;
     }
+    *target = BAO_MOVE(temp);
+}
 
-    bool swaped = false;
-    RandomAccessIterator l = quick_sort_partition(beg, end, compare, swaped), r = l + 1;
-    if (!swaped && !compare(*(l - 1), *beg))
+template <class RandomAccessIterator, class Comp>
+void heap_sort_p(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    if (end - beg > 1)
     {
-        RandomAccessIterator i = leftmost ? insert_sort_limit(beg, l, compare, 1)
-            : unguarded_insert_sort_limit(beg, l, compare, 1);
-        if (i == l)
-        {
-            i = unguarded_insert_sort_limit(r, end, compare, 1);
-        }
-        if (i == end)
-        {
-            return;
-        }
-        if (i >= l)
+        for (RandomAccessIterator i = beg + (end - beg) / 2; i >= beg; --i)
+            max_heapify_p(beg, i, end - 1, compare);
+        for (--end; end > beg; )
         {
-            while (r < end && util::object_equal(*r, *l, compare)) ++r;
-            return quick_sort_loop(r, end, deep - 1, compare, false);
+            std::swap(*beg, *end--);
+            max_heapify_p(beg, beg, end, compare);
         }
     }
-    while (r < end && util::object_equal(*r, *l, compare)) ++r;
-
-    quick_sort_loop(beg, l, deep - 1, compare, leftmost);
-    quick_sort_loop(r, end, deep - 1, compare, false);
 }
 
 template <class RandomAccessIterator, class Comp>
-void quick_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+void max_heapify_1(RandomAccessIterator arr, size_t index, size_t last, Comp compare)
 {
-    if (end - beg > 1)
+    typename std::iterator_traits<RandomAccessIterator>::value_type temp = BAO_MOVE(arr[index]);
+    size_t child;
+    for (; (child = index << 1) <= last; index = child)
     {
-        double deep = log((double)(end - beg)) / log(1.5);
-        quick_sort_loop(beg, end, (int)deep, compare, true);
+        if (child < last && compare(*(arr + child), *(arr + child + 1)))
+            ++child;
+        if (compare(temp, *(arr + child)))
+            *(arr + index) = BAO_MOVE(*(arr + child));
+        else
+            break;
     }
+    *(arr + index) = BAO_MOVE(temp);
 }
 
 template <class RandomAccessIterator, class Comp>
-RandomAccessIterator tim_sort_create_run(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+void heap_sort_1(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
 {
-    if (end - beg < timsort_last_run_threshold) // must bigger than timsort_min_run
+    if (end - beg > 1)
     {
-        insert_sort(beg, end, compare);
-        return end;
+        size_t length = (size_t)(end - beg);
+        RandomAccessIterator parr = beg - 1;
+        for (size_t i = length / 2; i > 0; --i)
+            max_heapify_1(parr, i, length, compare);
+        for (size_t i = length - 1; i > 0; --i)
+        {
+            std::swap(*beg, *(beg + i));
+            max_heapify_1(parr, 1, i, compare);
+        }
     }
+}
 
-    bool ascending;
-    RandomAccessIterator run_end = beg + 3;
-
-    if (compare(*(beg + 1), *beg))
+// std::upper_bound by an exponential search from one end, O(log d) for the answer d away from that end
+template <bool from_back, class RandomAccessIterator, class T, class Comp>
+RandomAccessIterator gallop_upper_bound(RandomAccessIterator first, RandomAccessIterator last, const T& val, Comp compare)
+{
+    typename std::iterator_traits<RandomAccessIterator>::difference_type len = last - first, lo = 0, hi = 1;
+    if (from_back)
     {
-        if (!compare(*(beg + 2), *beg))
+        while (hi <= len && compare(val, *(last - hi)))
         {
-            std::swap(*beg, *(beg + 1));
-            ascending = true;
+            lo = hi;
+            hi = hi * 2 + 1;
         }
-        else if (compare(*(beg + 2), *(beg + 1)))
+        return std::upper_bound(hi > len ? first : last - hi, last - lo, val, compare);
+    }
+    while (hi < len && !compare(val, *(first + hi)))
+    {
+        lo = hi;
+        hi = hi * 2 + 1;
+    }
+    return std::upper_bound(first + lo, hi > len ? last : first + hi, val, compare);
+}
+
+// std::lower_bound by an exponential search from one end
+template <bool from_back, class RandomAccessIterator, class T, class Comp>
+RandomAccessIterator gallop_lower_bound(RandomAccessIterator first, RandomAccessIterator last, const T& val, Comp compare)
+{
+    typename std::iterator_traits<RandomAccessIterator>::difference_type len = last - first, lo = 0, hi = 1;
+    if (from_back)
+    {
+        while (hi <= len && !compare(*(last - hi), val))
         {
-            ascending = false;
-        }
-        else
-        {
-            std::swap(*(beg + 2), *(beg + 1));
-            ascending = false;
+            lo = hi;
+            hi = hi * 2 + 1;
         }
+        return std::lower_bound(hi > len ? first : last - hi, last - lo, val, compare);
     }
-    else
+    while (hi < len && compare(*(first + hi), val))
     {
-        if (compare(*(beg + 2), *beg))
-        {
-            std::swap(*beg, *(beg + 1));
-            ascending = false;
-        }
-        else if (!compare(*(beg + 2), *(beg + 1)))
-        {
-            ascending = true;
-        }
-        else
-        {
-            std::swap(*(beg + 2), *(beg + 1));
-            ascending = true;
-        }
+        lo = hi;
+        hi = hi * 2 + 1;
     }
+    return std::lower_bound(first + lo, hi > len ? last : first + hi, val, compare);
+}
 
-    if (!ascending)
+// stable sort, runs in galloping mode while one side wins at least min_gallop times in a row,
+// min_gallop drops while galloping pays off and rises when it stops
+template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+void merge_2_part_force(RandomAccessBufferIterator buf, RandomAccessIterator beg, RandomAccessIterator mid, RandomAccessIterator end, Comp compare)
+{
+    if (mid - beg <= end - mid)
     {
-        while (run_end < end && compare(*run_end, *(run_end - 1)))
+        if (safecopy)
         {
-            ++run_end;
+            RandomAccessBufferIterator t = buf;
+            for (RandomAccessIterator s = beg; s != mid; ++s, ++t)
+            {
+                *t = BAO_MOVE(*s);
+            }
         }
+        else
+            memcpy((char*)buf, (char*)&*beg, (char*)&*mid - (char*)&*beg);
+        if (merge_2_part_kernel<simd_network_enabled<RandomAccessIterator, Comp, true>::value>::template run<false>(buf, beg, mid, end, compare))
+            return;
 
-        if (run_end - beg < timsort_min_run)
+        RandomAccessBufferIterator start1 = buf, start1_end = buf + (mid - beg);
+        RandomAccessIterator start2 = mid, k = beg;
+        size_t min_gallop = merge_min_gallop, count1 = 0, count2 = 0;
+        while (start1 < start1_end && start2 < end)
         {
-            insert_sort_part_rev(beg, run_end, beg + timsort_min_run, compare);
-            run_end = beg + timsort_min_run;
-            while (run_end < end && compare(*run_end, *(run_end - timsort_insert_gap)))
+            if (compare(*start2, *start1))
             {
-                unguarded_insert_single_rev(run_end, compare);
-                ++run_end;
+                *k++ = BAO_MOVE(*start2++);
+                count1 = 0;
+                if (++count2 < min_gallop || start2 >= end)
+                    continue;
+            }
+            else
+            {
+                *k++ = BAO_MOVE(*start1++);
+                count2 = 0;
+                if (++count1 < min_gallop || start1 >= start1_end)
+                    continue;
             }
-        }
 
-        // reverse
-        typename std::iterator_traits<RandomAccessIterator>::value_type t;
-        for (RandomAccessIterator b = beg, e = run_end - 1; b < e; ++b, --e)
+            // one side keeps winning, copy the blocks found by galloping while they stay long
+            while (true)
+            {
+                RandomAccessBufferIterator next1 = gallop_upper_bound<false>(start1, start1_end, *start2, compare);
+                count1 = next1 - start1;
+                while (start1 < next1)
+                    *k++ = BAO_MOVE(*start1++);
+                if (start1 >= start1_end)
+                    break;
+                RandomAccessIterator next2 = gallop_lower_bound<false>(start2, end, *start1, compare);
+                count2 = next2 - start2;
+                while (start2 < next2)
+                    *k++ = BAO_MOVE(*start2++);
+                if (start2 >= end)
+                    break;
+                if (count1 < merge_min_gallop && count2 < merge_min_gallop)
+                {
+                    ++min_gallop;
+                    break;
+                }
+                if (min_gallop > 1)
+                    --min_gallop;
+            }
+            count1 = count2 = 0;
+        }
+        while (start1 < start1_end)
         {
-            t = *b; *b = *e; *e = t;
+            *k++ = BAO_MOVE(*start1++);
         }
     }
     else
     {
-        while (run_end < end && !compare(*run_end, *(run_end - 1)))
-        {
-            ++run_end;
-        }
-
-        if (run_end - beg < timsort_min_run)
+        if (safecopy)
         {
-            insert_sort_part(beg, run_end, beg + timsort_min_run, compare);
-            run_end = beg + timsort_min_run;
-            while (run_end < end && !compare(*run_end, *(run_end - timsort_insert_gap)))
+            RandomAccessBufferIterator t = buf;
+            for (RandomAccessIterator s = mid; s != end; ++s, ++t)
             {
-                unguarded_insert_single(run_end, compare);
-                ++run_end;
+                *t = BAO_MOVE(*s);
             }
         }
-    }
-
-    return run_end;
-}
+        else
+            memcpy((char*)buf, (char*)&*mid, (char*)&*end - (char*)&*mid);
+        if (merge_2_part_kernel<simd_network_enabled<RandomAccessIterator, Comp, true>::value>::template run<true>(buf, beg, mid, end, compare))
+            return;
 
-template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
-void tim_sort_force_stack_merge(RandomAccessBufferIterator buf, RandomAccessIterator* beg, RandomAccessIterator* end, Comp compare)
-{
-    while (end - beg > 1)
-    {
-        if (end - beg > 2)
+        RandomAccessBufferIterator start1 = buf + (end - mid) - 1, start1_end = buf;
+        RandomAccessIterator start2 = mid - 1, k = end;
+        size_t min_gallop = merge_min_gallop, count1 = 0, count2 = 0;
+        while (start1 >= start1_end && start2 >= beg)
         {
-            if (end[0] - end[-1] <= end[-2] - end[-3])
+            if (compare(*start1, *start2))
             {
-                merge_2_part<safecopy>(buf, end[-2], end[-1], end[0], compare);
-                end[-1] = end[0];
-                --end;
+                *--k = BAO_MOVE(*start2--);
+                count1 = 0;
+                if (++count2 < min_gallop || start2 < beg)
+                    continue;
             }
             else
             {
-                merge_2_part<safecopy>(buf, end[-3], end[-2], end[-1], compare);
-                end[-2] = end[-1];
-                end[-1] = end[0];
-                --end;
+                *--k = BAO_MOVE(*start1--);
+                count2 = 0;
+                if (++count1 < min_gallop || start1 < start1_end)
+                    continue;
             }
+
+            while (true)
+            {
+                RandomAccessIterator next2 = gallop_upper_bound<true>(beg, start2 + 1, *start1, compare);
+                count2 = (start2 + 1) - next2;
+                while (start2 >= next2)
+                    *--k = BAO_MOVE(*start2--);
+                if (start2 < beg)
+                    break;
+                RandomAccessBufferIterator next1 = gallop_lower_bound<true>(start1_end, start1 + 1, *start2, compare);
+                count1 = (start1 + 1) - next1;
+                while (start1 >= next1)
+                    *--k = BAO_MOVE(*start1--);
+                if (start1 < start1_end)
+                    break;
+                if (count1 < merge_min_gallop && count2 < merge_min_gallop)
+                {
+                    ++min_gallop;
+                    break;
+                }
+                if (min_gallop > 1)
+                    --min_gallop;
+            }
+            count1 = count2 = 0;
         }
-        else
+        while (start1 >= start1_end)
         {
-            merge_2_part<safecopy>(buf, end[-2], end[-1], end[0], compare);
-            end[-1] = end[0];
-            --end;
+            *--k = BAO_MOVE(*start1--);
         }
     }
 }
 
+// stable sort
 template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
-void tim_sort_force_stack_merge_with_buffer(RandomAccessBufferIterator buf, size_t bufsize, RandomAccessIterator* beg, RandomAccessIterator* end, Comp compare)
+void merge_2_part(RandomAccessBufferIterator buf, RandomAccessIterator beg, RandomAccessIterator mid, RandomAccessIterator end, Comp compare)
 {
-    while (end - beg > 1)
+    if (!compare(*mid, *(mid - 1)))
     {
-        if (end - beg > 2)
+        return;
+    }
+    while (beg < mid && !compare(*mid, *beg))
+    {
+        ++beg;
+    }
+    if (beg < mid)
+    {
+        RandomAccessIterator mid_last = mid - 1, last = end - 1;
+        while (mid_last < last && !compare(*last, *mid_last))
         {
-            if (end[0] - end[-1] <= end[-2] - end[-3])
-            {
-                merge_2_part_with_buffer<safecopy>(buf, bufsize, end[-2], end[-1], end[0], compare);
-                end[-1] = end[0];
-                --end;
-            }
-            else
-            {
-                merge_2_part_with_buffer<safecopy>(buf, bufsize, end[-3], end[-2], end[-1], compare);
-                end[-2] = end[-1];
-                end[-1] = end[0];
-                --end;
-            }
+            --last;
         }
-        else
+        if (mid_last == last)
         {
-            merge_2_part_with_buffer<safecopy>(buf, bufsize, end[-2], end[-1], end[0], compare);
-            end[-1] = end[0];
-            --end;
+            return;
         }
+        end = last + 1;
     }
+    else
+    {
+        return;
+    }
+
+    if (end - beg < merge_2_part_insertion_sort_threshold)
+    {
+        insert_sort_part(beg, mid, end, compare);
+        return;
+    }
+
+    merge_2_part_force<safecopy>(buf, beg, mid, end, compare);
 }
 
-template <class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
-void tim_sort_stack_merge(RandomAccessBufferIterator buf, RandomAccessIterator* run_stack, RandomAccessIterator* &stack_top, RandomAccessIterator end, Comp compare)
+// stable sort, merges two sorted ranges into out, which must not overlap them
+template <class InputIterator1, class InputIterator2, class OutputIterator, class Comp>
+OutputIterator merge_2_part_to(InputIterator1 first1, InputIterator1 last1, InputIterator2 first2, InputIterator2 last2, OutputIterator out, Comp compare)
 {
-    for (bool merged = true; merged && end - stack_top[0] > stack_top[0] - stack_top[-1]; )
+    if (first1 < last1 && first2 < last2)
     {
-        merged = false;
-        if (stack_top - run_stack >= 2)
+        while (true)
         {
-            if (stack_top - run_stack > 2)
+            if (compare(*first2, *first1))
             {
-                if (stack_top[0] - stack_top[-2] >= stack_top[-2] - stack_top[-3]) // a + b >= c
-                {
-                    if (stack_top[0] - stack_top[-1] <= stack_top[-2] - stack_top[-3]) // a <= c
-                    {
-                        merge_2_part(buf, stack_top[-2], stack_top[-1], stack_top[0], compare);
-                        merge_2_part(buf, stack_top[-3], stack_top[-2], stack_top[0], compare);
-                        stack_top[-2] = stack_top[0];
-                        stack_top -= 2;
-                    }
-                    else
-                    {
-                        merge_2_part(buf, stack_top[-3], stack_top[-2], stack_top[-1], compare);
-                        stack_top[-2] = stack_top[-1];
-                        stack_top[-1] = stack_top[0];
-                        --stack_top;
-                    }
-                    merged = true;
-                    continue;
-                }
+                *out++ = BAO_MOVE(*first2++);
+                if (first2 >= last2)
+                    break;
             }
-            if (stack_top[0] - stack_top[-1] >= stack_top[-1] - stack_top[-2]) // a >= b
+            else
             {
-                merge_2_part(buf, stack_top[-2], stack_top[-1], stack_top[0], compare);
-                stack_top[-1] = stack_top[0];
-                --stack_top;
-                merged = true;
+                *out++ = BAO_MOVE(*first1++);
+                if (first1 >= last1)
+                    break;
             }
         }
     }
+    for (; first1 < last1; ++first1, ++out)
+    {
+        *out = BAO_MOVE(*first1);
+    }
+    for (; first2 < last2; ++first2, ++out)
+    {
+        *out = BAO_MOVE(*first2);
+    }
+    return out;
 }
 
-template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
-void tim_sort_stack_merge_13(RandomAccessBufferIterator buf, RandomAccessIterator* run_stack, RandomAccessIterator* &stack_top, RandomAccessIterator end, Comp compare)
+// merge path co-ranking, returns how many of the first k merged elements come from the first range
+template <class RandomAccessIterator1, class RandomAccessIterator2, class Comp>
+size_t merge_path_split(RandomAccessIterator1 first1, size_t len1, RandomAccessIterator2 first2, size_t len2, size_t k, Comp compare)
 {
-    while (stack_top - run_stack >= 2 && end - stack_top[0] > stack_top[0] - stack_top[-1])
+    size_t lo = k > len2 ? k - len2 : 0, hi = k < len1 ? k : len1;
+    while (lo < hi)
     {
-        if (stack_top - run_stack > 2 && (stack_top[0] - stack_top[-2]) * 4 / 3 >= stack_top[-1] - stack_top[-3]) // a >= c
-        {
-            merge_2_part<safecopy>(buf, stack_top[-3], stack_top[-2], stack_top[-1], compare);
-            stack_top[-2] = stack_top[-1];
-            stack_top[-1] = stack_top[0];
-            --stack_top;
-            while (stack_top - run_stack > 2 && (stack_top[-1] - stack_top[-2]) * 4 / 3 >= (stack_top[-2] - stack_top[-3]))
-            {
-                merge_2_part<safecopy>(buf, stack_top[-3], stack_top[-2], stack_top[-1], compare);
-                stack_top[-2] = stack_top[-1];
-                stack_top[-1] = stack_top[0];
-                --stack_top;
-            }
-        }
-        else if ((stack_top[0] - stack_top[-1]) * 4 / 3 >= (stack_top[-1] - stack_top[-2])) // 1.333 * a > b
-        {
-            merge_2_part<safecopy>(buf, stack_top[-2], stack_top[-1], stack_top[0], compare);
-            stack_top[-1] = stack_top[0];
-            --stack_top;
-        }
+        size_t i = lo + (hi - lo) / 2;
+        if (compare(*(first2 + (k - i - 1)), *(first1 + i)))
+            hi = i;
         else
-        {
-            break;
-        }
+            lo = i + 1;
     }
+    return lo;
 }
 
-template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
-void tim_sort_stack_merge_with_buffer_13(RandomAccessBufferIterator buf, size_t bufsize, RandomAccessIterator* run_stack, RandomAccessIterator* &stack_top, RandomAccessIterator end, Comp compare)
+template <class RandomAccessIterator>
+void swap_2_part_with_same_length(RandomAccessIterator beg, RandomAccessIterator mid)
 {
-    while (stack_top - run_stack >= 2 && end - stack_top[0] > stack_top[0] - stack_top[-1])
+    for (RandomAccessIterator l = beg, r = mid; l < mid; ++l, ++r)
     {
-        if (stack_top - run_stack > 2 && (stack_top[0] - stack_top[-2]) * 4 / 3 >= stack_top[-1] - stack_top[-3]) // a >= c
-        {
-            merge_2_part_with_buffer<safecopy>(buf, bufsize, stack_top[-3], stack_top[-2], stack_top[-1], compare);
-            stack_top[-2] = stack_top[-1];
-            stack_top[-1] = stack_top[0];
-            --stack_top;
-            while (stack_top - run_stack > 2 && (stack_top[-1] - stack_top[-2]) * 4 / 3 >= (stack_top[-2] - stack_top[-3]))
-            {
-                merge_2_part_with_buffer<safecopy>(buf, bufsize, stack_top[-3], stack_top[-2], stack_top[-1], compare);
-                stack_top[-2] = stack_top[-1];
-                stack_top[-1] = stack_top[0];
-                --stack_top;
-            }
-        }
-        else if ((stack_top[0] - stack_top[-1]) * 4 / 3 >= (stack_top[-1] - stack_top[-2])) // 1.333 * a > b
-        {
-            merge_2_part_with_buffer<safecopy>(buf, bufsize, stack_top[-2], stack_top[-1], stack_top[0], compare);
-            stack_top[-1] = stack_top[0];
-            --stack_top;
-        }
-        else
-        {
-            break;
-        }
+        std::swap(*l, *r);
     }
 }
 
-// stable sort
-template <bool safecopy, class RandomAccessIterator, class Comp>
-void tim_sort_buffer(RandomAccessIterator beg, RandomAccessIterator end, size_t bufsize, Comp compare)
+template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator>
+RandomAccessIterator swap_2_part_with_buffer(RandomAccessBufferIterator buf, size_t bufsize, RandomAccessIterator beg, RandomAccessIterator mid, RandomAccessIterator end)
 {
-    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
-    if (end - beg > 1)
-    {
-        RandomAccessIterator run_stack[78]; // ln(2^32)/ln(4/3) = 77.1
-        RandomAccessIterator* stack_top = run_stack + 1;
-        run_stack[0] = beg;
-        run_stack[1] = beg = tim_sort_create_run(beg, end, compare);
-
-        if (end > beg && (end - run_stack[0]) * sizeof(value_type) > merge_sort_stack_buffer_size)
+    RandomAccessIterator ret = beg + (end - mid);
+    while (true)
+    {
+        if (mid - beg <= end - mid)
         {
-            if (bufsize >= (size_t)(end - run_stack[0]) / 2)
+            if (mid - beg > 0)
             {
-                value_type* buf = safecopy ? new value_type[(end - run_stack[0]) / 2]
-                    : (value_type*)malloc((end - run_stack[0]) / 2 * sizeof(value_type));
-                while (beg < end)
+                if ((size_t)(mid - beg) > bufsize)
                 {
-                    RandomAccessIterator run = tim_sort_create_run(beg, end, compare);
-                    *++stack_top = run;
-                    beg = run;
-
-                    //tim_sort_stack_merge<T, RandomAccessIterator, Comp>(buf, run_stack, stack_top, end);
-                    tim_sort_stack_merge_13<safecopy>(buf, run_stack, stack_top, end, compare);
+                    swap_2_part_with_same_length(beg, mid);
+                    RandomAccessIterator m = mid;
+                    mid += mid - beg;
+                    beg = m;
                 }
-
-                tim_sort_force_stack_merge<safecopy>(buf, run_stack, stack_top, compare);
-                if (safecopy)
-                    delete[] buf;
                 else
-                    free(buf);
-            }
-            else
-            {
-                value_type* buf = safecopy ? new value_type[bufsize]
-                    : (value_type*)malloc(bufsize * sizeof(value_type));
-                while (beg < end)
                 {
-                    RandomAccessIterator run = tim_sort_create_run(beg, end, compare);
-                    *++stack_top = run;
-                    beg = run;
-
-                    //tim_sort_stack_merge<T, RandomAccessIterator, Comp>(buf, run_stack, stack_top, end);
-                    tim_sort_stack_merge_with_buffer_13<safecopy>(buf, bufsize, run_stack, stack_top, end, compare);
+                    if (safecopy)
+                    {
+                        RandomAccessBufferIterator t = buf;
+                        for (RandomAccessIterator s = beg; s != mid; ++s, ++t)
+                        {
+                            *t = BAO_MOVE(*s);
+                        }
+                        RandomAccessIterator m = beg;
+                        for (RandomAccessIterator s = mid; s < end; ++s, ++m)
+                        {
+                            *m = BAO_MOVE(*s);
+                        }
+                        for (RandomAccessBufferIterator it = buf; it < t; ++m, ++it)
+                        {
+                            *m = BAO_MOVE(*it);
+                        }
+                    }
+                    else
+                    {
+                        memcpy((char*)buf, (char*)&*beg, (char*)&*mid - (char*)&*beg);
+                        memmove((char*)&*beg, (char*)&*mid, (char*)&*end - (char*)&*mid);
+                        memcpy((char*)&*(beg + (end - mid)), (char*)buf, (char*)&*mid - (char*)&*beg);
+                    }
+                    return ret;
                 }
-
-                tim_sort_force_stack_merge_with_buffer<safecopy>(buf, bufsize, run_stack, stack_top, compare);
-                if (safecopy)
-                    delete[] buf;
-                else
-                    free(buf);
             }
+            else
+                return ret;
         }
-        else if (end > beg)
+        else
         {
-            typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
-            value_type buf[merge_sort_stack_buffer_size / sizeof(value_type)];
-            while (beg < end)
+            if (end - mid > 0)
             {
-                RandomAccessIterator run = tim_sort_create_run(beg, end, compare);
-                *++stack_top = run;
-                beg = run;
-
-                //tim_sort_stack_merge<T, RandomAccessIterator, Comp>(buf, run_stack, stack_top, end);
-                tim_sort_stack_merge_13<safecopy>(buf, run_stack, stack_top, end, compare);
+                if ((size_t)(end - mid) > bufsize)
+                {
+                    swap_2_part_with_same_length(mid - (end - mid), mid);
+                    RandomAccessIterator m = mid;
+                    mid -= end - mid;
+                    end = m;
+                }
+                else
+                {
+                    if (safecopy)
+                    {
+                        RandomAccessBufferIterator t = buf;
+                        for (RandomAccessIterator s = mid; s != end; ++s, ++t)
+                        {
+                            *t = BAO_MOVE(*s);
+                        }
+                        RandomAccessIterator m = end - 1;
+                        for (RandomAccessIterator s = mid - 1; s >= beg; --s, --m)
+                        {
+                            *m = BAO_MOVE(*s);
+                        }
+                        for (--t; t >= buf; --m, --t)
+                        {
+                            *m = BAO_MOVE(*t);
+                        }
+                    }
+                    else
+                    {
+                        memcpy((char*)buf, (char*)&*mid, (char*)&*end - (char*)&*mid);
+                        memmove((char*)&*(end - (mid - beg)), (char*)&*beg, (char*)&*mid - (char*)&*beg);
+                        memcpy((char*)&*beg, (char*)buf, (char*)&*end - (char*)&*mid);
+                    }
+                    return ret;
+                }
             }
-
-            tim_sort_force_stack_merge<safecopy>(buf, run_stack, stack_top, compare);
+            else
+                return ret;
         }
     }
 }
 
-template<class RandomAccessIterator>
-struct indirect_sort_iter_warp
-{
-    size_t index;
-    RandomAccessIterator it;
-    indirect_sort_iter_warp()
-    { }
-};
-
-template<class RandomAccessIterator, class Comp>
-struct indirect_sort_comp_warp
+template <class RandomAccessIterator, class Comp>
+std::pair<RandomAccessIterator, RandomAccessIterator> find_swap_bound(RandomAccessIterator beg, RandomAccessIterator mid, RandomAccessIterator end, Comp compare)
 {
-    Comp compare;
-    indirect_sort_comp_warp(Comp _compare)
-        : compare(_compare)
-    { }
-    indirect_sort_comp_warp(const indirect_sort_comp_warp& comp_warp)
-        : compare(comp_warp.compare)
-    { }
-    bool operator ()(const indirect_sort_iter_warp<RandomAccessIterator>& a, const indirect_sort_iter_warp<RandomAccessIterator>& b) const
+    if (end - beg < find_swap_bound_optimize_threshold)
     {
-        if (compare(*a.it, *b.it))
-        {
-            return true;
-        }
-        else if (compare(*b.it, *a.it))
-        {
-            return false;
-        }
-        else
-        {
-            return a.index < b.index;
-        }
-    }
-};
+        RandomAccessIterator pivot_r = mid + (end - mid) / 2 + 1;
+        RandomAccessIterator pivot_l = std::upper_bound(beg, mid, *pivot_r, compare);
 
-// stable sort, less swap method, works fine for fat class and small size of array
-template <class RandomAccessIterator, class Comp>
-void indirect_qsort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
-{
-    if (end - beg > 1)
+        pivot_r = std::lower_bound(pivot_r, end, *pivot_l, compare);
+
+        return std::make_pair(pivot_l, pivot_r);
+    }
+    else
     {
-        size_t size = (size_t)(end - beg);
-        indirect_sort_iter_warp<RandomAccessIterator>* ptr = new indirect_sort_iter_warp<RandomAccessIterator>[size], *ptr_beg = ptr, *ptr_end = ptr + size;
-        for (size_t i = 0; i < size; ++i)
+        typedef typename std::iterator_traits<RandomAccessIterator>::difference_type diff_type;
+
+        RandomAccessIterator pivot_l = beg;
+        RandomAccessIterator pivot_l_map = std::lower_bound(mid, end, *pivot_l, compare);
+
+        if (pivot_l_map - mid > (end - mid) / 2 || mid - pivot_l <= pivot_l_map - mid)
         {
-            ptr[i].it = beg + i;
-            ptr[i].index = i;
+            return std::make_pair(pivot_l, pivot_l_map);
         }
-        internal::quick_sort(ptr_beg, ptr_end, indirect_sort_comp_warp<RandomAccessIterator, Comp>(compare));
-        for (size_t i = 0; i < size; ++i)
+
+        RandomAccessIterator pivot_r = std::lower_bound(beg, mid, *(end - 1), compare);
+        RandomAccessIterator pivot_r_map = std::lower_bound(mid, end, *pivot_r, compare);
+
+        if (mid - pivot_r > (mid - beg) / 2 || mid - pivot_r >= pivot_r_map - mid)
         {
-            ptr[i].index = ptr[i].it - beg;
+            return std::make_pair(pivot_r, pivot_r_map);
         }
 
-        for (size_t index = 0; index < size; ++index)
+        do
         {
-            if (ptr[index].index)
+            RandomAccessIterator pivot_m = pivot_l + (pivot_r - pivot_l) / 2;
+            pivot_m = std::lower_bound(pivot_l, pivot_r, *pivot_m, compare);
+            if (pivot_m == pivot_l)
             {
-                size_t i = index;
-                typename std::iterator_traits<RandomAccessIterator>::value_type v = *ptr[i].it;
-                for (; ptr[i].index > index;)
+                pivot_m = std::upper_bound(pivot_l, pivot_r, *pivot_m, compare);
+                if (pivot_m == pivot_r)
                 {
-                    size_t j = ptr[i].index;
-                    *ptr[i].it = *ptr[j].it;
-                    ptr[i].index = 0;
-                    i = j;
+                    {
+                        diff_type pivot_m_diff = (mid - pivot_l) - (pivot_l_map - mid);
+                        if (pivot_l + pivot_m_diff <= pivot_r)
+                        {
+                            return std::make_pair(pivot_l + pivot_m_diff, pivot_l_map);
+                        }
+                    }
+                    {
+                        diff_type pivot_m_diff = (mid - pivot_r) - (pivot_r_map - mid);
+                        if (pivot_l_map - pivot_m_diff <= pivot_r_map)
+                        {
+                            return std::make_pair(pivot_r, pivot_r_map + pivot_m_diff);
+                        }
+                    }
+                    return std::make_pair(pivot_l, pivot_l_map);
                 }
-                *ptr[i].it = v;
-                ptr[i].index = 0;
             }
-        }
-        delete[] ptr;
+            RandomAccessIterator pivot_m_map = std::lower_bound(pivot_l_map, pivot_r_map, *pivot_m, compare);
+            diff_type pivot_m_diff = (mid - pivot_m) - (pivot_m_map - mid);
+            if (pivot_m_diff > 0)
+            {
+                pivot_l = pivot_m;
+                pivot_l_map = pivot_m_map;
+            }
+            else if (pivot_m_diff < 0)
+            {
+                pivot_r = pivot_m;
+                pivot_r_map = pivot_m_map;
+            }
+            else
+            {
+                return std::make_pair(pivot_m, pivot_m_map);
+            }
+        } while (true);
+
+        return std::make_pair(pivot_l, pivot_l_map);
     }
 }
 
-template <class RandomAccessIterator, class RadixIndexFunc, class Comp>
-void radix_sort_msd_in_place(RandomAccessIterator beg, RandomAccessIterator end, RadixIndexFunc get_index, uint32_t offset, Comp compare)
+// stable sort
+template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+void merge_2_part_with_buffer(RandomAccessBufferIterator buf, size_t bufsize, RandomAccessIterator beg, RandomAccessIterator mid, RandomAccessIterator end, Comp compare)
 {
-    if (end - beg < qsort_insertion_sort_threshold)
+    if (!compare(*mid, *(mid - 1)))
     {
-        internal::q_insert_sort(beg, end, compare);
         return;
     }
-    uint32_t counter[256] = { 0 }, not_empty_count = 0;
-    RandomAccessIterator _split_iter[257], *split_iter = &_split_iter[1];
-    for (RandomAccessIterator i = beg; i < end; ++i)
+    while (beg < mid && !compare(*mid, *beg))
     {
-        uint32_t index = (get_index(*i) >> offset) & 0xff;
-        counter[index]++;
+        ++beg;
     }
-    _split_iter[0] = beg;
-    for (size_t i = 0; i < 256; ++i)
+    if (beg < mid)
     {
-        not_empty_count += counter[i] > 0;
-        split_iter[i] = split_iter[i - 1] + counter[i];
+        RandomAccessIterator mid_last = mid - 1, last = end - 1;
+        while (mid_last < last && !compare(*last, *mid_last))
+        {
+            --last;
+        }
+        if (mid_last < last)
+        {
+            end = last + 1;
+        }
+        else
+        {
+            return;
+        }
     }
-    if (not_empty_count > 1)
+    else
     {
-        RandomAccessIterator sort_iter[256];
-        memcpy(sort_iter, _split_iter, sizeof(sort_iter));
-        for (size_t i = 0; i < 256; ++i)
-        {
-            if (split_iter[i] - split_iter[i - 1] > 0)
-            {
-                for (RandomAccessIterator start_i = sort_iter[i]; start_i < split_iter[i]; ++start_i)
-                {
-                    if (start_i < sort_iter[i]) start_i = sort_iter[i];
+        return;
+    }
 
-                    RandomAccessIterator cur = start_i;
-                    while (true)
-                    {
-                        uint32_t index = (get_index(*cur) >> offset) & 0xff;
-                        if (i == index)
-                        {
-                            sort_iter[index]++;
-                            break;
-                        }
+    if (end - beg < merge_2_part_insertion_sort_threshold || end - mid < 3 || mid - beg < 3)
+    {
+        insert_sort_part(beg, mid, end, compare);
+        return;
+    }
 
-                        std::swap(*cur, *sort_iter[index]);
-                        sort_iter[index]++;
-                    }
+    if ((size_t)(end - mid) <= bufsize || (size_t)(mid - beg) <= bufsize)
+    {
+        merge_2_part_force<safecopy>(buf, beg, mid, end, compare);
+        return;
+    }
+
+    std::pair<RandomAccessIterator, RandomAccessIterator> pair = find_swap_bound(beg, mid, end, compare);
+
+    RandomAccessIterator swap_mid = swap_2_part_with_buffer<safecopy>(buf, bufsize, pair.first, mid, pair.second);
+    if (beg < pair.first)
+        merge_2_part_with_buffer<safecopy>(buf, bufsize, beg, pair.first, swap_mid, compare);
+    if (pair.second < end)
+        merge_2_part_with_buffer<safecopy>(buf, bufsize, swap_mid, pair.second, end, compare);
+}
+
+// stable sort
+template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+void merge_sort_recursive(RandomAccessBufferIterator buf, RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    size_t len = end - beg;
+    if (len < merge_insertion_sort_threshold)
+    {
+        if (!small_sort_kernel<simd_network_enabled<RandomAccessIterator, Comp, true>::value>::run(beg, end, compare))
+            insert_sort(beg, end, compare);
+        return;
+    }
+    RandomAccessIterator mid = beg + (len >> 1);
+    merge_sort_recursive<safecopy>(buf, beg, mid, compare);
+    merge_sort_recursive<safecopy>(buf, mid, end, compare);
+    merge_2_part<safecopy>(buf, beg, mid, end, compare);
+}
+
+// stable sort
+template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+void merge_sort_recursive_with_buffer(RandomAccessBufferIterator buf, size_t bufsize, RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    size_t len = end - beg;
+    if (len < merge_insertion_sort_threshold)
+    {
+        if (!small_sort_kernel<simd_network_enabled<RandomAccessIterator, Comp, true>::value>::run(beg, end, compare))
+            insert_sort(beg, end, compare);
+        return;
+    }
+    RandomAccessIterator mid = beg + (len >> 1);
+    merge_sort_recursive_with_buffer<safecopy>(buf, bufsize, beg, mid, compare);
+    merge_sort_recursive_with_buffer<safecopy>(buf, bufsize, mid, end, compare);
+    merge_2_part_with_buffer<safecopy>(buf, bufsize, beg, mid, end, compare);
+}
+
+// stable sort
+template <bool safecopy, class RandomAccessIterator, class Comp>
+void merge_sort_with_buffer(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, bool buffered)
+{
+    if (end - beg > 1)
+    {
+        typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+        if (buffered)
+        {
+            if ((end - beg) / 2 * sizeof(value_type) <= merge_sort_stack_buffer_size)
+            {
+                value_type buf[merge_sort_stack_buffer_size / sizeof(value_type)];
+                merge_sort_recursive<safecopy>(buf, beg, end, compare);
+            }
+            else if (merge_sort_alloc_buffer)
+            {
+                size_t bufsize = (size_t)sqrt(end - beg + 0.1);
+                value_type * buf = safecopy ? safe_buffer_alloc<value_type>(beg, bufsize)
+                    : (value_type*)scratch_alloc(bufsize * sizeof(value_type));
+                merge_sort_recursive_with_buffer<safecopy>(buf, bufsize, beg, end, compare);
+                if (safecopy)
+                    safe_buffer_free(buf, bufsize);
+                else
+                    scratch_free(buf, bufsize * sizeof(value_type));
+            }
+            else
+            {
+                // not really in-place, uses a fixed size of buffer in stack
+                value_type buf[merge_sort_stack_buffer_size / sizeof(value_type)];
+                merge_sort_recursive_with_buffer<safecopy>(buf, sizeof(buf) / sizeof(value_type), beg, end, compare);
+            }
+        }
+        else
+        {
+            merge_sort_recursive_with_buffer<false>((value_type*)NULL, 0, beg, end, compare);
+        }
+    }
+}
+
+template <bool> struct buffer_type_mismatch;
+template <> struct buffer_type_mismatch<true> {};
+
+// the caller's buffer is counted and used in elements of the range, a buffer of another type
+// would be overrun, so it does not compile
+template <class RandomAccessIterator, class T>
+inline void check_buffer_type()
+{
+    (void)sizeof(buffer_type_mismatch<util::is_same<T, typename std::iterator_traits<RandomAccessIterator>::value_type>::value>);
+}
+
+// the caller's allocator when it already hands out T, or else a copy of it rebound to T like a container
+// makes, so an allocator of bytes still gives whole aligned elements
+template <class Alloc, class T, bool same = util::is_same<typename Alloc::value_type, T>::value>
+struct allocator_for
+{
+    typedef Alloc& type;
+};
+
+template <class Alloc, class T>
+struct allocator_for<Alloc, T, false>
+{
+#if __cplusplus >= 201103L || _MSC_VER >= 1800
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<T> type;
+#else
+    typedef typename Alloc::template rebind<T>::other type;
+#endif
+};
+
+// scratch of size elements of T from the caller's allocator or arena, copy constructed from src
+// when safecopy like safe_buffer_alloc, given back when it goes out of scope
+template <bool safecopy, class Alloc, class T>
+struct allocator_buffer
+{
+    typedef T value_type;
+    typename allocator_for<Alloc, T>::type alloc;
+    value_type* buf;
+    size_t size;
+
+    template <class RandomAccessIterator>
+    allocator_buffer(Alloc& a, RandomAccessIterator src, size_t n)
+        : alloc(a), buf(n > 0 ? alloc.allocate(n) : NULL), size(n)
+    {
+        if (safecopy && size > 0)
+        {
+            try
+            {
+                safe_buffer_construct<util::is_nothrow_movable_class<T>::value>::run(buf, src, size);
+            }
+            catch (...)
+            {
+                alloc.deallocate(buf, size);
+                throw;
+            }
+        }
+    }
+
+    ~allocator_buffer()
+    {
+        if (size > 0)
+        {
+            if (safecopy)
+            {
+                for (size_t i = 0; i < size; ++i)
+                    buf[i].~value_type();
+            }
+            alloc.deallocate(buf, size);
+        }
+    }
+
+private:
+    allocator_buffer(const allocator_buffer&);
+    allocator_buffer& operator=(const allocator_buffer&);
+};
+
+// stable sort on the caller's buffer of bufsize elements, never allocates,
+// merges in place where half of a part does not fit
+template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+void merge_sort_with_buffer(RandomAccessBufferIterator buf, size_t bufsize, RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    if (end - beg > 1)
+    {
+        if (bufsize >= (size_t)(end - beg) / 2)
+            merge_sort_recursive<safecopy>(buf, beg, end, compare);
+        else
+            merge_sort_recursive_with_buffer<safecopy>(buf, bufsize, beg, end, compare);
+    }
+}
+
+// stable sort, merges [beg, mid) and [mid, end) into out from both ends at once, the two ends
+// are independent chains, the right part may be one longer, so neither end runs past its part
+template <class RandomAccessIterator1, class RandomAccessIterator2, class Comp>
+void merge_2_part_bidirectional(RandomAccessIterator1 beg, RandomAccessIterator1 mid, RandomAccessIterator1 end, RandomAccessIterator2 out, Comp compare)
+{
+    RandomAccessIterator1 l = beg, r = mid, l_end = mid, r_end = end;
+    RandomAccessIterator2 out_end = out + (end - beg);
+    for (size_t n = mid - beg; n > 0; --n)
+    {
+        *out++ = compare(*r, *l) ? *r++ : *l++;
+        *--out_end = compare(*(r_end - 1), *(l_end - 1)) ? *--l_end : *--r_end;
+    }
+    if (l < l_end)
+        *out = *l;
+    else if (r < r_end)
+        *out = *r;
+}
+
+// stable sort, moves [beg, mid) and [mid, end) merged to out
+template <class RandomAccessIterator1, class RandomAccessIterator2, class Comp>
+void merge_2_part_ping_pong(RandomAccessIterator1 beg, RandomAccessIterator1 mid, RandomAccessIterator1 end, RandomAccessIterator2 out, Comp compare)
+{
+    if (!compare(*mid, *(mid - 1)))
+    {
+        std::copy(beg, end, out);
+    }
+    else if (compare(*(end - 1), *beg))
+    {
+        std::copy(beg, mid, std::copy(mid, end, out));
+    }
+    else
+    {
+        merge_2_part_bidirectional(beg, mid, end, out, compare);
+    }
+}
+
+// stable sort, the result is in buf if to_buf, or else in [beg, end), the other side is the scratch,
+// each level moves the data once between them
+template <class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+void merge_sort_ping_pong(RandomAccessIterator beg, RandomAccessIterator end, RandomAccessBufferIterator buf, bool to_buf, Comp compare)
+{
+    size_t len = end - beg;
+    if (len < merge_insertion_sort_threshold)
+    {
+        if (!small_sort_kernel<simd_network_enabled<RandomAccessIterator, Comp, true>::value>::run(beg, end, compare))
+            insert_sort(beg, end, compare);
+        if (to_buf)
+            std::copy(beg, end, buf);
+        return;
+    }
+    size_t half = len >> 1;
+    merge_sort_ping_pong(beg, beg + half, buf, !to_buf, compare);
+    merge_sort_ping_pong(beg + half, end, buf + half, !to_buf, compare);
+    if (to_buf)
+        merge_2_part_ping_pong(beg, beg + half, end, buf, compare);
+    else
+        merge_2_part_ping_pong(buf, buf + half, buf + len, beg, compare);
+}
+
+// stable sort, presorted input would still be copied between the range and the buffer
+// at every level of the ping-pong recursion, so it is found first and left as it is
+template <bool safecopy, class RandomAccessIterator, class Comp>
+void merge_sort_ping_pong_sorted(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    RandomAccessIterator i = beg + 1;
+    while (i < end && !compare(*i, *(i - 1)))
+        ++i;
+    if (i == end)
+        return;
+    size_t len = end - beg;
+    value_type* buf = safecopy ? safe_buffer_alloc<value_type>(beg, len) : (value_type*)malloc(len * sizeof(value_type));
+    merge_sort_ping_pong(beg, end, buf, false, compare);
+    if (safecopy)
+        safe_buffer_free(buf, len);
+    else
+        free(buf);
+}
+
+// what a loser tree node keeps of the head of its run, so a replay reads the key from the node
+// instead of through the iterator: a copy of a scalar, a pointer to any other element, which stays
+// valid until its run moves on, or a copy if the iterator returns a proxy
+template <class InputIterator, class T = typename std::iterator_traits<InputIterator>::value_type,
+    bool by_pointer = !util::is_scalar<T>::value
+        && (util::is_same<typename std::iterator_traits<InputIterator>::reference, T&>::value
+        || util::is_same<typename std::iterator_traits<InputIterator>::reference, const T&>::value)>
+struct loser_tree_key
+{
+    typedef T type;
+
+    static type get(const InputIterator& it)
+    {
+        return *it;
+    }
+
+    static const T& value(const type& key)
+    {
+        return key;
+    }
+};
+
+template <class InputIterator, class T>
+struct loser_tree_key<InputIterator, T, true>
+{
+    typedef const T* type;
+
+    static type get(const InputIterator& it)
+    {
+        return &*it;
+    }
+
+    static const T& value(type key)
+    {
+        return *key;
+    }
+};
+
+template <class Key>
+struct loser_tree_node
+{
+    size_t run;
+    Key head;
+};
+
+// stable sort, merges the sorted runs [cur[i], last[i]) for i < runs into out. a loser tree holds the run heads,
+// so each element costs log2(runs) compares, the tree is built again over the rest of the runs whenever one runs out
+template <class InputIterator, class OutputIterator, class Comp>
+OutputIterator merge_loser_tree(InputIterator* cur, InputIterator* last, size_t runs, OutputIterator out, Comp compare)
+{
+    typedef typename std::iterator_traits<InputIterator>::value_type value_type;
+    typedef loser_tree_key<InputIterator> key;
+    typedef loser_tree_node<typename key::type> node;
+
+    size_t live = 0;
+    for (size_t i = 0; i < runs; ++i)
+    {
+        if (!(cur[i] == last[i]))
+        {
+            cur[live] = cur[i];
+            last[live++] = last[i];
+        }
+    }
+    runs = live;
+    std::vector<node> tree(runs), win(runs * 2);
+    while (runs > 1)
+    {
+        // the leaves are runs + i, every inner node keeps the loser of its match, the earlier run wins on equal keys
+        for (size_t i = 0; i < runs; ++i)
+        {
+            win[runs + i].run = i;
+            win[runs + i].head = key::get(cur[i]);
+        }
+        for (size_t i = runs - 1; i > 0; --i)
+        {
+            const node& a = win[i * 2];
+            const node& b = win[i * 2 + 1];
+            bool b_wins = b.run < a.run ? !compare(key::value(a.head), key::value(b.head)) : compare(key::value(b.head), key::value(a.head));
+            win[i] = b_wins ? b : a;
+            tree[i] = b_wins ? a : b;
+        }
+        size_t winner = win[1].run;
+        typename key::type head = win[1].head;
+        while (true)
+        {
+            *out = key::value(head);
+            ++out;
+            if (++cur[winner] == last[winner])
+                break;
+            head = key::get(cur[winner]);
+            for (size_t i = (winner + runs) >> 1; i > 0; i >>= 1)
+            {
+                node& other = tree[i];
+                bool other_wins;
+                if (util::is_scalar<value_type>::value)
+                {
+                    // both compares and no branch, the winner of a scalar key is a coin toss for the predictor
+                    other_wins = compare(key::value(other.head), key::value(head))
+                        | (!compare(key::value(head), key::value(other.head)) & (other.run < winner));
                 }
-                if (split_iter[i] - split_iter[i - 1] > 1)
+                else
                 {
-                    if (offset >= 8)
-                    {
-                        radix_sort_msd_in_place(split_iter[i - 1], split_iter[i], get_index, offset - 8, compare);
-                    }
-                    else
-                    {
-                        internal::quick_sort(split_iter[i - 1], split_iter[i], compare);
-                    }
+                    other_wins = other.run < winner ? !compare(key::value(head), key::value(other.head))
+                        : compare(key::value(other.head), key::value(head));
+                }
+                if (other_wins)
+                {
+                    std::swap(other.run, winner);
+                    std::swap(other.head, head);
                 }
             }
         }
+        for (--runs; winner < runs; ++winner)
+        {
+            cur[winner] = cur[winner + 1];
+            last[winner] = last[winner + 1];
+        }
     }
-    else
+    if (runs == 1)
+        out = std::copy(cur[0], last[0], out);
+    return out;
+}
+
+// orders run indices by the element at pos[i] of run i
+template <class RandomAccessIterator, class Comp>
+struct multi_sequence_less
+{
+    const RandomAccessIterator* first;
+    const size_t* pos;
+    Comp compare;
+
+    multi_sequence_less(const RandomAccessIterator* _first, const size_t* _pos, Comp _compare)
+        : first(_first), pos(_pos), compare(_compare)
     {
-        if (offset >= 8)
+    }
+
+    bool operator()(size_t a, size_t b) const
+    {
+        return compare(*(first[a] + pos[a]), *(first[b] + pos[b]));
+    }
+};
+
+// multi-sequence selection, finds split[i] for the sorted runs [first[i], first[i] + len[i]) for i < k,
+// so that the elements before the splits are the first rank elements of their stable merge
+template <class RandomAccessIterator, class Comp>
+void multi_sequence_split(const RandomAccessIterator* first, const size_t* len, size_t k, size_t rank, size_t* split, Comp compare)
+{
+    // split[i] stays in [lo[i], hi[i]], everything before lo is less than the rest of the windows,
+    // and everything from hi on is greater, so the bounds are searched in the windows only
+    std::vector<size_t> lo(k, 0), hi(len, len + k), mid(k), lower(k), upper(k), order;
+    while (true)
+    {
+        // the pivot is the weighted median of the middles of the windows, so a round drops at least a quarter of them
+        size_t total = 0;
+        order.clear();
+        for (size_t i = 0; i < k; ++i)
         {
-            radix_sort_msd_in_place(beg, end, get_index, offset - 8, compare);
+            if (lo[i] < hi[i])
+            {
+                mid[i] = lo[i] + (hi[i] - lo[i]) / 2;
+                order.push_back(i);
+                total += hi[i] - lo[i];
+            }
+        }
+        if (order.empty())
+        {
+            std::copy(lo.begin(), lo.end(), split);
+            return;
+        }
+        std::sort(order.begin(), order.end(), multi_sequence_less<RandomAccessIterator, Comp>(first, &mid[0], compare));
+        size_t p = 0, weight = hi[order[0]] - lo[order[0]];
+        while (weight * 2 < total)
+        {
+            ++p;
+            weight += hi[order[p]] - lo[order[p]];
+        }
+        RandomAccessIterator pivot = first[order[p]] + mid[order[p]];
+
+        size_t less = 0, less_equal = 0;
+        for (size_t i = 0; i < k; ++i)
+        {
+            lower[i] = std::lower_bound(first[i] + lo[i], first[i] + hi[i], *pivot, compare) - first[i];
+            upper[i] = std::upper_bound(first[i] + lower[i], first[i] + hi[i], *pivot, compare) - first[i];
+            less += lower[i];
+            less_equal += upper[i];
+        }
+        if (rank < less)
+        {
+            hi.swap(lower);
+        }
+        else if (rank > less_equal)
+        {
+            lo.swap(upper);
         }
         else
         {
-            internal::quick_sort(beg, end, compare);
+            // the keys equal to the pivot go to the earlier runs first
+            size_t rest = rank - less;
+            for (size_t i = 0; i < k; ++i)
+            {
+                size_t take = std::min(upper[i] - lower[i], rest);
+                split[i] = lower[i] + take;
+                rest -= take;
+            }
+            return;
         }
     }
 }
 
-template <class RadixIndexValue>
-uint32_t radix_get_max_offset(RadixIndexValue index)
+#ifdef BAO_SORT_LIB_PARALLEL
+// stable sort, cuts the merge into parts by merge path, the parts are spawned to group
+template <class RandomAccessIterator1, class RandomAccessIterator2, class RandomAccessIterator3, class Comp>
+void parallel_merge_2_part_to(util::task_pool& pool, util::task_group& group, RandomAccessIterator1 first1, size_t len1, RandomAccessIterator2 first2, size_t len2, RandomAccessIterator3 out, size_t parts, Comp compare)
 {
-    uint32_t offset = 0;
-    for (; index >= 256; index >>= 8)
+    size_t len = len1 + len2;
+    for (size_t t = 0; t < parts; ++t)
     {
-        offset += 8;
+        pool.spawn(group, [=]()
+        {
+            size_t k0 = len * t / parts, k1 = len * (t + 1) / parts;
+            size_t i0 = merge_path_split(first1, len1, first2, len2, k0, compare);
+            size_t i1 = merge_path_split(first1, len1, first2, len2, k1, compare);
+            merge_2_part_to(first1 + i0, first1 + i1, first2 + (k0 - i0), first2 + (k1 - i1), out + k0, compare);
+        });
+    }
+}
+
+// stable, merges the sorted runs [first[i], first[i] + len[i]) for i < k to out, the output is cut into a part
+// per thread by multi_sequence_split, and every part is merged by its own loser tree
+template <class RandomAccessIterator1, class RandomAccessIterator2, class Comp>
+void parallel_merge_ranges(const RandomAccessIterator1* first, const size_t* len, size_t k, RandomAccessIterator2 out, Comp compare, unsigned threads)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < k; ++i)
+        total += len[i];
+
+    util::task_pool pool(threads);
+    util::task_group group;
+    size_t parts = pool.size();
+    for (size_t t = 0; t < parts; ++t)
+    {
+        pool.spawn(group, [=]()
+        {
+            size_t rank_beg = total * t / parts, rank_end = total * (t + 1) / parts;
+            std::vector<size_t> split_beg(k), split_end(k);
+            std::vector<RandomAccessIterator1> cur(k), last(k);
+            multi_sequence_split(first, len, k, rank_beg, &split_beg[0], compare);
+            multi_sequence_split(first, len, k, rank_end, &split_end[0], compare);
+            for (size_t i = 0; i < k; ++i)
+            {
+                cur[i] = first[i] + split_beg[i];
+                last[i] = first[i] + split_end[i];
+            }
+            merge_loser_tree(&cur[0], &last[0], k, out + rank_beg, compare);
+        });
+    }
+    pool.wait(group);
+}
+
+template <bool safecopy, class RandomAccessIterator1, class RandomAccessIterator2>
+void parallel_copy(util::task_pool& pool, util::task_group& group, RandomAccessIterator1 src, size_t len, RandomAccessIterator2 dst)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator1>::value_type value_type;
+    size_t part = (len + pool.size() - 1) / pool.size();
+    for (size_t s = 0; s < len; s += part)
+    {
+        size_t e = std::min(s + part, len);
+        pool.spawn(group, [=]()
+        {
+            if (safecopy)
+                std::copy(src + s, src + e, dst + s);
+            else
+                memcpy((char*)&*(dst + s), (char*)&*(src + s), (e - s) * sizeof(value_type));
+        });
+    }
+}
+
+// merges neighbouring runs of width from src to dst
+template <class RandomAccessIterator1, class RandomAccessIterator2, class Comp>
+void parallel_merge_level(util::task_pool& pool, RandomAccessIterator1 src, RandomAccessIterator2 dst, size_t len, size_t width, Comp compare)
+{
+    util::task_group group;
+    size_t pairs = (len + width * 2 - 1) / (width * 2);
+    size_t parts = pool.size() > pairs ? (pool.size() + pairs - 1) / pairs : 1;
+    for (size_t s = 0; s < len; s += width * 2)
+    {
+        size_t m = std::min(s + width, len), e = std::min(s + width * 2, len);
+        parallel_merge_2_part_to(pool, group, src + s, m - s, src + m, e - m, dst + s, parts, compare);
+    }
+    pool.wait(group);
+}
+
+template <bool safecopy, class RandomAccessIterator, class Comp>
+void parallel_merge_sort_buffer(typename std::iterator_traits<RandomAccessIterator>::value_type* buf, RandomAccessIterator beg, RandomAccessIterator end, Comp compare, unsigned threads)
+{
+    size_t len = end - beg, chunks = 1;
+    while (chunks < threads)
+        chunks <<= 1;
+    while (chunks > 1 && len / chunks < parallel_merge_task_threshold)
+        chunks >>= 1;
+    size_t width = (len + chunks - 1) / chunks;
+
+    util::task_pool pool(threads);
+    {
+        util::task_group group;
+        for (size_t s = 0; s < len; s += width)
+        {
+            size_t e = std::min(s + width, len);
+            pool.spawn(group, [=]()
+            {
+                merge_sort_recursive<safecopy>(buf + s, beg + s, beg + e, compare);
+            });
+        }
+        pool.wait(group);
+    }
+
+    bool in_buf = false;
+    for (; width < len; width *= 2, in_buf = !in_buf)
+    {
+        if (in_buf)
+            parallel_merge_level(pool, buf, beg, len, width, compare);
+        else
+            parallel_merge_level(pool, beg, buf, len, width, compare);
+    }
+
+    if (in_buf)
+    {
+        util::task_group group;
+        parallel_copy<safecopy>(pool, group, buf, len, beg);
+        pool.wait(group);
+    }
+}
+#endif
+
+// stable sort
+template <bool safecopy, class RandomAccessIterator, class Comp>
+void parallel_merge_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, unsigned threads)
+{
+    if (end - beg > 1)
+    {
+        typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+        size_t len = (size_t)(end - beg);
+#ifdef BAO_SORT_LIB_PARALLEL
+        if (len > parallel_merge_task_threshold && (threads = util::task_pool::thread_count(threads)) > 1)
+        {
+            value_type* buf = safecopy ? safe_buffer_alloc<value_type>(beg, len)
+                : (value_type*)malloc(len * sizeof(value_type));
+            parallel_merge_sort_buffer<safecopy>(buf, beg, end, compare, threads);
+            if (safecopy)
+                safe_buffer_free(buf, len);
+            else
+                free(buf);
+            return;
+        }
+#else
+        (void)threads;
+#endif
+        value_type* buf = safecopy ? safe_buffer_alloc<value_type>(beg, len / 2)
+            : (value_type*)malloc(len / 2 * sizeof(value_type));
+        merge_sort_recursive<safecopy>(buf, beg, end, compare);
+        if (safecopy)
+            safe_buffer_free(buf, len / 2);
+        else
+            free(buf);
+    }
+}
+
+// samples 9 points of [l, r], the partition kernels leave descending input to the scalar swaps,
+// which leave two sorted halves that quick_sort_loop finishes in O(n)
+template <class RandomAccessIterator, class Comp>
+bool quick_sort_descending(RandomAccessIterator l, RandomAccessIterator r, Comp compare)
+{
+    typename std::iterator_traits<RandomAccessIterator>::difference_type step = (r - l) / 8;
+    for (RandomAccessIterator it = l; it + step <= r; it += step)
+    {
+        if (!compare(*(it + step), *it))
+            return false;
+    }
+    return true;
+}
+
+// block partitioning in the BlockQuicksort way (Edelkamp, Weiss), [first, last) is partitioned around pivot
+// the compare results only move the buffer counters, the elements are swapped afterwards in batches,
+// so no branch depends on the compare results
+template <class RandomAccessIterator, class T, class Comp>
+RandomAccessIterator quick_sort_block_partition(RandomAccessIterator first, RandomAccessIterator last, const T& pivot, Comp compare)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::difference_type diff_type;
+    unsigned char offsets_l[qsort_block_size], offsets_r[qsort_block_size];
+    diff_type num_l = 0, num_r = 0, start_l = 0, start_r = 0;
+    diff_type size_l = qsort_block_size, size_r = qsort_block_size;
+    while (1)
+    {
+        diff_type unknown = last - first;
+        if (unknown <= 2 * qsort_block_size)
+        {
+            // the last round, the unknown part is split between the buffers which are empty
+            unknown -= (num_l || num_r) ? qsort_block_size : 0;
+            if (num_r)
+            {
+                size_l = unknown;
+            }
+            else if (num_l)
+            {
+                size_r = unknown;
+            }
+            else
+            {
+                size_l = unknown / 2;
+                size_r = unknown - size_l;
+            }
+        }
+        if (num_l == 0)
+        {
+            RandomAccessIterator it = first;
+            start_l = 0;
+            for (unsigned char i = 0; i < size_l; ++i, ++it)
+            {
+                offsets_l[num_l] = i;
+                num_l += !compare(*it, pivot);
+            }
+        }
+        if (num_r == 0)
+        {
+            RandomAccessIterator it = last;
+            start_r = 0;
+            for (unsigned char i = 0; i < size_r;)
+            {
+                offsets_r[num_r] = ++i;
+                num_r += compare(*--it, pivot);
+            }
+        }
+
+        diff_type num = std::min(num_l, num_r);
+        if (num > 0)
+        {
+            const unsigned char* ol = offsets_l + start_l;
+            const unsigned char* or_ = offsets_r + start_r;
+            if (num_l == num_r)
+            {
+                for (diff_type i = 0; i < num; ++i)
+                {
+                    std::swap(*(first + ol[i]), *(last - or_[i]));
+                }
+            }
+            else
+            {
+                // a cycle moves each element once instead of the three moves of a swap
+                RandomAccessIterator l = first + ol[0], r = last - or_[0];
+                T tmp(BAO_MOVE(*l));
+                *l = BAO_MOVE(*r);
+                for (diff_type i = 1; i < num; ++i)
+                {
+                    l = first + ol[i];
+                    *r = BAO_MOVE(*l);
+                    r = last - or_[i];
+                    *l = BAO_MOVE(*r);
+                }
+                *r = BAO_MOVE(tmp);
+            }
+        }
+        num_l -= num;
+        num_r -= num;
+        start_l += num;
+        start_r += num;
+        if (num_l == 0)
+        {
+            first += size_l;
+        }
+        if (num_r == 0)
+        {
+            last -= size_r;
+        }
+        if (size_l < qsort_block_size || size_r < qsort_block_size)
+        {
+            break;
+        }
+    }
+
+    // the elements left in one buffer are the last misplaced ones, move them to the boundary
+    if (num_l)
+    {
+        while (num_l--)
+        {
+            std::swap(*(first + offsets_l[start_l + num_l]), *--last);
+        }
+        return last;
+    }
+    while (num_r--)
+    {
+        std::swap(*(last - offsets_r[start_r + num_r]), *first++);
+    }
+    return first;
+}
+
+// partitions [l, r] around pivot, where *l is not before pivot and *r is
+template <bool simd, bool branchless>
+struct quick_sort_partition_kernel
+{
+    template <class RandomAccessIterator, class T, class Comp>
+    static RandomAccessIterator run(RandomAccessIterator l, RandomAccessIterator r, const T& pivot, Comp compare)
+    {
+        std::swap(*l++, *r--);
+        while (1)
+        {
+            while (compare(*l, pivot))
+                ++l;
+            while (!compare(*r, pivot))
+                --r;
+            if (l >= r)
+                break;
+            std::swap(*l++, *r--);
+        }
+        return l;
+    }
+};
+
+template <>
+struct quick_sort_partition_kernel<false, true>
+{
+    template <class RandomAccessIterator, class T, class Comp>
+    static RandomAccessIterator run(RandomAccessIterator l, RandomAccessIterator r, const T& pivot, Comp compare)
+    {
+        if (r - l < 2 * qsort_block_size || quick_sort_descending(l, r, compare))
+            return quick_sort_partition_kernel<false, false>::run(l, r, pivot, compare);
+        return quick_sort_block_partition(l, r + 1, pivot, compare);
+    }
+};
+
+#ifdef BAO_SORT_LIB_SIMD
+template <bool branchless>
+struct quick_sort_partition_kernel<true, branchless>
+{
+    template <class RandomAccessIterator, class T, class Comp>
+    static RandomAccessIterator run(RandomAccessIterator l, RandomAccessIterator r, const T& pivot, Comp compare)
+    {
+        if (r - l < 64 || quick_sort_descending(l, r, compare))
+            return quick_sort_partition_kernel<false, false>::run(l, r, pivot, compare);
+        T* first = &*l;
+        T* mid = simd_partition<T, simd_key_kind<T>::value, simd_compare<Comp, T>::value == 2>(first, first + (r - l) + 1, pivot);
+        return l + (mid - first);
+    }
+};
+#endif
+
+// partitions [beg, end) around the pivot at end - 1 and moves it to the returned boundary
+template <bool branchless, class RandomAccessIterator, class Comp>
+RandomAccessIterator quick_sort_partition_pivot(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, bool& swaped)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    RandomAccessIterator l = beg, r = end - 1;
+    const value_type& pivot = *r; // stays at end - 1 until the last swap
+
+    while (compare(*l, pivot))
+        ++l;
+    while (l < r && !compare(*r, pivot))
+        --r;
+    if (l < r)
+    {
+        swaped = true;
+        l = quick_sort_partition_kernel<simd_partition_enabled<RandomAccessIterator, Comp>::value, branchless>::run(l, r, pivot, compare);
+    }
+    std::swap(*l, *(end - 1));
+    return l;
+}
+
+template <bool branchless, class RandomAccessIterator, class Comp>
+RandomAccessIterator quick_sort_partition(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, bool& swaped)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::difference_type diff_type;
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    RandomAccessIterator r = end - 1;
+    uint32_t rnd = util::fake_rand_simple();
+    diff_type n = end - beg, h = (n - 1) / 2;
+    if (util::is_scalar<value_type>::value)
+    {
+        diff_type w = h;
+        util::make_mid_pivot(*(beg + rnd % w), *r, *(beg + h + rnd % w), compare);
+    }
+    else
+    {
+        if (n < 1 << 14)
+        {
+            diff_type w = h;
+            util::make_mid_pivot(*(beg + rnd % w), *r, *(beg + h + rnd % w), compare);
+        }
+        else
+        {
+            diff_type w = h - 3;
+            util::make_mid_pivot(*(beg), *(r), *(beg + h + 1), compare);
+            util::make_mid_pivot(*(beg + 1), *(beg + h - 1), *(r - 1), compare);
+            util::make_mid_pivot(*(beg + 2 + rnd % w), *(beg + h), *(r - 2 - rnd % w), compare);
+            util::make_mid_pivot(*(beg + h - 1), *(r), *(beg + h), compare);
+        }
+    }
+
+    return quick_sort_partition_pivot<branchless>(beg, end, compare, swaped);
+}
+
+template <bool branchless, class RandomAccessIterator, class Comp>
+void quick_sort_loop(RandomAccessIterator beg, RandomAccessIterator end, int deep, Comp compare, bool leftmost)
+{
+    if (end - beg <= qsort_insertion_sort_threshold)
+    {
+        if (small_sort_kernel<simd_network_enabled<RandomAccessIterator, Comp, false>::value>::run(beg, end, compare))
+        {
+            return;
+        }
+        if (leftmost)
+        {
+            q_insert_sort(beg, end, compare);
+        }
+        else
+        {
+            unguarded_q_insert_sort(beg, end, compare);
+        }
+        return;
+    }
+    if (deep <= 0)
+    {
+        shell_sort(beg, end, compare);
+        return;
+    }
+
+    bool swaped = false;
+    RandomAccessIterator l = quick_sort_partition<branchless>(beg, end, compare, swaped), r = l + 1;
+    if (!swaped && (l == beg || !compare(*(l - 1), *beg)))
+    {
+        RandomAccessIterator i = leftmost ? insert_sort_limit(beg, l, compare, 1)
+            : unguarded_insert_sort_limit(beg, l, compare, 1);
+        if (i == l)
+        {
+            i = unguarded_insert_sort_limit(r, end, compare, 1);
+        }
+        if (i == end)
+        {
+            return;
+        }
+        if (i >= l)
+        {
+            while (r < end && util::object_equal(*r, *l, compare)) ++r;
+            return quick_sort_loop<branchless>(r, end, deep - 1, compare, false);
+        }
+    }
+    while (r < end && util::object_equal(*r, *l, compare)) ++r;
+
+    quick_sort_loop<branchless>(beg, l, deep - 1, compare, leftmost);
+    quick_sort_loop<branchless>(r, end, deep - 1, compare, false);
+}
+
+template <bool branchless, class RandomAccessIterator, class Comp>
+void quick_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    if (end - beg > 1)
+    {
+        double deep = log((double)(end - beg)) / log(1.5);
+        quick_sort_loop<branchless>(beg, end, (int)deep, compare, true);
+    }
+}
+
+// pattern-defeating quicksort (Orson Peters), the pivots come from fixed positions,
+// unbalanced partitions swap a few elements to break the pattern and fall back to heap_sort after log(n) of them
+template <class RandomAccessIterator, class Comp>
+void pdq_sort_pivot(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::difference_type diff_type;
+    RandomAccessIterator r = end - 1;
+    diff_type h = (end - beg) / 2;
+    if (end - beg > pdqsort_ninther_threshold)
+    {
+        util::make_mid_pivot(*(beg), *(beg + h), *(r), compare);
+        util::make_mid_pivot(*(beg + 1), *(beg + h - 1), *(r - 1), compare);
+        util::make_mid_pivot(*(beg + 2), *(beg + h + 1), *(r - 2), compare);
+        util::make_mid_pivot(*(beg + h - 1), *(beg + h), *(beg + h + 1), compare);
+        std::swap(*(beg + h), *r);
+    }
+    else
+    {
+        util::make_mid_pivot(*(beg), *r, *(beg + h), compare);
+    }
+}
+
+// the pivot at end - 1 is not after *(beg - 1), so the elements equal to it go left and are done
+template <class RandomAccessIterator, class Comp>
+RandomAccessIterator pdq_sort_partition_left(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    std::swap(*beg, *(end - 1));
+    const value_type& pivot = *beg; // stays at beg until the last swap
+    RandomAccessIterator l = beg, r = end;
+    while (compare(pivot, *--r))
+        ;
+    if (r + 1 == end)
+    {
+        while (l < r && !compare(pivot, *++l))
+            ;
+    }
+    else
+    {
+        while (!compare(pivot, *++l))
+            ;
+    }
+    while (l < r)
+    {
+        std::swap(*l, *r);
+        while (compare(pivot, *--r))
+            ;
+        while (!compare(pivot, *++l))
+            ;
+    }
+    std::swap(*beg, *r);
+    return r;
+}
+
+template <class RandomAccessIterator>
+void pdq_sort_break_patterns(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::difference_type diff_type;
+    diff_type n = end - beg, q = n / 4;
+    if (n >= qsort_insertion_sort_threshold)
+    {
+        std::swap(*beg, *(beg + q));
+        std::swap(*(end - 1), *(end - q));
+        if (n > pdqsort_ninther_threshold)
+        {
+            std::swap(*(beg + 1), *(beg + q + 1));
+            std::swap(*(beg + 2), *(beg + q + 2));
+            std::swap(*(end - 2), *(end - q - 1));
+            std::swap(*(end - 3), *(end - q - 2));
+        }
+    }
+}
+
+template <class RandomAccessIterator, class Comp>
+void pdq_sort_loop(RandomAccessIterator beg, RandomAccessIterator end, int bad_allowed, Comp compare, bool leftmost)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::difference_type diff_type;
+    while (end - beg > qsort_insertion_sort_threshold)
+    {
+        diff_type n = end - beg;
+        pdq_sort_pivot(beg, end, compare);
+        if (!leftmost && !compare(*(beg - 1), *(end - 1)))
+        {
+            beg = pdq_sort_partition_left(beg, end, compare) + 1;
+            continue;
+        }
+
+        bool swaped = false;
+        RandomAccessIterator l = quick_sort_partition_pivot<true>(beg, end, compare, swaped), r = l + 1;
+        if (l - beg < n / 8 || end - r < n / 8)
+        {
+            if (--bad_allowed <= 0)
+            {
+                heap_sort_1(beg, end, compare);
+                return;
+            }
+            pdq_sort_break_patterns(beg, l);
+            pdq_sort_break_patterns(r, end);
+        }
+        else if (!swaped && (l == beg || !compare(*(l - 1), *beg)))
+        {
+            RandomAccessIterator i = leftmost ? insert_sort_limit(beg, l, compare, 1)
+                : unguarded_insert_sort_limit(beg, l, compare, 1);
+            if (i == l)
+            {
+                i = unguarded_insert_sort_limit(r, end, compare, 1);
+            }
+            if (i == end)
+            {
+                return;
+            }
+        }
+
+        pdq_sort_loop(beg, l, bad_allowed, compare, leftmost);
+        beg = r;
+        leftmost = false;
+    }
+
+    if (small_sort_kernel<simd_network_enabled<RandomAccessIterator, Comp, false>::value>::run(beg, end, compare))
+    {
+        return;
+    }
+    if (leftmost)
+    {
+        q_insert_sort(beg, end, compare);
+    }
+    else
+    {
+        unguarded_q_insert_sort(beg, end, compare);
+    }
+}
+
+template <class RandomAccessIterator, class Comp>
+void pdq_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    int bad_allowed = 0;
+    for (typename std::iterator_traits<RandomAccessIterator>::difference_type n = end - beg; n > 1; n >>= 1)
+    {
+        ++bad_allowed;
+    }
+    pdq_sort_loop(beg, end, bad_allowed, compare, true);
+}
+
+#ifdef BAO_SORT_LIB_PARALLEL
+// same steps as quick_sort_loop, but the left part of every big partition becomes a task
+template <bool branchless, class RandomAccessIterator, class Comp>
+void parallel_quick_sort_loop(util::task_pool& pool, util::task_group& group, RandomAccessIterator beg, RandomAccessIterator end, int deep, Comp compare, bool leftmost)
+{
+    while (end - beg > parallel_qsort_task_threshold)
+    {
+        if (deep <= 0)
+        {
+            shell_sort(beg, end, compare);
+            return;
+        }
+
+        bool swaped = false;
+        RandomAccessIterator l = quick_sort_partition<branchless>(beg, end, compare, swaped), r = l + 1;
+        --deep;
+        if (!swaped && (l == beg || !compare(*(l - 1), *beg)))
+        {
+            RandomAccessIterator i = leftmost ? insert_sort_limit(beg, l, compare, 1)
+                : unguarded_insert_sort_limit(beg, l, compare, 1);
+            if (i == l)
+            {
+                i = unguarded_insert_sort_limit(r, end, compare, 1);
+            }
+            if (i == end)
+            {
+                return;
+            }
+            if (i >= l)
+            {
+                while (r < end && util::object_equal(*r, *l, compare)) ++r;
+                beg = r;
+                leftmost = false;
+                continue;
+            }
+        }
+        while (r < end && util::object_equal(*r, *l, compare)) ++r;
+
+        pool.spawn(group, [&pool, &group, beg, l, deep, compare, leftmost]()
+        {
+            parallel_quick_sort_loop<branchless>(pool, group, beg, l, deep, compare, leftmost);
+        });
+        beg = r;
+        leftmost = false;
+    }
+    quick_sort_loop<branchless>(beg, end, deep, compare, leftmost);
+}
+#endif
+
+template <class RandomAccessIterator, class Comp>
+void parallel_quick_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, unsigned threads)
+{
+    if (end - beg > 1)
+    {
+        double deep = log((double)(end - beg)) / log(1.5);
+#ifdef BAO_SORT_LIB_PARALLEL
+        if (end - beg > parallel_qsort_task_threshold && (threads = util::task_pool::thread_count(threads)) > 1)
+        {
+            util::task_pool pool(threads);
+            util::task_group group;
+            parallel_quick_sort_loop<false>(pool, group, beg, end, (int)deep, compare, true);
+            pool.wait(group);
+            return;
+        }
+#else
+        (void)threads;
+#endif
+        quick_sort_loop<false>(beg, end, (int)deep, compare, true);
+    }
+}
+
+// samplesort in the IPS4o way, elements are classified into buckets and moved in place block by block
+template <class T>
+inline size_t samplesort_block_size()
+{
+    return sizeof(T) < (size_t)samplesort_block_bytes ? (size_t)samplesort_block_bytes / sizeof(T) : 1;
+}
+
+// log2 of the bucket count, 0 if the range is too small to be worth it
+inline size_t samplesort_log_buckets(size_t len, size_t block)
+{
+    size_t log_buckets = 0;
+    while (((size_t)2 << log_buckets) <= (size_t)samplesort_max_buckets
+        && ((size_t)2 << log_buckets) * block * 2 <= len)
+    {
+        ++log_buckets;
+    }
+    return ((size_t)1 << log_buckets) >= (size_t)samplesort_min_buckets ? log_buckets : 0;
+}
+
+template <class T, class Comp>
+struct samplesort_classifier
+{
+    std::vector<T> tree;      // splitters as an implicit search tree, root at 1
+    std::vector<T> splitters; // sorted, only for the equal buckets
+    size_t log_buckets;
+    size_t buckets;
+    bool equal_buckets;
+    Comp compare;
+
+    samplesort_classifier(Comp _compare)
+        : log_buckets(0)
+        , buckets(0)
+        , equal_buckets(false)
+        , compare(_compare)
+    {
+    }
+
+    size_t bucket_count() const
+    {
+        return equal_buckets ? buckets * 2 : buckets;
+    }
+
+    // every element of a batch walks one tree level at a time, so the compares do not wait on each other
+    template <class RandomAccessIterator>
+    void classify(RandomAccessIterator it, size_t* index, size_t count) const
+    {
+        for (size_t u = 0; u < count; ++u)
+            index[u] = 1;
+        for (size_t l = 0; l < log_buckets; ++l)
+        {
+            for (size_t u = 0; u < count; ++u)
+                index[u] = 2 * index[u] + (size_t)compare(tree[index[u]], *(it + u));
+        }
+        for (size_t u = 0; u < count; ++u)
+        {
+            index[u] -= buckets;
+        }
+        if (equal_buckets)
+        {
+            for (size_t u = 0; u < count; ++u)
+                index[u] = 2 * index[u] + (size_t)(index[u] < buckets - 1 && !compare(*(it + u), splitters[index[u]]));
+        }
+    }
+
+    size_t bucket(const T& v) const
+    {
+        size_t b = 1;
+        for (size_t l = 0; l < log_buckets; ++l)
+            b = 2 * b + (size_t)compare(tree[b], v);
+        b -= buckets;
+        if (equal_buckets)
+            b = 2 * b + (size_t)(b < buckets - 1 && !compare(v, splitters[b]));
+        return b;
+    }
+
+    // picks evenly spaced splitters from a sorted sample, duplicated splitters turn on the equal buckets
+    template <class RandomAccessIterator>
+    void build(RandomAccessIterator sample, size_t sample_len, size_t log_k)
+    {
+        while (true)
+        {
+            buckets = (size_t)1 << log_k;
+            equal_buckets = false;
+            splitters.clear();
+            for (size_t i = 1; i < buckets; ++i)
+            {
+                const T& s = *(sample + i * sample_len / buckets);
+                if (splitters.empty() || compare(splitters.back(), s))
+                    splitters.push_back(s);
+                else
+                    equal_buckets = true;
+            }
+            if (!equal_buckets || buckets * 2 <= (size_t)samplesort_max_buckets)
+                break;
+            --log_k;
+        }
+        log_buckets = log_k;
+        while (splitters.size() < buckets - 1)
+            splitters.push_back(splitters.back());
+        tree.assign(buckets, splitters[0]);
+        build_tree(1, 0, buckets - 1);
+    }
+
+    void build_tree(size_t node, size_t lo, size_t hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        tree[node] = splitters[mid];
+        if (node * 2 < buckets)
+        {
+            build_tree(node * 2, lo, mid);
+            build_tree(node * 2 + 1, mid + 1, hi);
+        }
+    }
+};
+
+template <class T>
+struct samplesort_buffers
+{
+    std::vector<T> blocks;   // one block per bucket, flushed to the array when full
+    std::vector<T> swap;     // the two blocks in flight during the permutation
+    std::vector<T> overhang; // bucket tails saved for the cleanup, and the overflow block
+    size_t fill[samplesort_max_buckets];
+    size_t count[samplesort_max_buckets];
+
+    void init(const T& v, size_t block, bool with_overhang)
+    {
+        if (blocks.empty())
+        {
+            blocks.assign(block * samplesort_max_buckets, v);
+            swap.assign(block * 2, v);
+        }
+        if (with_overhang && overhang.empty())
+        {
+            overhang.assign(block * (samplesort_max_buckets + 1), v);
+        }
+    }
+};
+
+struct samplesort_no_lock
+{
+    void lock(size_t) { }
+    void unlock(size_t) { }
+};
+
+#ifdef BAO_SORT_LIB_PARALLEL
+struct samplesort_mutex_lock
+{
+    std::mutex locks[samplesort_max_buckets];
+
+    void lock(size_t b) { locks[b].lock(); }
+    void unlock(size_t b) { locks[b].unlock(); }
+};
+#endif
+
+// one partition step, the range is cut into stripes, one stripe per thread
+// classify_stripe -> prepare -> move_empty_blocks -> permute -> save_overhang -> fill_bucket
+// every phase can run its stripes or buckets concurrently.
+// Classifier gives bucket_count(), bucket(v) and classify(it, index, count)
+template <class RandomAccessIterator, class Classifier>
+struct samplesort_partition
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    typedef samplesort_buffers<value_type> buffers_type;
+
+    RandomAccessIterator beg;
+    size_t len;
+    size_t block;
+    size_t buckets;
+    size_t stripes;
+    size_t overflow_bucket;
+    const Classifier& cls;
+    buffers_type* bufs;
+    std::vector<size_t> stripe_beg;
+    std::vector<size_t> stripe_write;
+    size_t bucket_beg[samplesort_max_buckets + 1];
+    size_t delim[samplesort_max_buckets + 1];
+    size_t write[samplesort_max_buckets];
+    size_t read[samplesort_max_buckets];
+    size_t overhang_len[samplesort_max_buckets];
+
+    samplesort_partition(RandomAccessIterator _beg, size_t _len, size_t _block,
+        const Classifier& _cls, buffers_type* _bufs, size_t _stripes)
+        : beg(_beg)
+        , len(_len)
+        , block(_block)
+        , buckets(_cls.bucket_count())
+        , stripes(_stripes)
+        , overflow_bucket(_cls.bucket_count())
+        , cls(_cls)
+        , bufs(_bufs)
+        , stripe_beg(_stripes + 1, _len)
+        , stripe_write(_stripes, 0)
+    {
+        for (size_t t = 0; t < stripes; ++t)
+            stripe_beg[t] = _len / block * t / stripes * block;
+    }
+
+    size_t align_up(size_t pos) const
+    {
+        return (pos + block - 1) / block * block;
+    }
+
+    value_type* overhang_block(size_t b) const
+    {
+        return &bufs[0].overhang[b * block];
+    }
+
+    value_type* overflow_block() const
+    {
+        return &bufs[0].overhang[samplesort_max_buckets * block];
+    }
+
+    bool block_is_full(size_t pos) const
+    {
+        size_t t = std::upper_bound(stripe_beg.begin(), stripe_beg.end(), pos) - stripe_beg.begin() - 1;
+        return pos < stripe_write[t];
+    }
+
+    // full blocks are written back to the front of the stripe, the rest stays in the buffers
+    void classify_stripe(size_t t)
+    {
+        buffers_type& buf = bufs[t];
+        size_t first = stripe_beg[t], last = stripe_beg[t + 1], write_pos = first;
+        size_t index[samplesort_classify_unroll];
+        for (size_t b = 0; b < buckets; ++b)
+        {
+            buf.fill[b] = 0;
+            buf.count[b] = 0;
+        }
+        for (size_t i = first; i < last; )
+        {
+            size_t batch = std::min((size_t)samplesort_classify_unroll, last - i);
+            cls.classify(beg + i, index, batch);
+            for (size_t u = 0; u < batch; ++u, ++i)
+            {
+                size_t b = index[u];
+                value_type* dst = &buf.blocks[b * block];
+                dst[buf.fill[b]++] = *(beg + i);
+                if (buf.fill[b] == block)
+                {
+                    std::copy(dst, dst + block, beg + write_pos);
+                    write_pos += block;
+                    buf.count[b] += block;
+                    buf.fill[b] = 0;
+                }
+            }
+        }
+        for (size_t b = 0; b < buckets; ++b)
+        {
+            buf.count[b] += buf.fill[b];
+        }
+        stripe_write[t] = write_pos;
+    }
+
+    // bucket b ends up in [bucket_beg[b], bucket_beg[b + 1]), its full blocks go to [delim[b], delim[b + 1])
+    void prepare()
+    {
+        bucket_beg[0] = 0;
+        for (size_t b = 0; b < buckets; ++b)
+        {
+            size_t size = 0;
+            for (size_t t = 0; t < stripes; ++t)
+                size += bufs[t].count[b];
+            bucket_beg[b + 1] = bucket_beg[b] + size;
+            delim[b] = align_up(bucket_beg[b]);
+        }
+        delim[buckets] = align_up(len);
+    }
+
+    // the empty blocks of a bucket area are moved behind its full blocks
+    void move_empty_blocks(size_t b)
+    {
+        size_t i = delim[b], j = delim[b + 1];
+        while (true)
+        {
+            while (i < j && block_is_full(i))
+                i += block;
+            while (i < j && !block_is_full(j - block))
+                j -= block;
+            if (i >= j)
+                break;
+            j -= block;
+            std::copy(beg + j, beg + j + block, beg + i);
+            i += block;
+        }
+        write[b] = delim[b];
+        read[b] = i;
+    }
+
+    // takes blocks from the read end of the areas and swaps them into the write end of their own bucket,
+    // a block is only read under the lock, after that its place can be written by anyone
+    template <class Lock>
+    void permute(size_t t, Lock& lock)
+    {
+        value_type* cur = &bufs[t].swap[0];
+        value_type* tmp = &bufs[t].swap[block];
+        size_t start = t * buckets / stripes;
+        for (size_t i = 0; i < buckets; ++i)
+        {
+            size_t src = (start + i) % buckets;
+            while (true)
+            {
+                lock.lock(src);
+                if (read[src] <= write[src])
+                {
+                    lock.unlock(src);
+                    break;
+                }
+                read[src] -= block;
+                std::copy(beg + read[src], beg + read[src] + block, cur);
+                lock.unlock(src);
+
+                size_t dest = cls.bucket(*cur);
+                while (true)
+                {
+                    lock.lock(dest);
+                    size_t pos = write[dest];
+                    while (pos < read[dest] && cls.bucket(*(beg + pos)) == dest)
+                        pos += block;
+                    bool occupied = pos < read[dest];
+                    write[dest] = pos + block;
+                    lock.unlock(dest);
+
+                    if (!occupied)
+                    {
+                        if (pos + block > len)
+                        {
+                            overflow_bucket = dest;
+                            std::copy(cur, cur + block, overflow_block());
+                        }
+                        else
+                        {
+                            std::copy(cur, cur + block, beg + pos);
+                        }
+                        break;
+                    }
+                    std::copy(beg + pos, beg + pos + block, tmp);
+                    std::copy(cur, cur + block, beg + pos);
+                    std::swap(cur, tmp);
+                    dest = cls.bucket(*cur);
+                }
+            }
+        }
+    }
+
+    // the last block of a bucket may run into the next bucket, that part is saved before being overwritten
+    void save_overhang(size_t b)
+    {
+        size_t first = std::max(bucket_beg[b + 1], delim[b]), last = write[b];
+        value_type* dst = overhang_block(b);
+        size_t n = 0;
+        if (b == overflow_bucket)
+        {
+            value_type* src = overflow_block();
+            last -= block;
+            for (size_t pos = last; pos < write[b]; ++pos)
+            {
+                if (pos < bucket_beg[b + 1])
+                    *(beg + pos) = src[pos - last];
+                else
+                    dst[n++] = src[pos - last];
+            }
+        }
+        for (size_t pos = first; pos < last; ++pos)
+        {
+            dst[n++] = *(beg + pos);
+        }
+        overhang_len[b] = n;
+    }
+
+    // the gaps at both ends of a bucket are filled from its overhang and the stripe buffers
+    void fill_bucket(size_t b)
+    {
+        size_t bucket_end = bucket_beg[b + 1];
+        size_t gap_end = std::min(delim[b], bucket_end), tail = std::min(write[b], bucket_end);
+        size_t pos = bucket_beg[b];
+        fill_gap(pos, gap_end, tail, overhang_block(b), overhang_len[b]);
+        for (size_t t = 0; t < stripes; ++t)
+        {
+            fill_gap(pos, gap_end, tail, &bufs[t].blocks[b * block], bufs[t].fill[b]);
+        }
+    }
+
+    void fill_gap(size_t& pos, size_t gap_end, size_t tail, const value_type* src, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (pos == gap_end)
+                pos = tail;
+            *(beg + pos++) = src[i];
+        }
+    }
+
+    void run()
+    {
+        samplesort_no_lock lock;
+        for (size_t t = 0; t < stripes; ++t)
+            classify_stripe(t);
+        prepare();
+        for (size_t b = 0; b < buckets; ++b)
+            move_empty_blocks(b);
+        for (size_t t = 0; t < stripes; ++t)
+            permute(t, lock);
+        for (size_t b = 0; b < buckets; ++b)
+            save_overhang(b);
+        for (size_t b = 0; b < buckets; ++b)
+            fill_bucket(b);
+    }
+
+#ifdef BAO_SORT_LIB_PARALLEL
+    void run(util::task_pool& pool)
+    {
+        samplesort_mutex_lock lock;
+        util::task_group phase;
+        for (size_t t = 0; t < stripes; ++t)
+            pool.spawn(phase, [this, t]() { classify_stripe(t); });
+        pool.wait(phase);
+        prepare();
+        for_buckets(pool, &samplesort_partition::move_empty_blocks);
+        for (size_t t = 0; t < stripes; ++t)
+            pool.spawn(phase, [this, &lock, t]() { permute(t, lock); });
+        pool.wait(phase);
+        for_buckets(pool, &samplesort_partition::save_overhang);
+        for_buckets(pool, &samplesort_partition::fill_bucket);
+    }
+
+    void for_buckets(util::task_pool& pool, void (samplesort_partition::*step)(size_t))
+    {
+        util::task_group phase;
+        for (size_t t = 0; t < stripes; ++t)
+        {
+            size_t first = t * buckets / stripes, last = (t + 1) * buckets / stripes;
+            pool.spawn(phase, [this, step, first, last]()
+            {
+                for (size_t b = first; b < last; ++b)
+                    (this->*step)(b);
+            });
+        }
+        pool.wait(phase);
+    }
+#endif
+};
+
+template <class RandomAccessIterator, class Comp>
+void sample_sort_select(samplesort_classifier<typename std::iterator_traits<RandomAccessIterator>::value_type, Comp>& cls,
+    RandomAccessIterator beg, RandomAccessIterator end, size_t log_buckets)
+{
+    size_t len = end - beg, log_len = 0;
+    while (len >> log_len)
+        ++log_len;
+    size_t oversample = log_len / 5 > 1 ? log_len / 5 : 1;
+    size_t sample = std::min(oversample << log_buckets, len / 2);
+    uint32_t rnd = (util::fake_rand_simple() ^ (uint32_t)len) | 1;
+    for (size_t i = 0; i < sample; ++i)
+    {
+        // draw a full size_t, a single 32-bit word is biased and never reaches past 2^32
+        size_t r = 0;
+        for (size_t w = 0; w < sizeof(size_t); w += sizeof(uint32_t))
+        {
+            rnd ^= rnd << 13;
+            rnd ^= rnd >> 17;
+            rnd ^= rnd << 5;
+            r = (r << 16 << 16) ^ rnd;
+        }
+        std::swap(*(beg + i), *(beg + i + r % (len - i)));
+    }
+    quick_sort<false>(beg, beg + sample, cls.compare);
+    cls.build(beg, sample, log_buckets);
+}
+
+template <class RandomAccessIterator, class Comp>
+void sample_sort_loop(RandomAccessIterator beg, RandomAccessIterator end, int deep, Comp compare, bool leftmost,
+    samplesort_buffers<typename std::iterator_traits<RandomAccessIterator>::value_type>& buffers)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    size_t len = end - beg, block = samplesort_block_size<value_type>();
+    size_t log_buckets = samplesort_log_buckets(len, block);
+    if (log_buckets == 0 || deep <= 0)
+    {
+        quick_sort_loop<false>(beg, end, deep, compare, leftmost);
+        return;
+    }
+
+    samplesort_classifier<value_type, Comp> cls(compare);
+    sample_sort_select(cls, beg, end, log_buckets);
+    buffers.init(*beg, block, true);
+
+    samplesort_partition<RandomAccessIterator, samplesort_classifier<value_type, Comp> > part(beg, len, block, cls, &buffers, 1);
+    part.run();
+
+    // the equal buckets need no more sorting
+    for (size_t b = 0; b < part.buckets; ++b)
+    {
+        size_t first = part.bucket_beg[b], last = part.bucket_beg[b + 1];
+        if (last - first > 1 && !(cls.equal_buckets && (b & 1)))
+        {
+            sample_sort_loop(beg + first, beg + last, deep - 1, compare, leftmost && first == 0, buffers);
+        }
+    }
+}
+
+// sorted or reversed input costs a whole partition per level, a scan that stops at the first turn is cheaper
+template <class RandomAccessIterator, class Comp>
+bool sample_sort_presorted(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    RandomAccessIterator i = beg + 1;
+    while (i < end && !compare(*i, *(i - 1)))
+        ++i;
+    if (i == end)
+        return true;
+    if (i - beg > 1)
+        return false;
+    while (i < end && !compare(*(i - 1), *i))
+        ++i;
+    if (i < end)
+        return false;
+    std::reverse(beg, end);
+    return true;
+}
+
+template <class RandomAccessIterator, class Comp>
+void sample_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    if (end - beg > 1 && !sample_sort_presorted(beg, end, compare))
+    {
+        double deep = log((double)(end - beg)) / log(1.5);
+        samplesort_buffers<typename std::iterator_traits<RandomAccessIterator>::value_type> buffers;
+        sample_sort_loop(beg, end, (int)deep, compare, true, buffers);
+    }
+}
+
+#ifdef BAO_SORT_LIB_PARALLEL
+// every phase of the partition runs on all threads, small buckets are then sorted by tasks,
+// and the buckets still too big for one thread are partitioned in parallel again.
+// neighbour buckets are sorted concurrently, so none of them may use the element before it as a guard
+template <class RandomAccessIterator, class Comp>
+void parallel_sample_sort_loop(util::task_pool& pool, util::task_group& group,
+    std::vector<samplesort_buffers<typename std::iterator_traits<RandomAccessIterator>::value_type> >& thread_buffers,
+    std::vector<samplesort_buffers<typename std::iterator_traits<RandomAccessIterator>::value_type> >& stripe_buffers,
+    RandomAccessIterator beg, RandomAccessIterator end, int deep, Comp compare)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    typedef samplesort_partition<RandomAccessIterator, samplesort_classifier<value_type, Comp> > partition_type;
+    size_t len = end - beg, block = samplesort_block_size<value_type>();
+    size_t log_buckets = samplesort_log_buckets(len, block);
+    if (log_buckets == 0 || deep <= 0)
+    {
+        quick_sort_loop<false>(beg, end, deep, compare, true);
+        return;
+    }
+
+    samplesort_classifier<value_type, Comp> cls(compare);
+    sample_sort_select(cls, beg, end, log_buckets);
+    size_t stripes = pool.size();
+    for (size_t t = 0; t < stripes; ++t)
+        stripe_buffers[t].init(*beg, block, t == 0);
+
+    partition_type part(beg, len, block, cls, &stripe_buffers[0], stripes);
+    part.run(pool);
+
+    // small buckets are batched into tasks of at least parallel_samplesort_task_threshold elements
+    size_t big = std::max(len / stripes, (size_t)parallel_samplesort_stripe_threshold);
+    std::vector<size_t> big_buckets, batch;
+    size_t batch_len = 0;
+    for (size_t b = 0; b < part.buckets; ++b)
+    {
+        size_t first = part.bucket_beg[b], last = part.bucket_beg[b + 1];
+        if (last - first > 1 && !(cls.equal_buckets && (b & 1)))
+        {
+            if (last - first > big)
+            {
+                big_buckets.push_back(first);
+                big_buckets.push_back(last);
+            }
+            else
+            {
+                batch.push_back(first);
+                batch.push_back(last);
+                batch_len += last - first;
+            }
+        }
+        if (!batch.empty() && (batch_len >= (size_t)parallel_samplesort_task_threshold || b + 1 == part.buckets))
+        {
+            pool.spawn(group, [&pool, &thread_buffers, beg, batch, deep, compare]()
+            {
+                samplesort_buffers<value_type>& buffers = thread_buffers[pool.thread_index()];
+                for (size_t i = 0; i < batch.size(); i += 2)
+                {
+                    sample_sort_loop(beg + batch[i], beg + batch[i + 1], deep - 1, compare, true, buffers);
+                }
+            });
+            batch.clear();
+            batch_len = 0;
+        }
+    }
+    for (size_t i = 0; i < big_buckets.size(); i += 2)
+    {
+        parallel_sample_sort_loop(pool, group, thread_buffers, stripe_buffers,
+            beg + big_buckets[i], beg + big_buckets[i + 1], deep - 1, compare);
+    }
+}
+#endif
+
+template <class RandomAccessIterator, class Comp>
+void parallel_sample_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, unsigned threads)
+{
+    if (end - beg > 1)
+    {
+#ifdef BAO_SORT_LIB_PARALLEL
+        if (end - beg > parallel_samplesort_stripe_threshold && (threads = util::task_pool::thread_count(threads)) > 1)
+        {
+            if (sample_sort_presorted(beg, end, compare))
+                return;
+            typedef samplesort_buffers<typename std::iterator_traits<RandomAccessIterator>::value_type> buffers_type;
+            double deep = log((double)(end - beg)) / log(1.5);
+            util::task_pool pool(threads);
+            std::vector<buffers_type> thread_buffers(pool.size()), stripe_buffers(pool.size());
+            util::task_group group;
+            parallel_sample_sort_loop(pool, group, thread_buffers, stripe_buffers, beg, end, (int)deep, compare);
+            pool.wait(group);
+            return;
+        }
+#else
+        (void)threads;
+#endif
+        sample_sort(beg, end, compare);
+    }
+}
+
+template <class RandomAccessIterator, class Comp>
+RandomAccessIterator tim_sort_create_run(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    typedef small_sort_kernel<simd_network_enabled<RandomAccessIterator, Comp, true>::value> small_sort;
+    if (end - beg < timsort_last_run_threshold) // must bigger than timsort_min_run
+    {
+        if (!small_sort::run(beg, end, compare))
+            insert_sort(beg, end, compare);
+        return end;
+    }
+
+    bool ascending;
+    RandomAccessIterator run_end = beg + 3;
+
+    if (compare(*(beg + 1), *beg))
+    {
+        if (!compare(*(beg + 2), *beg))
+        {
+            std::swap(*beg, *(beg + 1));
+            ascending = true;
+        }
+        else if (compare(*(beg + 2), *(beg + 1)))
+        {
+            ascending = false;
+        }
+        else
+        {
+            std::swap(*(beg + 2), *(beg + 1));
+            ascending = false;
+        }
+    }
+    else
+    {
+        if (compare(*(beg + 2), *beg))
+        {
+            std::swap(*beg, *(beg + 1));
+            ascending = false;
+        }
+        else if (!compare(*(beg + 2), *(beg + 1)))
+        {
+            ascending = true;
+        }
+        else
+        {
+            std::swap(*(beg + 2), *(beg + 1));
+            ascending = true;
+        }
+    }
+
+    if (!ascending)
+    {
+        while (run_end < end && compare(*run_end, *(run_end - 1)))
+        {
+            ++run_end;
+        }
+
+        if (run_end - beg < timsort_min_run)
+        {
+            if (!small_sort::run_reverse(beg, beg + timsort_min_run, compare))
+                insert_sort_part_rev(beg, run_end, beg + timsort_min_run, compare);
+            run_end = beg + timsort_min_run;
+            while (run_end < end && compare(*run_end, *(run_end - timsort_insert_gap)))
+            {
+                unguarded_insert_single_rev(run_end, compare);
+                ++run_end;
+            }
+        }
+
+        // reverse
+        for (RandomAccessIterator b = beg, e = run_end - 1; b < e; ++b, --e)
+        {
+            std::swap(*b, *e);
+        }
+    }
+    else
+    {
+        while (run_end < end && !compare(*run_end, *(run_end - 1)))
+        {
+            ++run_end;
+        }
+
+        if (run_end - beg < timsort_min_run)
+        {
+            if (!small_sort::run(beg, beg + timsort_min_run, compare))
+                insert_sort_part(beg, run_end, beg + timsort_min_run, compare);
+            run_end = beg + timsort_min_run;
+            while (run_end < end && !compare(*run_end, *(run_end - timsort_insert_gap)))
+            {
+                unguarded_insert_single(run_end, compare);
+                ++run_end;
+            }
+        }
+    }
+
+    return run_end;
+}
+
+template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+void tim_sort_force_stack_merge(RandomAccessBufferIterator buf, RandomAccessIterator* beg, RandomAccessIterator* end, Comp compare)
+{
+    while (end - beg > 1)
+    {
+        if (end - beg > 2)
+        {
+            if (end[0] - end[-1] <= end[-2] - end[-3])
+            {
+                merge_2_part<safecopy>(buf, end[-2], end[-1], end[0], compare);
+                end[-1] = end[0];
+                --end;
+            }
+            else
+            {
+                merge_2_part<safecopy>(buf, end[-3], end[-2], end[-1], compare);
+                end[-2] = end[-1];
+                end[-1] = end[0];
+                --end;
+            }
+        }
+        else
+        {
+            merge_2_part<safecopy>(buf, end[-2], end[-1], end[0], compare);
+            end[-1] = end[0];
+            --end;
+        }
+    }
+}
+
+template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+void tim_sort_force_stack_merge_with_buffer(RandomAccessBufferIterator buf, size_t bufsize, RandomAccessIterator* beg, RandomAccessIterator* end, Comp compare)
+{
+    while (end - beg > 1)
+    {
+        if (end - beg > 2)
+        {
+            if (end[0] - end[-1] <= end[-2] - end[-3])
+            {
+                merge_2_part_with_buffer<safecopy>(buf, bufsize, end[-2], end[-1], end[0], compare);
+                end[-1] = end[0];
+                --end;
+            }
+            else
+            {
+                merge_2_part_with_buffer<safecopy>(buf, bufsize, end[-3], end[-2], end[-1], compare);
+                end[-2] = end[-1];
+                end[-1] = end[0];
+                --end;
+            }
+        }
+        else
+        {
+            merge_2_part_with_buffer<safecopy>(buf, bufsize, end[-2], end[-1], end[0], compare);
+            end[-1] = end[0];
+            --end;
+        }
+    }
+}
+
+template <class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+void tim_sort_stack_merge(RandomAccessBufferIterator buf, RandomAccessIterator* run_stack, RandomAccessIterator* &stack_top, RandomAccessIterator end, Comp compare)
+{
+    for (bool merged = true; merged && end - stack_top[0] > stack_top[0] - stack_top[-1]; )
+    {
+        merged = false;
+        if (stack_top - run_stack >= 2)
+        {
+            if (stack_top - run_stack > 2)
+            {
+                if (stack_top[0] - stack_top[-2] >= stack_top[-2] - stack_top[-3]) // a + b >= c
+                {
+                    if (stack_top[0] - stack_top[-1] <= stack_top[-2] - stack_top[-3]) // a <= c
+                    {
+                        merge_2_part(buf, stack_top[-2], stack_top[-1], stack_top[0], compare);
+                        merge_2_part(buf, stack_top[-3], stack_top[-2], stack_top[0], compare);
+                        stack_top[-2] = stack_top[0];
+                        stack_top -= 2;
+                    }
+                    else
+                    {
+                        merge_2_part(buf, stack_top[-3], stack_top[-2], stack_top[-1], compare);
+                        stack_top[-2] = stack_top[-1];
+                        stack_top[-1] = stack_top[0];
+                        --stack_top;
+                    }
+                    merged = true;
+                    continue;
+                }
+            }
+            if (stack_top[0] - stack_top[-1] >= stack_top[-1] - stack_top[-2]) // a >= b
+            {
+                merge_2_part(buf, stack_top[-2], stack_top[-1], stack_top[0], compare);
+                stack_top[-1] = stack_top[0];
+                --stack_top;
+                merged = true;
+            }
+        }
+    }
+}
+
+template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+void tim_sort_stack_merge_13(RandomAccessBufferIterator buf, RandomAccessIterator* run_stack, RandomAccessIterator* &stack_top, RandomAccessIterator end, Comp compare)
+{
+    while (stack_top - run_stack >= 2 && end - stack_top[0] > stack_top[0] - stack_top[-1])
+    {
+        if (stack_top - run_stack > 2 && (stack_top[0] - stack_top[-2]) * 4 / 3 >= stack_top[-1] - stack_top[-3]) // a >= c
+        {
+            merge_2_part<safecopy>(buf, stack_top[-3], stack_top[-2], stack_top[-1], compare);
+            stack_top[-2] = stack_top[-1];
+            stack_top[-1] = stack_top[0];
+            --stack_top;
+            while (stack_top - run_stack > 2 && (stack_top[-1] - stack_top[-2]) * 4 / 3 >= (stack_top[-2] - stack_top[-3]))
+            {
+                merge_2_part<safecopy>(buf, stack_top[-3], stack_top[-2], stack_top[-1], compare);
+                stack_top[-2] = stack_top[-1];
+                stack_top[-1] = stack_top[0];
+                --stack_top;
+            }
+        }
+        else if ((stack_top[0] - stack_top[-1]) * 4 / 3 >= (stack_top[-1] - stack_top[-2])) // 1.333 * a > b
+        {
+            merge_2_part<safecopy>(buf, stack_top[-2], stack_top[-1], stack_top[0], compare);
+            stack_top[-1] = stack_top[0];
+            --stack_top;
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+void tim_sort_stack_merge_with_buffer_13(RandomAccessBufferIterator buf, size_t bufsize, RandomAccessIterator* run_stack, RandomAccessIterator* &stack_top, RandomAccessIterator end, Comp compare)
+{
+    while (stack_top - run_stack >= 2 && end - stack_top[0] > stack_top[0] - stack_top[-1])
+    {
+        if (stack_top - run_stack > 2 && (stack_top[0] - stack_top[-2]) * 4 / 3 >= stack_top[-1] - stack_top[-3]) // a >= c
+        {
+            merge_2_part_with_buffer<safecopy>(buf, bufsize, stack_top[-3], stack_top[-2], stack_top[-1], compare);
+            stack_top[-2] = stack_top[-1];
+            stack_top[-1] = stack_top[0];
+            --stack_top;
+            while (stack_top - run_stack > 2 && (stack_top[-1] - stack_top[-2]) * 4 / 3 >= (stack_top[-2] - stack_top[-3]))
+            {
+                merge_2_part_with_buffer<safecopy>(buf, bufsize, stack_top[-3], stack_top[-2], stack_top[-1], compare);
+                stack_top[-2] = stack_top[-1];
+                stack_top[-1] = stack_top[0];
+                --stack_top;
+            }
+        }
+        else if ((stack_top[0] - stack_top[-1]) * 4 / 3 >= (stack_top[-1] - stack_top[-2])) // 1.333 * a > b
+        {
+            merge_2_part_with_buffer<safecopy>(buf, bufsize, stack_top[-2], stack_top[-1], stack_top[0], compare);
+            stack_top[-1] = stack_top[0];
+            --stack_top;
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+// merge policies of tim_sort, timsort_policy keeps the run stack invariants of timsort,
+// powersort_policy merges by the node power of the run boundaries (Munro, Wild), which is nearly optimal
+struct timsort_policy
+{
+};
+
+struct powersort_policy
+{
+};
+
+template <class MergePolicy>
+struct tim_sort_merger
+{
+    template <class RandomAccessIterator>
+    tim_sort_merger(RandomAccessIterator, RandomAccessIterator)
+    {
+    }
+
+    template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+    void collapse(RandomAccessBufferIterator buf, size_t bufsize, RandomAccessIterator* run_stack, RandomAccessIterator*& stack_top, RandomAccessIterator end, Comp compare)
+    {
+        if (bufsize == 0)
+            tim_sort_stack_merge_13<safecopy>(buf, run_stack, stack_top, end, compare);
+        else
+            tim_sort_stack_merge_with_buffer_13<safecopy>(buf, bufsize, run_stack, stack_top, end, compare);
+    }
+
+    template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+    void force(RandomAccessBufferIterator buf, size_t bufsize, RandomAccessIterator* run_stack, RandomAccessIterator* stack_top, Comp compare)
+    {
+        if (bufsize == 0)
+            tim_sort_force_stack_merge<safecopy>(buf, run_stack, stack_top, compare);
+        else
+            tim_sort_force_stack_merge_with_buffer<safecopy>(buf, bufsize, run_stack, stack_top, compare);
+    }
+};
+
+template <>
+struct tim_sort_merger<powersort_policy>
+{
+    size_t length;
+    int power[78]; // power[i] is the power of the boundary run_stack[i], increasing to the top
+
+    template <class RandomAccessIterator>
+    tim_sort_merger(RandomAccessIterator beg, RandomAccessIterator end)
+        : length((size_t)(end - beg))
+    {
+    }
+
+    // the first bit where the midpoints of [l, m) and [m, r) differ, as fractions of the length
+    int node_power(size_t l, size_t m, size_t r) const
+    {
+        size_t a = l + m, b = m + r, d = length * 2;
+        int p = 0;
+        while (1)
+        {
+            ++p;
+            a <<= 1;
+            b <<= 1;
+            if ((a >= d) != (b >= d))
+                return p;
+            if (a >= d)
+            {
+                a -= d;
+                b -= d;
+            }
+        }
+    }
+
+    template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+    static void merge(RandomAccessBufferIterator buf, size_t bufsize, RandomAccessIterator beg, RandomAccessIterator mid, RandomAccessIterator end, Comp compare)
+    {
+        if (bufsize == 0)
+            merge_2_part<safecopy>(buf, beg, mid, end, compare);
+        else
+            merge_2_part_with_buffer<safecopy>(buf, bufsize, beg, mid, end, compare);
+    }
+
+    // the new run is on the top, the runs below with a higher boundary power are merged first
+    template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+    void collapse(RandomAccessBufferIterator buf, size_t bufsize, RandomAccessIterator* run_stack, RandomAccessIterator*& stack_top, RandomAccessIterator, Comp compare)
+    {
+        if (stack_top - run_stack < 2)
+            return;
+        int p = node_power(stack_top[-2] - run_stack[0], stack_top[-1] - run_stack[0], stack_top[0] - run_stack[0]);
+        while (stack_top - run_stack > 2 && power[stack_top - run_stack - 2] > p)
+        {
+            merge<safecopy>(buf, bufsize, stack_top[-3], stack_top[-2], stack_top[-1], compare);
+            stack_top[-2] = stack_top[-1];
+            stack_top[-1] = stack_top[0];
+            --stack_top;
+        }
+        power[stack_top - run_stack - 1] = p;
+    }
+
+    template <bool safecopy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+    void force(RandomAccessBufferIterator buf, size_t bufsize, RandomAccessIterator* run_stack, RandomAccessIterator* stack_top, Comp compare)
+    {
+        for (; stack_top - run_stack > 1; --stack_top)
+        {
+            merge<safecopy>(buf, bufsize, stack_top[-2], stack_top[-1], stack_top[0], compare);
+            stack_top[-1] = stack_top[0];
+        }
+    }
+};
+
+// creates and merges the runs of [beg, end) after the first one on run_stack
+template <bool safecopy, class MergePolicy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+void tim_sort_merge_runs(tim_sort_merger<MergePolicy>& merger, RandomAccessBufferIterator buf, size_t bufsize, RandomAccessIterator* run_stack, RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    RandomAccessIterator* stack_top = run_stack + 1;
+    while (beg < end)
+    {
+        RandomAccessIterator run = tim_sort_create_run(beg, end, compare);
+        *++stack_top = run;
+        beg = run;
+
+        merger.template collapse<safecopy>(buf, bufsize, run_stack, stack_top, end, compare);
+    }
+
+    merger.template force<safecopy>(buf, bufsize, run_stack, stack_top, compare);
+}
+
+// stable sort, the merger takes bufsize 0 as a buffer of half the range
+template <bool safecopy, class MergePolicy, class RandomAccessIterator, class Comp>
+void tim_sort_buffer(RandomAccessIterator beg, RandomAccessIterator end, size_t bufsize, Comp compare)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    if (end - beg > 1)
+    {
+        tim_sort_merger<MergePolicy> merger(beg, end);
+        RandomAccessIterator run_stack[78]; // ln(2^32)/ln(4/3) = 77.1
+        run_stack[0] = beg;
+        run_stack[1] = beg = tim_sort_create_run(beg, end, compare);
+
+        if (end > beg && (end - run_stack[0]) * sizeof(value_type) > merge_sort_stack_buffer_size)
+        {
+            size_t alloc_size = bufsize;
+            if (bufsize >= (size_t)(end - run_stack[0]) / 2)
+            {
+                alloc_size = (end - run_stack[0]) / 2;
+                bufsize = 0;
+            }
+            // the shorter side of a merge is never longer than all runs after the first
+            if (alloc_size > (size_t)(end - beg))
+            {
+                alloc_size = end - beg;
+                if (bufsize > alloc_size)
+                    bufsize = alloc_size;
+            }
+            value_type* buf = safecopy ? safe_buffer_alloc<value_type>(beg, alloc_size)
+                : (value_type*)scratch_alloc(alloc_size * sizeof(value_type));
+            tim_sort_merge_runs<safecopy>(merger, buf, bufsize, run_stack, beg, end, compare);
+            if (safecopy)
+                safe_buffer_free(buf, alloc_size);
+            else
+                scratch_free(buf, alloc_size * sizeof(value_type));
+        }
+        else if (end > beg)
+        {
+            value_type buf[merge_sort_stack_buffer_size / sizeof(value_type)];
+            tim_sort_merge_runs<safecopy>(merger, buf, 0, run_stack, beg, end, compare);
+        }
+    }
+}
+
+// stable sort on the caller's buffer of bufsize elements, never allocates,
+// merges in place where a run does not fit
+template <bool safecopy, class MergePolicy, class RandomAccessIterator, class RandomAccessBufferIterator, class Comp>
+void tim_sort_with_buffer(RandomAccessBufferIterator buf, size_t bufsize, RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    if (end - beg > 1)
+    {
+        tim_sort_merger<MergePolicy> merger(beg, end);
+        RandomAccessIterator run_stack[78];
+        run_stack[0] = beg;
+        run_stack[1] = tim_sort_create_run(beg, end, compare);
+        if (bufsize >= (size_t)(end - beg) / 2)
+        {
+            tim_sort_merge_runs<safecopy>(merger, buf, 0, run_stack, run_stack[1], end, compare);
+        }
+        else if (bufsize > 0)
+        {
+            tim_sort_merge_runs<safecopy>(merger, buf, bufsize, run_stack, run_stack[1], end, compare);
+        }
+        else
+        {
+            // the merger takes bufsize 0 as half the range, one element is enough to merge in place
+            typename std::iterator_traits<RandomAccessIterator>::value_type one[1];
+            tim_sort_merge_runs<safecopy>(merger, one, 1, run_stack, run_stack[1], end, compare);
+        }
+    }
+}
+
+#ifdef BAO_SORT_LIB_PARALLEL
+// moves a chunk edge to the next turning point, so that a chunk tends to start a natural run
+template <class RandomAccessIterator, class Comp>
+RandomAccessIterator parallel_tim_sort_chunk_edge(RandomAccessIterator edge, RandomAccessIterator end, Comp compare)
+{
+    RandomAccessIterator last = end - edge > timsort_chunk_edge_scan ? edge + timsort_chunk_edge_scan : end;
+    for (RandomAccessIterator i = edge; i < last; ++i)
+    {
+        if (compare(*(i - 1), *(i - 2)) != compare(*i, *(i - 1)))
+            return i;
+    }
+    return edge;
+}
+
+// merges the runs from run_beg[0] to run_end[0] as a balanced tree, split at the run edge nearest the middle
+template <bool safecopy, class RandomAccessIterator, class Comp>
+void parallel_tim_sort_merge_tree(util::task_pool& pool, typename std::iterator_traits<RandomAccessIterator>::value_type* buf, RandomAccessIterator base, RandomAccessIterator* run_beg, RandomAccessIterator* run_end, Comp compare)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    if (run_end - run_beg < 2)
+    {
+        return;
+    }
+    RandomAccessIterator beg = *run_beg, end = *run_end, half = beg + (end - beg) / 2;
+    RandomAccessIterator* run_mid = std::lower_bound(run_beg + 1, run_end - 1, half);
+    if (run_mid - 1 > run_beg && half - run_mid[-1] < *run_mid - half)
+    {
+        --run_mid;
+    }
+
+    if (end - beg > parallel_merge_task_threshold)
+    {
+        util::task_group group;
+        pool.spawn(group, [&pool, buf, base, run_beg, run_mid, compare]()
+        {
+            parallel_tim_sort_merge_tree<safecopy>(pool, buf, base, run_beg, run_mid, compare);
+        });
+        parallel_tim_sort_merge_tree<safecopy>(pool, buf, base, run_mid, run_end, compare);
+        pool.wait(group);
+    }
+    else
+    {
+        parallel_tim_sort_merge_tree<safecopy>(pool, buf, base, run_beg, run_mid, compare);
+        parallel_tim_sort_merge_tree<safecopy>(pool, buf, base, run_mid, run_end, compare);
+    }
+
+    RandomAccessIterator mid = *run_mid;
+    if (!compare(*mid, *(mid - 1)))
+    {
+        return;
+    }
+    beg = std::upper_bound(beg, mid, *mid, compare);
+    end = std::lower_bound(mid, end, *(mid - 1), compare);
+    if (end - beg > parallel_merge_task_threshold && pool.size() > 1)
+    {
+        value_type* out = buf + (beg - base);
+        util::task_group group;
+        parallel_merge_2_part_to(pool, group, beg, mid - beg, mid, end - mid, out, pool.size(), compare);
+        pool.wait(group);
+        parallel_copy<safecopy>(pool, group, out, end - beg, beg);
+        pool.wait(group);
+    }
+    else
+    {
+        merge_2_part<safecopy>(buf + (beg - base), beg, mid, end, compare);
+    }
+}
+
+// stable sort, buf holds end - beg elements
+template <bool safecopy, class RandomAccessIterator, class Comp>
+void parallel_tim_sort_buffer(typename std::iterator_traits<RandomAccessIterator>::value_type* buf, RandomAccessIterator beg, RandomAccessIterator end, Comp compare, unsigned threads)
+{
+    size_t len = end - beg, chunks = std::min((size_t)threads, len / parallel_merge_task_threshold);
+    util::task_pool pool(threads);
+
+    std::vector<RandomAccessIterator> edges(chunks + 1, end);
+    edges[0] = beg;
+    for (size_t c = 1; c < chunks; ++c)
+    {
+        edges[c] = parallel_tim_sort_chunk_edge(beg + len * c / chunks, end, compare);
+    }
+
+    // every chunk finds and extends its runs concurrently
+    std::vector<std::vector<RandomAccessIterator> > chunk_runs(chunks);
+    {
+        util::task_group group;
+        for (size_t c = 0; c < chunks; ++c)
+        {
+            pool.spawn(group, [=, &chunk_runs, &edges]()
+            {
+                RandomAccessIterator run = edges[c], run_last = edges[c + 1];
+                while (run < run_last)
+                {
+                    run = tim_sort_create_run(run, run_last, compare);
+                    chunk_runs[c].push_back(run);
+                }
+            });
+        }
+        pool.wait(group);
+    }
+
+    // a run edge that is already in order is dropped, which also stitches the runs crossing chunk edges
+    std::vector<RandomAccessIterator> runs(1, beg);
+    for (size_t c = 0; c < chunks; ++c)
+    {
+        for (size_t i = 0; i < chunk_runs[c].size(); ++i)
+        {
+            if (runs.size() > 1 && !compare(*runs.back(), *(runs.back() - 1)))
+                runs.back() = chunk_runs[c][i];
+            else
+                runs.push_back(chunk_runs[c][i]);
+        }
+    }
+
+    parallel_tim_sort_merge_tree<safecopy>(pool, buf, beg, &runs[0], &runs.back(), compare);
+}
+#endif
+
+// stable sort
+template <bool safecopy, class RandomAccessIterator, class Comp>
+void parallel_tim_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, unsigned threads)
+{
+#ifdef BAO_SORT_LIB_PARALLEL
+    if (end - beg > parallel_merge_task_threshold && (threads = util::task_pool::thread_count(threads)) > 1)
+    {
+        typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+        size_t len = (size_t)(end - beg);
+        value_type* buf = safecopy ? safe_buffer_alloc<value_type>(beg, len)
+            : (value_type*)malloc(len * sizeof(value_type));
+        parallel_tim_sort_buffer<safecopy>(buf, beg, end, compare, threads);
+        if (safecopy)
+            safe_buffer_free(buf, len);
+        else
+            free(buf);
+        return;
+    }
+#else
+    (void)threads;
+#endif
+    tim_sort_buffer<safecopy, timsort_policy>(beg, end, (size_t)(end - beg), compare);
+}
+
+template<class RandomAccessIterator>
+struct indirect_sort_iter_warp
+{
+    size_t index;
+    RandomAccessIterator it;
+    indirect_sort_iter_warp()
+    { }
+};
+
+template<class RandomAccessIterator, class Comp>
+struct indirect_sort_comp_warp
+{
+    Comp compare;
+    indirect_sort_comp_warp(Comp _compare)
+        : compare(_compare)
+    { }
+    indirect_sort_comp_warp(const indirect_sort_comp_warp& comp_warp)
+        : compare(comp_warp.compare)
+    { }
+    bool operator ()(const indirect_sort_iter_warp<RandomAccessIterator>& a, const indirect_sort_iter_warp<RandomAccessIterator>& b) const
+    {
+        if (compare(*a.it, *b.it))
+        {
+            return true;
+        }
+        else if (compare(*b.it, *a.it))
+        {
+            return false;
+        }
+        else
+        {
+            return a.index < b.index;
+        }
+    }
+};
+
+// stable sort, less swap method, works fine for fat class and small size of array
+template <class RandomAccessIterator, class Comp>
+void indirect_qsort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    if (end - beg > 1)
+    {
+        size_t size = (size_t)(end - beg);
+        size_t bytes = size * sizeof(indirect_sort_iter_warp<RandomAccessIterator>);
+        indirect_sort_iter_warp<RandomAccessIterator>* ptr = (indirect_sort_iter_warp<RandomAccessIterator>*)scratch_alloc(bytes), *ptr_beg = ptr, *ptr_end = ptr + size;
+        for (size_t i = 0; i < size; ++i)
+        {
+            ptr[i].it = beg + i;
+            ptr[i].index = i;
+        }
+        internal::quick_sort<false>(ptr_beg, ptr_end, indirect_sort_comp_warp<RandomAccessIterator, Comp>(compare));
+        for (size_t i = 0; i < size; ++i)
+        {
+            ptr[i].index = ptr[i].it - beg;
+        }
+
+        for (size_t index = 0; index < size; ++index)
+        {
+            if (ptr[index].index)
+            {
+                size_t i = index;
+                typename std::iterator_traits<RandomAccessIterator>::value_type v = BAO_MOVE(*ptr[i].it);
+                for (; ptr[i].index > index;)
+                {
+                    size_t j = ptr[i].index;
+                    *ptr[i].it = BAO_MOVE(*ptr[j].it);
+                    ptr[i].index = 0;
+                    i = j;
+                }
+                *ptr[i].it = BAO_MOVE(v);
+                ptr[i].index = 0;
+            }
+        }
+        scratch_free(ptr, bytes);
+    }
+}
+
+template <class RandomAccessIterator, class RadixIndexFunc, class Comp>
+void radix_sort_msd_in_place(RandomAccessIterator beg, RandomAccessIterator end, RadixIndexFunc get_index, uint32_t offset, Comp compare)
+{
+    if (end - beg < qsort_insertion_sort_threshold)
+    {
+        internal::q_insert_sort(beg, end, compare);
+        return;
+    }
+    uint32_t counter[256] = { 0 }, not_empty_count = 0;
+    RandomAccessIterator _split_iter[257], *split_iter = &_split_iter[1];
+    for (RandomAccessIterator i = beg; i < end; ++i)
+    {
+        uint32_t index = (get_index(*i) >> offset) & 0xff;
+        counter[index]++;
+    }
+    _split_iter[0] = beg;
+    for (size_t i = 0; i < 256; ++i)
+    {
+        not_empty_count += counter[i] > 0;
+        split_iter[i] = split_iter[i - 1] + counter[i];
+    }
+    if (not_empty_count > 1)
+    {
+        RandomAccessIterator sort_iter[256];
+        memcpy(sort_iter, _split_iter, sizeof(sort_iter));
+        for (size_t i = 0; i < 256; ++i)
+        {
+            if (split_iter[i] - split_iter[i - 1] > 0)
+            {
+                for (RandomAccessIterator start_i = sort_iter[i]; start_i < split_iter[i]; ++start_i)
+                {
+                    if (start_i < sort_iter[i]) start_i = sort_iter[i];
+
+                    RandomAccessIterator cur = start_i;
+                    while (true)
+                    {
+                        uint32_t index = (get_index(*cur) >> offset) & 0xff;
+                        if (i == index)
+                        {
+                            sort_iter[index]++;
+                            break;
+                        }
+
+                        std::swap(*cur, *sort_iter[index]);
+                        sort_iter[index]++;
+                    }
+                }
+                if (split_iter[i] - split_iter[i - 1] > 1)
+                {
+                    if (offset >= 8)
+                    {
+                        radix_sort_msd_in_place(split_iter[i - 1], split_iter[i], get_index, offset - 8, compare);
+                    }
+                    else
+                    {
+                        internal::quick_sort<false>(split_iter[i - 1], split_iter[i], compare);
+                    }
+                }
+            }
+        }
+    }
+    else
+    {
+        if (offset >= 8)
+        {
+            radix_sort_msd_in_place(beg, end, get_index, offset - 8, compare);
+        }
+        else
+        {
+            internal::quick_sort<false>(beg, end, compare);
+        }
+    }
+}
+
+template <class RadixIndexValue>
+uint32_t radix_get_max_offset(RadixIndexValue index)
+{
+    uint32_t offset = 0;
+    for (; index >= 256; index >>= 8)
+    {
+        offset += 8;
+    }
+    return offset;
+}
+
+template <class RandomAccessIterator, class RadixIndexFunc>
+uint32_t radix_get_max_offset(RandomAccessIterator beg, RandomAccessIterator end, RadixIndexFunc get_index)
+{
+    uint32_t max_offset = 0;
+    for (RandomAccessIterator i = beg; i < end; ++i)
+    {
+        uint32_t offset = radix_get_max_offset(get_index(*i));
+        if (max_offset < offset)
+            max_offset = offset;
+    }
+    return max_offset;
+}
+
+template <class RandomAccessIterator, class RadixIndexFunc, class Comp>
+void radix_sort_msd_in_place(RandomAccessIterator beg, RandomAccessIterator end, RadixIndexFunc get_index, Comp compare)
+{
+    radix_sort_msd_in_place(beg, end, get_index, radix_get_max_offset(beg, end, get_index), compare);
+}
+
+// one byte of the index is one bucket, for the block partition of samplesort
+template <class RadixIndexFunc>
+struct radix_classifier
+{
+    mutable RadixIndexFunc get_index;
+    uint32_t offset;
+
+    radix_classifier(RadixIndexFunc _get_index, uint32_t _offset)
+        : get_index(_get_index)
+        , offset(_offset)
+    {
+    }
+
+    size_t bucket_count() const
+    {
+        return 256;
+    }
+
+    template <class T>
+    size_t bucket(const T& v) const
+    {
+        return (size_t)((get_index(v) >> offset) & 0xff);
+    }
+
+    template <class RandomAccessIterator>
+    void classify(RandomAccessIterator it, size_t* index, size_t count) const
+    {
+        for (size_t u = 0; u < count; ++u)
+            index[u] = bucket(*(it + u));
+    }
+};
+
+#ifdef BAO_SORT_LIB_PARALLEL
+// the digit is partitioned by all threads with per-thread histograms and block permutation,
+// buckets still too big for one thread go on to the next digit in parallel, the others become tasks
+template <class RandomAccessIterator, class RadixIndexFunc, class Comp>
+void parallel_radix_sort_msd_loop(util::task_pool& pool, util::task_group& group,
+    std::vector<samplesort_buffers<typename std::iterator_traits<RandomAccessIterator>::value_type> >& stripe_buffers,
+    RandomAccessIterator beg, RandomAccessIterator end, RadixIndexFunc get_index, uint32_t offset, Comp compare)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    typedef radix_classifier<RadixIndexFunc> classifier_type;
+    size_t len = end - beg, block = samplesort_block_size<value_type>(), stripes = pool.size();
+    classifier_type cls(get_index, offset);
+    for (size_t t = 0; t < stripes; ++t)
+        stripe_buffers[t].init(*beg, block, t == 0);
+
+    samplesort_partition<RandomAccessIterator, classifier_type> part(beg, len, block, cls, &stripe_buffers[0], stripes);
+    part.run(pool);
+
+    size_t big = std::max(len / stripes, (size_t)parallel_samplesort_stripe_threshold);
+    std::vector<size_t> big_buckets, batch;
+    size_t batch_len = 0;
+    for (size_t b = 0; b < part.buckets; ++b)
+    {
+        size_t first = part.bucket_beg[b], last = part.bucket_beg[b + 1];
+        if (last - first > 1)
+        {
+            if (last - first > big)
+            {
+                big_buckets.push_back(first);
+                big_buckets.push_back(last);
+            }
+            else
+            {
+                batch.push_back(first);
+                batch.push_back(last);
+                batch_len += last - first;
+            }
+        }
+        if (!batch.empty() && (batch_len >= (size_t)parallel_samplesort_task_threshold || b + 1 == part.buckets))
+        {
+            pool.spawn(group, [beg, batch, get_index, offset, compare]()
+            {
+                for (size_t i = 0; i < batch.size(); i += 2)
+                {
+                    if (offset >= 8)
+                        radix_sort_msd_in_place(beg + batch[i], beg + batch[i + 1], get_index, offset - 8, compare);
+                    else
+                        internal::quick_sort<false>(beg + batch[i], beg + batch[i + 1], compare);
+                }
+            });
+            batch.clear();
+            batch_len = 0;
+        }
+    }
+    for (size_t i = 0; i < big_buckets.size(); i += 2)
+    {
+        RandomAccessIterator first = beg + big_buckets[i], last = beg + big_buckets[i + 1];
+        if (offset >= 8)
+        {
+            parallel_radix_sort_msd_loop(pool, group, stripe_buffers, first, last, get_index, offset - 8, compare);
+        }
+        else
+        {
+            double deep = log((double)(last - first)) / log(1.5);
+            parallel_quick_sort_loop<false>(pool, group, first, last, (int)deep, compare, true);
+        }
+    }
+}
+#endif
+
+template <class RandomAccessIterator, class RadixIndexFunc, class Comp>
+void parallel_radix_sort_msd_in_place(RandomAccessIterator beg, RandomAccessIterator end, RadixIndexFunc get_index, Comp compare, unsigned threads)
+{
+#ifdef BAO_SORT_LIB_PARALLEL
+    if (end - beg > parallel_samplesort_stripe_threshold && (threads = util::task_pool::thread_count(threads)) > 1)
+    {
+        typedef samplesort_buffers<typename std::iterator_traits<RandomAccessIterator>::value_type> buffers_type;
+        util::task_pool pool(threads);
+        util::task_group group;
+        size_t len = end - beg, stripes = pool.size();
+        std::vector<uint32_t> offsets(stripes, 0);
+        for (size_t t = 0; t < stripes; ++t)
+        {
+            RandomAccessIterator first = beg + len * t / stripes, last = beg + len * (t + 1) / stripes;
+            pool.spawn(group, [&offsets, t, first, last, get_index]()
+            {
+                offsets[t] = radix_get_max_offset(first, last, get_index);
+            });
+        }
+        pool.wait(group);
+
+        std::vector<buffers_type> stripe_buffers(stripes);
+        uint32_t max_offset = *std::max_element(offsets.begin(), offsets.end());
+        parallel_radix_sort_msd_loop(pool, group, stripe_buffers, beg, end, get_index, max_offset, compare);
+        pool.wait(group);
+        return;
+    }
+#else
+    (void)threads;
+#endif
+    radix_sort_msd_in_place(beg, end, get_index, compare);
+}
+
+template <bool safecopy, class T>
+inline void radix_lsd_put(T& dst, const T& src)
+{
+    if (safecopy)
+        dst = src;
+    else
+        memcpy((void*)&dst, (const void*)&src, sizeof(T));
+}
+
+// stable LSD radix sort, the range is cut into stripes with their own histograms,
+// every stripe scatters its elements in order so equal digits keep their order
+template <bool safecopy, class RandomAccessIterator, class RadixIndexFunc>
+struct radix_lsd_sorter
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+
+    RandomAccessIterator beg;
+    value_type* buf;
+    RadixIndexFunc get_index;
+    size_t len;
+    size_t stripes;
+    size_t digits;
+    size_t radix;
+    uint32_t digit_bits;
+    uint32_t shift;
+    bool in_buf;
+    std::vector<size_t> stripe_beg;
+    std::vector<size_t> counter; // stripes * digits * radix
+#ifdef BAO_SORT_LIB_PARALLEL
+    util::task_pool* pool;
+#endif
+
+    radix_lsd_sorter(RandomAccessIterator _beg, size_t _len, RadixIndexFunc _get_index, size_t _stripes)
+        : beg(_beg)
+        , buf(NULL)
+        , get_index(_get_index)
+        , len(_len)
+        , stripes(_stripes)
+        , shift(0)
+        , in_buf(false)
+        , stripe_beg(_stripes + 1, _len)
+#ifdef BAO_SORT_LIB_PARALLEL
+        , pool(NULL)
+#endif
+    {
+        uint32_t key_bits = (uint32_t)(8 * sizeof(get_index(*beg)));
+        digit_bits = len < (size_t)radixsort_lsd_wide_digit_threshold ? 8 : 11;
+        digits = (key_bits + digit_bits - 1) / digit_bits;
+        radix = (size_t)1 << digit_bits;
+        counter.assign(stripes * digits * radix, 0);
+        for (size_t t = 0; t < stripes; ++t)
+            stripe_beg[t] = len * t / stripes;
+    }
+
+    size_t* stripe_counter(size_t t, size_t d)
+    {
+        return &counter[(t * digits + d) * radix];
+    }
+
+    // the index keeps the functor's own type until the digit is cut out,
+    // a size_t would drop the high half of 64-bit keys on 32-bit targets
+    template <class Index>
+    static size_t digit_of(Index index, uint32_t shift, size_t mask)
+    {
+        return (size_t)(index >> shift) & mask;
+    }
+
+    template <class Index>
+    void count_index(size_t t, Index index)
+    {
+        size_t mask = radix - 1;
+        for (size_t d = 0; d < digits; ++d)
+        {
+            ++stripe_counter(t, d)[digit_of(index, (uint32_t)(d * digit_bits), mask)];
+        }
+    }
+
+    // all digits are counted in one pass, the first scatter uses them as they are
+    void count_all(size_t t)
+    {
+        for (RandomAccessIterator i = beg + stripe_beg[t], last = beg + stripe_beg[t + 1]; i < last; ++i)
+        {
+            count_index(t, get_index(*i));
+        }
+    }
+
+    template <class Iterator>
+    void count_digit(Iterator src, size_t t)
+    {
+        size_t* count = stripe_counter(t, 0), mask = radix - 1;
+        std::fill(count, count + radix, (size_t)0);
+        for (Iterator i = src + stripe_beg[t], last = src + stripe_beg[t + 1]; i < last; ++i)
+        {
+            ++count[digit_of(get_index(*i), shift, mask)];
+        }
+    }
+
+    void count_digit(size_t t)
+    {
+        if (in_buf)
+            count_digit(buf, t);
+        else
+            count_digit(beg, t);
+    }
+
+    // the counters of stripe t become its first write position of every bucket
+    void scan()
+    {
+        size_t pos = 0;
+        for (size_t b = 0; b < radix; ++b)
+        {
+            for (size_t t = 0; t < stripes; ++t)
+            {
+                size_t* count = stripe_counter(t, 0);
+                size_t n = count[b];
+                count[b] = pos;
+                pos += n;
+            }
+        }
+    }
+
+    template <class Iterator1, class Iterator2>
+    void scatter(Iterator1 src, Iterator2 dst, size_t t)
+    {
+        size_t* offset = stripe_counter(t, 0), mask = radix - 1;
+        for (Iterator1 i = src + stripe_beg[t], last = src + stripe_beg[t + 1]; i < last; ++i)
+        {
+            radix_lsd_put<safecopy>(*(dst + offset[digit_of(get_index(*i), shift, mask)]++), *i);
+        }
+    }
+
+    void scatter(size_t t)
+    {
+        if (in_buf)
+            scatter(buf, beg, t);
+        else
+            scatter(beg, buf, t);
+    }
+
+    void copy_back(size_t t)
+    {
+        for (size_t i = stripe_beg[t]; i < stripe_beg[t + 1]; ++i)
+            radix_lsd_put<safecopy>(*(beg + i), buf[i]);
+    }
+
+    void for_stripes(void (radix_lsd_sorter::*step)(size_t))
+    {
+#ifdef BAO_SORT_LIB_PARALLEL
+        if (pool)
+        {
+            util::task_group group;
+            for (size_t t = 0; t < stripes; ++t)
+                pool->spawn(group, [this, step, t]() { (this->*step)(t); });
+            pool->wait(group);
+            return;
+        }
+#endif
+        for (size_t t = 0; t < stripes; ++t)
+            (this->*step)(t);
+    }
+
+    void run()
+    {
+        for_stripes(&radix_lsd_sorter::count_all);
+
+        // a digit with a single bucket in use would only copy every element
+        std::vector<size_t> passes;
+        for (size_t d = 0; d < digits; ++d)
+        {
+            bool constant = false;
+            for (size_t b = 0; b < radix && !constant; ++b)
+            {
+                size_t total = 0;
+                for (size_t t = 0; t < stripes; ++t)
+                    total += stripe_counter(t, d)[b];
+                constant = total == len;
+            }
+            if (!constant)
+                passes.push_back(d);
+        }
+        if (passes.empty())
+            return;
+
+        buf = safecopy ? safe_buffer_alloc<value_type>(beg, len) : (value_type*)malloc(len * sizeof(value_type));
+        for (size_t p = 0; p < passes.size(); ++p)
+        {
+            shift = (uint32_t)(passes[p] * digit_bits);
+            if (p == 0)
+            {
+                // the first pass reads the input the counters came from, they only need moving to slot 0
+                for (size_t t = 0; t < stripes && passes[p] > 0; ++t)
+                    std::copy(stripe_counter(t, passes[p]), stripe_counter(t, passes[p]) + radix, stripe_counter(t, 0));
+            }
+            else
+            {
+                for_stripes(&radix_lsd_sorter::count_digit);
+            }
+            scan();
+            for_stripes(&radix_lsd_sorter::scatter);
+            in_buf = !in_buf;
+        }
+        if (in_buf)
+        {
+            for_stripes(&radix_lsd_sorter::copy_back);
+        }
+        if (safecopy)
+            safe_buffer_free(buf, len);
+        else
+            free(buf);
+    }
+};
+
+template <bool safecopy, class RandomAccessIterator, class RadixIndexFunc>
+void radix_sort_lsd(RandomAccessIterator beg, RandomAccessIterator end, RadixIndexFunc get_index, unsigned threads)
+{
+    if (end - beg < 2)
+        return;
+#ifdef BAO_SORT_LIB_PARALLEL
+    if (end - beg > parallel_radix_lsd_threshold && (threads = util::task_pool::thread_count(threads)) > 1)
+    {
+        util::task_pool pool(threads);
+        radix_lsd_sorter<safecopy, RandomAccessIterator, RadixIndexFunc> sorter(beg, end - beg, get_index, pool.size());
+        sorter.pool = &pool;
+        sorter.run();
+        return;
+    }
+#else
+    (void)threads;
+#endif
+    radix_lsd_sorter<safecopy, RandomAccessIterator, RadixIndexFunc> sorter(beg, end - beg, get_index, 1);
+    sorter.run();
+}
+
+template<class T, class IndexType>
+struct radix_get_index
+{
+    IndexType operator()(const T& v)
+    {
+        return v.get_index();
+    }
+};
+
+template<class IndexType>
+struct radix_get_index<int, IndexType>
+{
+    uint32_t operator()(const int& v)
+    {
+        return (uint32_t)v + (1U << 31);
+    }
+};
+
+template<class IndexType>
+struct radix_get_index<unsigned, IndexType>
+{
+    uint32_t operator()(const unsigned& v)
+    {
+        return v;
+    }
+};
+
+#if __cplusplus >= 201103L || _MSC_VER >= 1600
+template<class IndexType>
+struct radix_get_index<int64_t, IndexType>
+{
+    uint64_t operator()(const int64_t& v)
+    {
+        return (uint64_t)v + (1ULL << 63);
+    }
+};
+
+template<class IndexType>
+struct radix_get_index<uint64_t, IndexType>
+{
+    uint64_t operator()(const uint64_t& v)
+    {
+        return v;
+    }
+};
+#endif
+
+// radix and counting sort order the keys by radix_get_index, so they only stand in for std::less
+template <class T, class Comp>
+struct auto_sort_keyed
+    : util::value_constant<bool, false>
+{
+};
+
+template <>
+struct auto_sort_keyed<int, std::less<int> >
+    : util::value_constant<bool, true>
+{
+};
+
+template <>
+struct auto_sort_keyed<unsigned, std::less<unsigned> >
+    : util::value_constant<bool, true>
+{
+};
+
+#if __cplusplus >= 201103L || _MSC_VER >= 1600
+template <>
+struct auto_sort_keyed<int64_t, std::less<int64_t> >
+    : util::value_constant<bool, true>
+{
+};
+
+template <>
+struct auto_sort_keyed<uint64_t, std::less<uint64_t> >
+    : util::value_constant<bool, true>
+{
+};
+#endif
+
+struct auto_sort_decision
+{
+    enum engine_type
+    {
+        tim_sort,
+        quick_sort,
+        radix_sort,
+        counting_sort
+    };
+
+    engine_type engine;
+    size_t sample;          // sampled elements, 0 if the range was too short to sample
+    size_t runs;            // ascending or descending runs in the sample windows
+    double disorder;        // inversions left in the windows after reversing the runs, random is 1
+    double window_order;    // part of the neighbouring windows which are in order
+    double distinct;        // distinct keys / sample
+    double key_range;       // max - min + 1 of the integer keys, 0 for other keys
+
+    auto_sort_decision()
+        : engine(quick_sort)
+        , sample(0)
+        , runs(0)
+        , disorder(1)
+        , window_order(0)
+        , distinct(1)
+        , key_range(0)
+    {
+    }
+
+    const char* name() const
+    {
+        static const char* names[] = { "tim_sort", "quick_sort", "radix_sort", "counting_sort" };
+        return names[engine];
     }
-    return offset;
+};
+
+template <class Comp>
+struct auto_sort_reverse_comp
+{
+    Comp compare;
+
+    auto_sort_reverse_comp(Comp _compare)
+        : compare(_compare)
+    {
+    }
+
+    template <class T>
+    bool operator()(const T& a, const T& b) const
+    {
+        return compare(b, a);
+    }
+};
+
+// reverses the runs against compare like timsort does, then insert sorts the window,
+// returns the element moves which are the inversions left
+template <class RandomAccessIterator, class Comp>
+size_t auto_sort_window_disorder(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, size_t& runs)
+{
+    for (RandomAccessIterator i = beg; i < end; ++runs)
+    {
+        RandomAccessIterator j = i + 1;
+        if (j < end && compare(*j, *i))
+        {
+            while (++j < end && compare(*j, *(j - 1)))
+                ;
+            std::reverse(i, j);
+        }
+        else
+        {
+            while (j < end && !compare(*j, *(j - 1)))
+                ++j;
+        }
+        i = j;
+    }
+    size_t moves = 0;
+    for (RandomAccessIterator i = beg + 1; i < end; ++i)
+    {
+        typename std::iterator_traits<RandomAccessIterator>::value_type val = BAO_MOVE(*i);
+        RandomAccessIterator j = i;
+        for (; j != beg && compare(val, *(j - 1)); --j, ++moves)
+        {
+            *j = BAO_MOVE(*(j - 1));
+        }
+        *j = BAO_MOVE(val);
+    }
+    return moves;
 }
 
-template <class RandomAccessIterator, class RadixIndexFunc, class Comp>
-void radix_sort_msd_in_place(RandomAccessIterator beg, RandomAccessIterator end, RadixIndexFunc get_index, Comp compare)
+// the key range and the engines which need integer keys
+template <bool keyed>
+struct auto_sort_keys
+{
+    template <class RandomAccessIterator>
+    static double range(RandomAccessIterator, RandomAccessIterator)
+    {
+        return 0;
+    }
+
+    template <class RandomAccessIterator, class Comp>
+    static bool counting_sort(RandomAccessIterator, RandomAccessIterator, Comp)
+    {
+        return false;
+    }
+
+    template <class RandomAccessIterator, class Comp>
+    static void radix_sort(RandomAccessIterator, RandomAccessIterator, Comp)
+    {
+    }
+};
+
+template <>
+struct auto_sort_keys<true>
+{
+    template <class RandomAccessIterator>
+    static double range(RandomAccessIterator min, RandomAccessIterator max)
+    {
+        radix_get_index<typename std::iterator_traits<RandomAccessIterator>::value_type, uint32_t> get_index;
+        return (double)(get_index(*max) - get_index(*min)) + 1;
+    }
+
+    // needs the exact min and max, gives up if the keys span more than the range length
+    template <class RandomAccessIterator, class Comp>
+    static bool counting_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp)
+    {
+        typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+        value_type min = *beg, max = *beg;
+        for (RandomAccessIterator i = beg + 1; i < end; ++i)
+        {
+            if (*i < min)
+                min = *i;
+            else if (max < *i)
+                max = *i;
+        }
+        if (range(&min, &max) > (double)(end - beg))
+        {
+            return false;
+        }
+        radix_get_index<value_type, uint32_t> get_index;
+        std::vector<size_t> count((size_t)range(&min, &max), 0);
+        for (RandomAccessIterator i = beg; i < end; ++i)
+        {
+            ++count[(size_t)(get_index(*i) - get_index(min))];
+        }
+        RandomAccessIterator out = beg;
+        for (size_t k = 0; k < count.size(); ++k)
+        {
+            for (size_t c = count[k]; c > 0; --c)
+            {
+                *out++ = (value_type)(min + (value_type)k);
+            }
+        }
+        return true;
+    }
+
+    template <class RandomAccessIterator, class Comp>
+    static void radix_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+    {
+        radix_sort_msd_in_place(beg, end, radix_get_index<typename std::iterator_traits<RandomAccessIterator>::value_type, uint32_t>(), compare);
+    }
+};
+
+// samples windows spread over the range: presorted runs go to timsort,
+// integer keys to counting sort when the range is narrow, otherwise radix sort unless quick_sort has the SIMD partition
+template <class RandomAccessIterator, class Comp>
+auto_sort_decision auto_sort_plan(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    typedef typename std::vector<value_type>::iterator sample_iterator;
+    const bool keyed = auto_sort_keyed<value_type, Comp>::value;
+    auto_sort_decision decision;
+    size_t n = end - beg, w = auto_sort_sample_window;
+    if (n < (size_t)auto_sort_sample_threshold)
+    {
+        return decision;
+    }
+
+    size_t windows = auto_sort_sample_windows;
+    std::vector<value_type> sample(beg, beg + windows * w), reverse_sample;
+    size_t inversions[2] = { 0, 0 }, ordered[2] = { 0, 0 }, runs[2] = { 0, 0 };
+    for (size_t k = 0; k < windows; ++k)
+    {
+        RandomAccessIterator it = beg + (n - w) / (windows - 1) * k;
+        sample_iterator b = sample.begin() + k * w, e = b + w;
+        std::copy(it, it + w, b);
+        reverse_sample.assign(b, e);
+        inversions[0] += auto_sort_window_disorder(b, e, compare, runs[0]);
+        inversions[1] += auto_sort_window_disorder(reverse_sample.begin(), reverse_sample.end(), auto_sort_reverse_comp<Comp>(compare), runs[1]);
+        if (k > 0)
+        {
+            ordered[0] += !compare(*b, *(b - 1));
+            ordered[1] += !compare(*(b - w), *(e - 1));
+        }
+    }
+
+    // a descending run reverses to no inversions either way, the window order tells the direction
+    int dir = inversions[1] < inversions[0] || (inversions[1] == inversions[0] && ordered[1] > ordered[0]);
+    decision.sample = sample.size();
+    decision.runs = runs[dir];
+    decision.disorder = (double)inversions[dir] / ((double)windows * w * (w - 1) / 4);
+    decision.window_order = (double)ordered[dir] / (windows - 1);
+
+    quick_sort<false>(sample.begin(), sample.end(), compare);
+    size_t distinct = 1;
+    for (sample_iterator i = sample.begin() + 1; i < sample.end(); ++i)
+    {
+        distinct += compare(*(i - 1), *i);
+    }
+    decision.distinct = (double)distinct / sample.size();
+    decision.key_range = auto_sort_keys<keyed>::range(sample.begin(), sample.end() - 1);
+
+    if (decision.disorder < 0.125 && decision.window_order >= 0.75)
+    {
+        decision.engine = auto_sort_decision::tim_sort;
+    }
+    else if (keyed && decision.key_range <= (double)n)
+    {
+        decision.engine = auto_sort_decision::counting_sort;
+    }
+    else if (keyed && !simd_partition_enabled<RandomAccessIterator, Comp>::value)
+    {
+        decision.engine = auto_sort_decision::radix_sort;
+    }
+    return decision;
+}
+
+template <class RandomAccessIterator, class Comp>
+auto_sort_decision auto_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    const bool keyed = auto_sort_keyed<value_type, Comp>::value;
+    auto_sort_decision decision = auto_sort_plan(beg, end, compare);
+    switch (decision.engine)
+    {
+    case auto_sort_decision::tim_sort:
+        // the memcpy merges are only valid on the keyed scalars and other trivially copyable types
+        tim_sort_buffer<!(keyed || util::is_trivially_copyable<value_type>::value), timsort_policy>(beg, end, (size_t)(end - beg), compare);
+        return decision;
+    case auto_sort_decision::counting_sort:
+        if (auto_sort_keys<keyed>::counting_sort(beg, end, compare))
+            return decision;
+        // the sample missed the keys out of the range
+        decision.engine = simd_partition_enabled<RandomAccessIterator, Comp>::value ? auto_sort_decision::quick_sort : auto_sort_decision::radix_sort;
+        break;
+    default:
+        break;
+    }
+    if (decision.engine == auto_sort_decision::radix_sort)
+        auto_sort_keys<keyed>::radix_sort(beg, end, compare);
+    else
+        quick_sort<false>(beg, end, compare);
+    return decision;
+}
+
+} // namespace internal
+
+namespace sort
+{
+
+template <class RandomAccessIterator, class Comp>
+void insert_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    internal::insert_sort(beg, end, compare);
+}
+
+// stable sort
+template <class RandomAccessIterator>
+void insert_sort(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    insert_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
+template <class RandomAccessIterator, class Comp>
+void shell_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    internal::shell_sort(beg, end, compare);
+}
+
+template <class RandomAccessIterator>
+void shell_sort(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    shell_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
+template <class RandomAccessIterator, class Comp>
+void heap_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+#if defined(_MSC_VER)
+    internal::heap_sort_1(beg, end, compare);
+#else
+    internal::heap_sort_p(beg, end, compare);
+#endif
+}
+
+template <class RandomAccessIterator>
+void heap_sort(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    heap_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
+// stable sort
+template <class RandomAccessIterator, class Comp>
+void merge_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    if (end - beg > 1)
+    {
+        typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+        size_t bytes = (end - beg) / 2 * sizeof(value_type);
+        value_type * buf = (value_type*)internal::scratch_alloc(bytes);
+        internal::merge_sort_recursive<false>(buf, beg, end, compare);
+        internal::scratch_free(buf, bytes);
+    }
+}
+
+// stable sort
+template <class RandomAccessIterator, class Comp>
+void merge_sort_s(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    if (end - beg > 1)
+    {
+        typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+        size_t len = (end - beg) / 2;
+        value_type * buf = internal::safe_buffer_alloc<value_type>(beg, len);
+        internal::merge_sort_recursive<true>(buf, beg, end, compare);
+        internal::safe_buffer_free(buf, len);
+    }
+}
+
+// stable sort
+template <class RandomAccessIterator>
+void merge_sort(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    merge_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
+// stable sort
+template <class RandomAccessIterator>
+void merge_sort_s(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    merge_sort_s(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
+// stable sort, uses a buffer of the full length and moves the data once per level
+template <class RandomAccessIterator, class Comp>
+void merge_sort_ping_pong(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    if (end - beg > 1)
+    {
+        internal::merge_sort_ping_pong_sorted<false>(beg, end, compare);
+    }
+}
+
+// stable sort
+template <class RandomAccessIterator, class Comp>
+void merge_sort_ping_pong_s(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    if (end - beg > 1)
+    {
+        internal::merge_sort_ping_pong_sorted<true>(beg, end, compare);
+    }
+}
+
+// stable sort
+template <class RandomAccessIterator>
+void merge_sort_ping_pong(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    merge_sort_ping_pong(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
+// stable sort
+template <class RandomAccessIterator>
+void merge_sort_ping_pong_s(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    merge_sort_ping_pong_s(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
+// stable, merges the sorted ranges [ranges[i].first, ranges[i].second) for i < k into out in one pass,
+// equal keys keep the order of the ranges, returns the end of the output
+template <class RangeIterator, class OutputIterator, class Comp>
+OutputIterator merge_ranges(RangeIterator ranges, size_t k, OutputIterator out, Comp compare)
+{
+    typedef typename std::iterator_traits<RangeIterator>::value_type::first_type iterator;
+    std::vector<iterator> cur(k + 1), last(k + 1);
+    for (size_t i = 0; i < k; ++i, ++ranges)
+    {
+        cur[i] = (*ranges).first;
+        last[i] = (*ranges).second;
+    }
+    return internal::merge_loser_tree(&cur[0], &last[0], k, out, compare);
+}
+
+// stable
+template <class RangeIterator, class OutputIterator>
+OutputIterator merge_ranges(RangeIterator ranges, size_t k, OutputIterator out)
+{
+    typedef typename std::iterator_traits<RangeIterator>::value_type::first_type iterator;
+    return merge_ranges(ranges, k, out, std::less<typename std::iterator_traits<iterator>::value_type>());
+}
+
+// stable, merge_ranges on threads for random access ranges and out, 0 means all hardware threads,
+// the output is cut into equal slices by multi-sequence selection, one per thread
+template <class RangeIterator, class RandomAccessIterator, class Comp>
+RandomAccessIterator parallel_merge_ranges(RangeIterator ranges, size_t k, RandomAccessIterator out, Comp compare, unsigned threads)
+{
+#ifdef BAO_SORT_LIB_PARALLEL
+    typedef typename std::iterator_traits<RangeIterator>::value_type::first_type iterator;
+    std::vector<iterator> first(k + 1);
+    std::vector<size_t> len(k + 1);
+    size_t total = 0;
+    RangeIterator range = ranges;
+    for (size_t i = 0; i < k; ++i, ++range)
+    {
+        first[i] = (*range).first;
+        len[i] = (*range).second - (*range).first;
+        total += len[i];
+    }
+    if (total > parallel_merge_task_threshold && (threads = util::task_pool::thread_count(threads)) > 1)
+    {
+        internal::parallel_merge_ranges(&first[0], &len[0], k, out, compare, threads);
+        return out + total;
+    }
+#else
+    (void)threads;
+#endif
+    return merge_ranges(ranges, k, out, compare);
+}
+
+// stable
+template <class RangeIterator, class RandomAccessIterator, class Comp>
+RandomAccessIterator parallel_merge_ranges(RangeIterator ranges, size_t k, RandomAccessIterator out, Comp compare)
+{
+    return parallel_merge_ranges(ranges, k, out, compare, 0);
+}
+
+// stable
+template <class RangeIterator, class RandomAccessIterator>
+RandomAccessIterator parallel_merge_ranges(RangeIterator ranges, size_t k, RandomAccessIterator out)
+{
+    typedef typename std::iterator_traits<RangeIterator>::value_type::first_type iterator;
+    return parallel_merge_ranges(ranges, k, out, std::less<typename std::iterator_traits<iterator>::value_type>(), 0);
+}
+
+// stable sort
+template <class RandomAccessIterator, class Comp>
+void merge_sort_buffer(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    internal::merge_sort_with_buffer<false>(beg, end, compare, true);
+}
+
+// stable sort
+template <class RandomAccessIterator>
+void merge_sort_buffer(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    merge_sort_buffer(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
+// stable sort
+template <class RandomAccessIterator, class Comp>
+void merge_sort_buffer_s(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    internal::merge_sort_with_buffer<true>(beg, end, compare, true);
+}
+
+// stable sort
+template <class RandomAccessIterator>
+void merge_sort_buffer_s(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    merge_sort_buffer_s(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
+// the scratch in elements that lets merge_sort_buffer and tim_sort_buffer on n elements
+// merge without moving parts in place, a smaller buffer still works, down to none
+inline size_t required_buffer_size(size_t n)
+{
+    return n / 2;
+}
+
+// stable sort on the caller's buffer of bufsize raw elements, never allocates
+template <class RandomAccessIterator, class Comp, class T>
+void merge_sort_buffer(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, T* buf, size_t bufsize)
 {
-    uint32_t max_offset = 0;
-    for (RandomAccessIterator i = beg; i < end; ++i)
-    {
-        uint32_t offset = radix_get_max_offset(get_index(*i));
-        if (max_offset < offset)
-            max_offset = offset;
-    }
-    radix_sort_msd_in_place(beg, end, get_index, max_offset, compare);
+    internal::check_buffer_type<RandomAccessIterator, T>();
+    internal::merge_sort_with_buffer<false>(buf, bufsize, beg, end, compare);
 }
 
-template<class T, class IndexType>
-struct radix_get_index
+// stable sort, takes required_buffer_size(end - beg) elements from alloc, an allocator or an arena
+// with allocate(n) and deallocate(p, n)
+template <class RandomAccessIterator, class Comp, class Alloc>
+void merge_sort_buffer(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, Alloc& alloc)
 {
-    IndexType operator()(const T& v)
+    if (end - beg > 1)
     {
-        return v.get_index();
+        internal::allocator_buffer<false, Alloc, typename std::iterator_traits<RandomAccessIterator>::value_type> scratch(alloc, beg, required_buffer_size(end - beg));
+        internal::merge_sort_with_buffer<false>(scratch.buf, scratch.size, beg, end, compare);
     }
-};
+}
 
-template<class IndexType>
-struct radix_get_index<int, IndexType>
+// stable sort on the caller's buffer of bufsize constructed elements, never allocates
+template <class RandomAccessIterator, class Comp, class T>
+void merge_sort_buffer_s(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, T* buf, size_t bufsize)
 {
-    uint32_t operator()(const int& v)
-    {
-        return (uint32_t)v + (1U << 31);
-    }
-};
+    internal::check_buffer_type<RandomAccessIterator, T>();
+    internal::merge_sort_with_buffer<true>(buf, bufsize, beg, end, compare);
+}
 
-template<class IndexType>
-struct radix_get_index<unsigned, IndexType>
+// stable sort, takes required_buffer_size(end - beg) elements from alloc and constructs them
+template <class RandomAccessIterator, class Comp, class Alloc>
+void merge_sort_buffer_s(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, Alloc& alloc)
 {
-    uint32_t operator()(const unsigned& v)
+    if (end - beg > 1)
     {
-        return v;
+        internal::allocator_buffer<true, Alloc, typename std::iterator_traits<RandomAccessIterator>::value_type> scratch(alloc, beg, required_buffer_size(end - beg));
+        internal::merge_sort_with_buffer<true>(scratch.buf, scratch.size, beg, end, compare);
     }
-};
+}
 
-#if __cplusplus >= 201103L || _MSC_VER >= 1600
-template<class IndexType>
-struct radix_get_index<int64_t, IndexType>
+// stable sort
+template <class RandomAccessIterator, class Comp>
+void merge_sort_in_place(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
 {
-    uint64_t operator()(const unsigned& v)
-    {
-        return v;
-    }
-};
-#endif
+    internal::merge_sort_with_buffer<true>(beg, end, compare, false);
+}
 
-} // namespace internal
+// stable sort
+template <class RandomAccessIterator>
+void merge_sort_in_place(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    merge_sort_in_place(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
 
-namespace sort
+// stable sort, threads = 0 uses all hardware threads
+template <class RandomAccessIterator, class Comp>
+void parallel_merge_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, unsigned threads)
 {
+    internal::parallel_merge_sort<false>(beg, end, compare, threads);
+}
 
+// stable sort
 template <class RandomAccessIterator, class Comp>
-void insert_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+void parallel_merge_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
 {
-    internal::insert_sort(beg, end, compare);
+    internal::parallel_merge_sort<false>(beg, end, compare, 0);
 }
 
 // stable sort
 template <class RandomAccessIterator>
-void insert_sort(RandomAccessIterator beg, RandomAccessIterator end)
+void parallel_merge_sort(RandomAccessIterator beg, RandomAccessIterator end)
 {
-    insert_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+    parallel_merge_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
 }
 
+// stable sort
 template <class RandomAccessIterator, class Comp>
-void shell_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+void parallel_merge_sort_s(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, unsigned threads)
 {
-    internal::shell_sort(beg, end, compare);
+    internal::parallel_merge_sort<true>(beg, end, compare, threads);
+}
+
+// stable sort
+template <class RandomAccessIterator, class Comp>
+void parallel_merge_sort_s(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    internal::parallel_merge_sort<true>(beg, end, compare, 0);
 }
 
+// stable sort
 template <class RandomAccessIterator>
-void shell_sort(RandomAccessIterator beg, RandomAccessIterator end)
+void parallel_merge_sort_s(RandomAccessIterator beg, RandomAccessIterator end)
 {
-    shell_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+    parallel_merge_sort_s(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
 }
 
 template <class RandomAccessIterator, class Comp>
-void heap_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+void quick_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
 {
-#if defined(_MSC_VER)
-    internal::heap_sort_1(beg, end, compare);
-#else
-    internal::heap_sort_p(beg, end, compare);
-#endif
+    if (end - beg > 1)
+    {
+        internal::quick_sort<false>(beg, end, compare);
+    }
 }
 
 template <class RandomAccessIterator>
-void heap_sort(RandomAccessIterator beg, RandomAccessIterator end)
+void quick_sort(RandomAccessIterator beg, RandomAccessIterator end)
 {
-    heap_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+    quick_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
 }
 
-// stable sort
+// quick_sort with block partitioning, no branch depends on the compare results
 template <class RandomAccessIterator, class Comp>
-void merge_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+void quick_sort_branchless(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
 {
     if (end - beg > 1)
     {
-        typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
-        value_type * buf = (value_type*)malloc((end - beg) / 2 * sizeof(value_type));
-        internal::merge_sort_recursive<false>(buf, beg, end, compare);
-        free(buf);
+        internal::quick_sort<true>(beg, end, compare);
     }
 }
 
-// stable sort
+template <class RandomAccessIterator>
+void quick_sort_branchless(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    quick_sort_branchless(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
+// quick_sort with an O(n log n) worst case, which does not depend on random pivots
 template <class RandomAccessIterator, class Comp>
-void merge_sort_s(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+void pdq_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
 {
     if (end - beg > 1)
     {
-        typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
-        value_type * buf = new value_type[(end - beg) / 2];
-        internal::merge_sort_recursive<true>(buf, beg, end, compare);
-        delete[] buf;
+        internal::pdq_sort(beg, end, compare);
     }
 }
 
-// stable sort
 template <class RandomAccessIterator>
-void merge_sort(RandomAccessIterator beg, RandomAccessIterator end)
+void pdq_sort(RandomAccessIterator beg, RandomAccessIterator end)
 {
-    merge_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+    pdq_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
+// threads = 0 uses all hardware threads, sequential if built without C++11
+template <class RandomAccessIterator, class Comp>
+void parallel_quick_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, unsigned threads)
+{
+    internal::parallel_quick_sort(beg, end, compare, threads);
+}
+
+template <class RandomAccessIterator, class Comp>
+void parallel_quick_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    internal::parallel_quick_sort(beg, end, compare, 0);
 }
 
-// stable sort
 template <class RandomAccessIterator>
-void merge_sort_s(RandomAccessIterator beg, RandomAccessIterator end)
+void parallel_quick_sort(RandomAccessIterator beg, RandomAccessIterator end)
 {
-    merge_sort_s(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+    parallel_quick_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
 }
 
-// stable sort
 template <class RandomAccessIterator, class Comp>
-void merge_sort_buffer(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+void sample_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
 {
-    internal::merge_sort_with_buffer<false>(beg, end, compare, true);
+    internal::sample_sort(beg, end, compare);
 }
 
-// stable sort
 template <class RandomAccessIterator>
-void merge_sort_buffer(RandomAccessIterator beg, RandomAccessIterator end)
+void sample_sort(RandomAccessIterator beg, RandomAccessIterator end)
 {
-    merge_sort_buffer(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+    sample_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
 }
 
-// stable sort
+// threads = 0 uses all hardware threads, sequential if built without C++11
 template <class RandomAccessIterator, class Comp>
-void merge_sort_buffer_s(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+void parallel_sample_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, unsigned threads)
 {
-    internal::merge_sort_with_buffer<true>(beg, end, compare, true);
+    internal::parallel_sample_sort(beg, end, compare, threads);
+}
+
+template <class RandomAccessIterator, class Comp>
+void parallel_sample_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    internal::parallel_sample_sort(beg, end, compare, 0);
 }
 
-// stable sort
 template <class RandomAccessIterator>
-void merge_sort_buffer_s(RandomAccessIterator beg, RandomAccessIterator end)
+void parallel_sample_sort(RandomAccessIterator beg, RandomAccessIterator end)
 {
-    merge_sort_buffer_s(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+    parallel_sample_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
 }
 
+typedef internal::timsort_policy timsort_policy;
+typedef internal::powersort_policy powersort_policy;
+
 // stable sort
 template <class RandomAccessIterator, class Comp>
-void merge_sort_in_place(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+void tim_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
 {
-    internal::merge_sort_with_buffer<true>(beg, end, compare, false);
+    internal::tim_sort_buffer<false, timsort_policy>(beg, end, (size_t)(end - beg), compare);
 }
 
 // stable sort
 template <class RandomAccessIterator>
-void merge_sort_in_place(RandomAccessIterator beg, RandomAccessIterator end)
+void tim_sort(RandomAccessIterator beg, RandomAccessIterator end)
 {
-    merge_sort_in_place(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+    tim_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
+// stable sort, MergePolicy is timsort_policy or powersort_policy
+template <class MergePolicy, class RandomAccessIterator, class Comp>
+void tim_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    internal::tim_sort_buffer<false, MergePolicy>(beg, end, (size_t)(end - beg), compare);
+}
+
+// stable sort
+template <class MergePolicy, class RandomAccessIterator>
+void tim_sort(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    tim_sort<MergePolicy>(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
 }
 
+// stable sort
 template <class RandomAccessIterator, class Comp>
-void quick_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+void tim_sort_s(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
 {
-    if (end - beg > 1)
-    {
-        internal::quick_sort(beg, end, compare);
-    }
+    internal::tim_sort_buffer<true, timsort_policy>(beg, end, end - beg, compare);
 }
 
+// stable sort
 template <class RandomAccessIterator>
-void quick_sort(RandomAccessIterator beg, RandomAccessIterator end)
+void tim_sort_s(RandomAccessIterator beg, RandomAccessIterator end)
 {
-    quick_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+    tim_sort_s(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
+// stable sort, threads = 0 uses all hardware threads
+template <class RandomAccessIterator, class Comp>
+void parallel_tim_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, unsigned threads)
+{
+    internal::parallel_tim_sort<false>(beg, end, compare, threads);
 }
 
 // stable sort
 template <class RandomAccessIterator, class Comp>
-void tim_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+void parallel_tim_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
 {
-    internal::tim_sort_buffer<false>(beg, end, (size_t)(end - beg), compare);
+    internal::parallel_tim_sort<false>(beg, end, compare, 0);
 }
 
 // stable sort
 template <class RandomAccessIterator>
-void tim_sort(RandomAccessIterator beg, RandomAccessIterator end)
+void parallel_tim_sort(RandomAccessIterator beg, RandomAccessIterator end)
 {
-    tim_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+    parallel_tim_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
 }
 
 // stable sort
 template <class RandomAccessIterator, class Comp>
-void tim_sort_s(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+void parallel_tim_sort_s(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, unsigned threads)
+{
+    internal::parallel_tim_sort<true>(beg, end, compare, threads);
+}
+
+// stable sort
+template <class RandomAccessIterator, class Comp>
+void parallel_tim_sort_s(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
 {
-    internal::tim_sort_buffer<true>(beg, end, end - beg, compare);
+    internal::parallel_tim_sort<true>(beg, end, compare, 0);
 }
 
 // stable sort
 template <class RandomAccessIterator>
-void tim_sort_s(RandomAccessIterator beg, RandomAccessIterator end)
+void parallel_tim_sort_s(RandomAccessIterator beg, RandomAccessIterator end)
 {
-    tim_sort_s(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+    parallel_tim_sort_s(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
 }
 
 // stable sort
@@ -2002,7 +6395,7 @@ void tim_sort_buffer(RandomAccessIterator beg, RandomAccessIterator end, Comp co
     if (end - beg > 1)
     {
         size_t bufsize = (size_t)sqrt(end - beg + 0.1);
-        internal::tim_sort_buffer<false>(beg, end, bufsize, compare);
+        internal::tim_sort_buffer<false, timsort_policy>(beg, end, bufsize, compare);
     }
 }
 
@@ -2013,6 +6406,24 @@ void tim_sort_buffer(RandomAccessIterator beg, RandomAccessIterator end)
     tim_sort_buffer(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
 }
 
+// stable sort, MergePolicy is timsort_policy or powersort_policy
+template <class MergePolicy, class RandomAccessIterator, class Comp>
+void tim_sort_buffer(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    if (end - beg > 1)
+    {
+        size_t bufsize = (size_t)sqrt(end - beg + 0.1);
+        internal::tim_sort_buffer<false, MergePolicy>(beg, end, bufsize, compare);
+    }
+}
+
+// stable sort
+template <class MergePolicy, class RandomAccessIterator>
+void tim_sort_buffer(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    tim_sort_buffer<MergePolicy>(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
 // stable sort
 template <class RandomAccessIterator, class Comp>
 void tim_sort_buffer_s(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
@@ -2020,7 +6431,7 @@ void tim_sort_buffer_s(RandomAccessIterator beg, RandomAccessIterator end, Comp
     if (end - beg > 1)
     {
         size_t bufsize = (size_t)sqrt(end - beg + 0.1);
-        internal::tim_sort_buffer<true>(beg, end, bufsize, compare);
+        internal::tim_sort_buffer<true, timsort_policy>(beg, end, bufsize, compare);
     }
 }
 
@@ -2031,6 +6442,53 @@ void tim_sort_buffer_s(RandomAccessIterator beg, RandomAccessIterator end)
     tim_sort_buffer_s(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
 }
 
+// stable sort on the caller's buffer of bufsize raw elements, never allocates
+template <class RandomAccessIterator, class Comp, class T>
+void tim_sort_buffer(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, T* buf, size_t bufsize)
+{
+    internal::check_buffer_type<RandomAccessIterator, T>();
+    internal::tim_sort_with_buffer<false, timsort_policy>(buf, bufsize, beg, end, compare);
+}
+
+// stable sort on the caller's buffer, MergePolicy is timsort_policy or powersort_policy
+template <class MergePolicy, class RandomAccessIterator, class Comp, class T>
+void tim_sort_buffer(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, T* buf, size_t bufsize)
+{
+    internal::check_buffer_type<RandomAccessIterator, T>();
+    internal::tim_sort_with_buffer<false, MergePolicy>(buf, bufsize, beg, end, compare);
+}
+
+// stable sort, takes required_buffer_size(end - beg) elements from alloc, an allocator or an arena
+// with allocate(n) and deallocate(p, n)
+template <class RandomAccessIterator, class Comp, class Alloc>
+void tim_sort_buffer(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, Alloc& alloc)
+{
+    if (end - beg > 1)
+    {
+        internal::allocator_buffer<false, Alloc, typename std::iterator_traits<RandomAccessIterator>::value_type> scratch(alloc, beg, required_buffer_size(end - beg));
+        internal::tim_sort_with_buffer<false, timsort_policy>(scratch.buf, scratch.size, beg, end, compare);
+    }
+}
+
+// stable sort on the caller's buffer of bufsize constructed elements, never allocates
+template <class RandomAccessIterator, class Comp, class T>
+void tim_sort_buffer_s(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, T* buf, size_t bufsize)
+{
+    internal::check_buffer_type<RandomAccessIterator, T>();
+    internal::tim_sort_with_buffer<true, timsort_policy>(buf, bufsize, beg, end, compare);
+}
+
+// stable sort, takes required_buffer_size(end - beg) elements from alloc and constructs them
+template <class RandomAccessIterator, class Comp, class Alloc>
+void tim_sort_buffer_s(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, Alloc& alloc)
+{
+    if (end - beg > 1)
+    {
+        internal::allocator_buffer<true, Alloc, typename std::iterator_traits<RandomAccessIterator>::value_type> scratch(alloc, beg, required_buffer_size(end - beg));
+        internal::tim_sort_with_buffer<true, timsort_policy>(scratch.buf, scratch.size, beg, end, compare);
+    }
+}
+
 // stable sort
 template <class RandomAccessIterator, class Comp>
 void indirect_qsort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
@@ -2057,6 +6515,95 @@ void radix_sort_in_place(RandomAccessIterator beg, RandomAccessIterator end)
     radix_sort_in_place<uint32_t>(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
 }
 
+// stable sort, threads = 0 uses all hardware threads
+template <class RandomAccessIterator, class RadixIndexFunc>
+void radix_sort_lsd(RandomAccessIterator beg, RandomAccessIterator end, RadixIndexFunc get_index, unsigned threads)
+{
+    internal::radix_sort_lsd<false>(beg, end, get_index, threads);
+}
+
+// stable sort
+template <class RandomAccessIterator, class RadixIndexFunc>
+void radix_sort_lsd(RandomAccessIterator beg, RandomAccessIterator end, RadixIndexFunc get_index)
+{
+    internal::radix_sort_lsd<false>(beg, end, get_index, 0);
+}
+
+// stable sort
+template <class RandomAccessIterator>
+void radix_sort_lsd(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    radix_sort_lsd(beg, end, internal::radix_get_index<typename std::iterator_traits<RandomAccessIterator>::value_type, uint32_t>());
+}
+
+// stable sort
+template <class RandomAccessIterator, class RadixIndexFunc>
+void radix_sort_lsd_s(RandomAccessIterator beg, RandomAccessIterator end, RadixIndexFunc get_index, unsigned threads)
+{
+    internal::radix_sort_lsd<true>(beg, end, get_index, threads);
+}
+
+// stable sort
+template <class RandomAccessIterator, class RadixIndexFunc>
+void radix_sort_lsd_s(RandomAccessIterator beg, RandomAccessIterator end, RadixIndexFunc get_index)
+{
+    internal::radix_sort_lsd<true>(beg, end, get_index, 0);
+}
+
+// stable sort
+template <class RandomAccessIterator>
+void radix_sort_lsd_s(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    radix_sort_lsd_s(beg, end, internal::radix_get_index<typename std::iterator_traits<RandomAccessIterator>::value_type, uint32_t>());
+}
+
+// threads = 0 uses all hardware threads, sequential if built without C++11
+template <class IndexType, class RandomAccessIterator, class Comp>
+void parallel_radix_sort_in_place(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, unsigned threads)
+{
+    internal::parallel_radix_sort_msd_in_place(beg, end, internal::radix_get_index<typename std::iterator_traits<RandomAccessIterator>::value_type, IndexType>(), compare, threads);
+}
+
+template <class IndexType, class RandomAccessIterator, class Comp>
+void parallel_radix_sort_in_place(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    parallel_radix_sort_in_place<IndexType>(beg, end, compare, 0);
+}
+
+template <class RandomAccessIterator>
+void parallel_radix_sort_in_place(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    parallel_radix_sort_in_place<uint32_t>(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
+typedef internal::auto_sort_decision auto_sort_decision;
+
+// the engine auto_sort would pick, the range is only read
+template <class RandomAccessIterator, class Comp>
+auto_sort_decision auto_sort_plan(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    return internal::auto_sort_plan(beg, end, compare);
+}
+
+template <class RandomAccessIterator>
+auto_sort_decision auto_sort_plan(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    return auto_sort_plan(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
+// samples the range and picks tim_sort, quick_sort, radix sort or counting sort, returns the decision for logging
+template <class RandomAccessIterator, class Comp>
+auto_sort_decision auto_sort(RandomAccessIterator beg, RandomAccessIterator end, Comp compare)
+{
+    return internal::auto_sort(beg, end, compare);
+}
+
+template <class RandomAccessIterator>
+auto_sort_decision auto_sort(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    return auto_sort(beg, end, std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>());
+}
+
 } // namespace sort
 
 } // namespace baobao
@@ -197,14 +197,29 @@ void init_test_func_map(std::map<std::string, arrar_function_t> &test_func_map)
         test_func_map["bao_heap"] = baobao_warp::baobao_heap_sort;
         test_func_map["bao_shell"] = baobao_warp::baobao_shell_sort;
         test_func_map["bao_merge"] = baobao_warp::baobao_merge_sort;
+        test_func_map["bao_merge_s"] = baobao_warp::baobao_merge_sort_s;
+        test_func_map["bao_mer_pp"] = baobao_warp::baobao_merge_sort_ping_pong;
         test_func_map["bao_mer_buf"] = baobao_warp::baobao_merge_sort_buffer;
         test_func_map["bao_mer_in"] = baobao_warp::baobao_merge_sort_in_place;
+        test_func_map["bao_par_mer"] = baobao_warp::baobao_parallel_merge_sort;
+        test_func_map["bao_par_mr"] = baobao_warp::baobao_parallel_merge_ranges;
         test_func_map["bao_qsort"] = baobao_warp::baobao_quick_sort;
+        test_func_map["bao_qs_bless"] = baobao_warp::baobao_quick_sort_branchless;
+        test_func_map["bao_pdq"] = baobao_warp::baobao_pdq_sort;
         test_func_map["bao_indir"] = baobao_warp::baobao_indirect_qsort;
+        test_func_map["bao_par_qs"] = baobao_warp::baobao_parallel_quick_sort;
+        test_func_map["bao_sample"] = baobao_warp::baobao_sample_sort;
+        test_func_map["bao_par_ss"] = baobao_warp::baobao_parallel_sample_sort;
+        test_func_map["bao_auto"] = baobao_warp::baobao_auto_sort;
         test_func_map["bao_tim"] = baobao_warp::baobao_tim_sort;
+        test_func_map["bao_tim_s"] = baobao_warp::baobao_tim_sort_s;
+        test_func_map["bao_tim_pow"] = baobao_warp::baobao_tim_sort_powersort;
         test_func_map["bao_tim_buf"] = baobao_warp::baobao_tim_sort_buffer;
+        test_func_map["bao_par_tim"] = baobao_warp::baobao_parallel_tim_sort;
 #if TEST_TYPE_SIMPLE < 2
         test_func_map["bao_radix_in"] = baobao_warp::baobao_radix_sort_in_place;
+        test_func_map["bao_par_rdx"] = baobao_warp::baobao_parallel_radix_sort_in_place;
+        test_func_map["bao_rdx_lsd"] = baobao_warp::baobao_radix_sort_lsd;
 #endif
     }
     // https://github.com/Mrrl/GrailSort
@@ -15,6 +15,8 @@
 #include <algorithm>
 #include <cstdlib>
 #include <functional>
+#include <utility>
+#include <vector>
 
 #if __cplusplus >= 201103L || _MSC_VER >= 1700
 #define BAO_SORT_LIB_STD11
@@ -257,6 +259,16 @@ void baobao_merge_sort_s(sort_element_t arr[], size_t len)
     baobao::sort::merge_sort_s(arr, arr + len);
 }
 
+void baobao_parallel_merge_sort(sort_element_t arr[], size_t len)
+{
+    baobao::sort::parallel_merge_sort(arr, arr + len);
+}
+
+void baobao_merge_sort_ping_pong(sort_element_t arr[], size_t len)
+{
+    baobao::sort::merge_sort_ping_pong(arr, arr + len);
+}
+
 void baobao_merge_sort_buffer(sort_element_t arr[], size_t len)
 {
     baobao::sort::merge_sort_buffer(arr, arr + len);
@@ -272,16 +284,71 @@ void baobao_merge_sort_in_place(sort_element_t arr[], size_t len)
     baobao::sort::merge_sort_in_place(arr, arr + len);
 }
 
+// 16 shards sorted on their own, then merged by parallel_merge_ranges
+void baobao_parallel_merge_ranges(sort_element_t arr[], size_t len)
+{
+    const size_t shards = 16;
+    std::vector<std::pair<sort_element_t*, sort_element_t*> > ranges;
+    for (size_t i = 0; i < shards; ++i)
+    {
+        ranges.push_back(std::make_pair(arr + len * i / shards, arr + len * (i + 1) / shards));
+        baobao::sort::merge_sort(ranges.back().first, ranges.back().second);
+    }
+    std::vector<sort_element_t> out(len);
+    baobao::sort::parallel_merge_ranges(ranges.begin(), shards, out.begin());
+    std::copy(out.begin(), out.end(), arr);
+}
+
 void baobao_quick_sort(sort_element_t arr[], size_t len)
 {
     baobao::sort::quick_sort(arr, arr + len);
 }
 
+void baobao_quick_sort_branchless(sort_element_t arr[], size_t len)
+{
+    baobao::sort::quick_sort_branchless(arr, arr + len);
+}
+
+void baobao_pdq_sort(sort_element_t arr[], size_t len)
+{
+    baobao::sort::pdq_sort(arr, arr + len);
+}
+
+void baobao_parallel_quick_sort(sort_element_t arr[], size_t len)
+{
+    baobao::sort::parallel_quick_sort(arr, arr + len);
+}
+
+void baobao_sample_sort(sort_element_t arr[], size_t len)
+{
+    baobao::sort::sample_sort(arr, arr + len);
+}
+
+void baobao_parallel_sample_sort(sort_element_t arr[], size_t len)
+{
+    baobao::sort::parallel_sample_sort(arr, arr + len);
+}
+
+void baobao_auto_sort(sort_element_t arr[], size_t len)
+{
+    baobao::sort::auto_sort(arr, arr + len);
+}
+
 void baobao_tim_sort(sort_element_t arr[], size_t len)
 {
     baobao::sort::tim_sort(arr, arr + len);
 }
 
+void baobao_parallel_tim_sort(sort_element_t arr[], size_t len)
+{
+    baobao::sort::parallel_tim_sort(arr, arr + len);
+}
+
+void baobao_tim_sort_powersort(sort_element_t arr[], size_t len)
+{
+    baobao::sort::tim_sort<baobao::sort::powersort_policy>(arr, arr + len);
+}
+
 void baobao_tim_sort_buffer(sort_element_t arr[], size_t len)
 {
     baobao::sort::tim_sort_buffer(arr, arr + len);
@@ -307,6 +374,16 @@ void baobao_radix_sort_in_place(sort_element_t arr[], size_t len)
 {
     baobao::sort::radix_sort_in_place(arr, arr + len);
 }
+
+void baobao_parallel_radix_sort_in_place(sort_element_t arr[], size_t len)
+{
+    baobao::sort::parallel_radix_sort_in_place(arr, arr + len);
+}
+
+void baobao_radix_sort_lsd(sort_element_t arr[], size_t len)
+{
+    baobao::sort::radix_sort_lsd(arr, arr + len);
+}
 #endif
 
 
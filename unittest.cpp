@@ -0,0 +1,1467 @@
+// filename:    unittest.cpp
+// author:      baobaobear
+// create date: 2026-10-18
+
+// correctness and stability checks, sorttest.cpp only benchmarks int, double and TestClass
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "sortlib.hpp"
+#include "extsort.hpp"
+#include "sorttest.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef BAO_SORT_LIB_SCRATCH_CACHE
+#include <thread>
+#endif
+
+static int test_failures = 0;
+
+#define TEST_CHECK(cond) \
+    do \
+    { \
+        if (!(cond)) \
+        { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            ++test_failures; \
+        } \
+    } while (0)
+
+static std::string test_string(uint32_t v)
+{
+    char s[32];
+    sprintf(s, "key-%010u", v);
+    return s;
+}
+
+#ifdef BAO_SORT_LIB_PARALLEL
+// the first exception of a task, also from a nested group, reaches the caller of wait after every task ran
+static void test_task_pool_exception()
+{
+    for (unsigned threads = 1; threads <= 4; ++threads)
+    {
+        baobao::util::task_pool pool(threads);
+        std::atomic<int> done(0);
+        bool caught = false;
+        try
+        {
+            baobao::util::task_group group;
+            for (int i = 0; i < 64; ++i)
+            {
+                pool.spawn(group, [&pool, &done, i]()
+                {
+                    baobao::util::task_group inner;
+                    pool.spawn(inner, [&done, i]()
+                    {
+                        ++done;
+                        if (i % 16 == 5)
+                            throw std::runtime_error("task");
+                    });
+                    pool.wait(inner);
+                });
+            }
+            pool.wait(group);
+        }
+        catch (const std::runtime_error&)
+        {
+            caught = true;
+        }
+        TEST_CHECK(caught);
+        TEST_CHECK(done.load() == 64);
+
+        // the pool is still usable
+        baobao::util::task_group group;
+        for (int i = 0; i < 64; ++i)
+        {
+            pool.spawn(group, [&done]() { ++done; });
+        }
+        pool.wait(group);
+        TEST_CHECK(done.load() == 128);
+    }
+}
+#endif
+
+// the i-th of n keys of a kind: 0 random over all ints, 1 all equal, 2 three keys, 3 ascending,
+// 4 descending, 5 ascending runs of 100
+static int test_key(size_t i, size_t n, int kind)
+{
+    switch (kind)
+    {
+    case 0:
+        return (int)((baobao::util::rand_uint32(65535) << 16) | baobao::util::rand_uint32(65535));
+    case 1:
+        return 42;
+    case 2:
+        return (int)baobao::util::rand_uint32(2) - 1;
+    case 3:
+        return (int)i;
+    case 4:
+        return (int)(n - i);
+    default:
+        return (int)(i % 100);
+    }
+}
+
+// a double of the key, one in 16 is an extreme: the largest and smallest finite values, a denormal,
+// infinities and zeros of both signs
+static double test_key_double(int key)
+{
+    static const double extremes[] = { DBL_MAX, -DBL_MAX, DBL_MIN, -DBL_MIN, DBL_MIN / 8, HUGE_VAL, -HUGE_VAL, 0.0, -0.0 };
+    unsigned pick = (unsigned)key & 15;
+    if (pick < sizeof(extremes) / sizeof(extremes[0]) && baobao::util::rand_uint32(15) == 0)
+        return extremes[pick];
+    return key / 7.0;
+}
+
+template <class T>
+static bool test_same_as_std_sort(const std::vector<T>& in, const std::vector<T>& out)
+{
+    std::vector<T> expect(in);
+    std::sort(expect.begin(), expect.end());
+    return out == expect;
+}
+
+// sorted by val, and every index of the input once with its val
+static bool test_class_permutation(const std::vector<baobao::TestClass>& in, const std::vector<baobao::TestClass>& out)
+{
+    if (out.size() != in.size())
+        return false;
+    std::vector<char> seen(in.size(), 0);
+    for (size_t i = 0; i < out.size(); ++i)
+    {
+        size_t index = (size_t)out[i].index;
+        if (index >= in.size() || seen[index] || out[i].val != in[index].val || (i > 0 && out[i].val < out[i - 1].val))
+            return false;
+        seen[index] = 1;
+    }
+    return true;
+}
+
+// n keys of a kind as int, double and TestClass, the TestClass index is the position
+static void test_fill_keys(size_t n, int kind, std::vector<int>& in, std::vector<double>& in_double, std::vector<baobao::TestClass>& in_class)
+{
+    in.resize(n);
+    in_double.resize(n);
+    in_class.resize(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        in[i] = test_key(i, n, kind);
+        in_double[i] = test_key_double(in[i]);
+        in_class[i].val = in[i];
+        in_class[i].index = (int)i;
+    }
+}
+
+// threads 1 is the sequential quick_sort, parallel tasks start above parallel_qsort_task_threshold
+static void test_parallel_quick_sort()
+{
+    static const size_t sizes[] = { 0, 1, 2, 1000, 16385, 70001 };
+    static const unsigned threads[] = { 1, 2, 3 };
+    for (size_t si = 0; si < sizeof(sizes) / sizeof(sizes[0]); ++si)
+    {
+        for (int kind = 0; kind < 6; ++kind)
+        {
+            std::vector<int> in;
+            std::vector<double> in_double;
+            std::vector<baobao::TestClass> in_class;
+            test_fill_keys(sizes[si], kind, in, in_double, in_class);
+            for (size_t ti = 0; ti < sizeof(threads) / sizeof(threads[0]); ++ti)
+            {
+                std::vector<int> v(in);
+                std::vector<double> d(in_double);
+                std::vector<baobao::TestClass> c(in_class);
+                baobao::sort::parallel_quick_sort(v.begin(), v.end(), std::less<int>(), threads[ti]);
+                baobao::sort::parallel_quick_sort(d.begin(), d.end(), std::less<double>(), threads[ti]);
+                baobao::sort::parallel_quick_sort(c.begin(), c.end(), std::less<baobao::TestClass>(), threads[ti]);
+                TEST_CHECK(test_same_as_std_sort(in, v));
+                TEST_CHECK(test_same_as_std_sort(in_double, d));
+                TEST_CHECK(test_class_permutation(in_class, c));
+            }
+        }
+    }
+}
+
+// sorted, a permutation of the input and equal keys keep their input order
+static bool test_class_stable(const std::vector<baobao::TestClass>& in, const std::vector<baobao::TestClass>& out)
+{
+    return test_class_permutation(in, out) && (out.empty() || baobao::check_sorted_stable(out.begin(), out.end(), std::less<baobao::TestClass>()));
+}
+
+struct test_parallel_merge_sorter
+{
+    template <class RandomAccessIterator, class Comp>
+    void operator()(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, unsigned threads, bool safecopy) const
+    {
+        if (safecopy)
+            baobao::sort::parallel_merge_sort_s(beg, end, compare, threads);
+        else
+            baobao::sort::parallel_merge_sort(beg, end, compare, threads);
+    }
+};
+
+struct test_parallel_tim_sorter
+{
+    template <class RandomAccessIterator, class Comp>
+    void operator()(RandomAccessIterator beg, RandomAccessIterator end, Comp compare, unsigned threads, bool safecopy) const
+    {
+        if (safecopy)
+            baobao::sort::parallel_tim_sort_s(beg, end, compare, threads);
+        else
+            baobao::sort::parallel_tim_sort(beg, end, compare, threads);
+    }
+};
+
+// a stable parallel sort and its _s version at 1, 2 and 3 threads, the parallel path starts
+// above parallel_merge_task_threshold
+template <class Sorter>
+static void test_parallel_stable_sort(Sorter sorter)
+{
+    static const size_t sizes[] = { 0, 1, 2, 1000, 16385, 70001 };
+    static const unsigned threads[] = { 1, 2, 3 };
+    for (size_t si = 0; si < sizeof(sizes) / sizeof(sizes[0]); ++si)
+    {
+        for (int kind = 0; kind < 6; ++kind)
+        {
+            std::vector<int> in;
+            std::vector<double> in_double;
+            std::vector<baobao::TestClass> in_class;
+            test_fill_keys(sizes[si], kind, in, in_double, in_class);
+            for (size_t ti = 0; ti < sizeof(threads) / sizeof(threads[0]); ++ti)
+            {
+                for (int safecopy = 0; safecopy < 2; ++safecopy)
+                {
+                    std::vector<int> v(in);
+                    std::vector<baobao::TestClass> c(in_class);
+                    sorter(v.begin(), v.end(), std::less<int>(), threads[ti], safecopy != 0);
+                    sorter(c.begin(), c.end(), std::less<baobao::TestClass>(), threads[ti], safecopy != 0);
+                    TEST_CHECK(test_same_as_std_sort(in, v));
+                    TEST_CHECK(test_class_stable(in_class, c));
+                }
+            }
+        }
+    }
+}
+
+// the unsigned keys are the ints masked to 0 to 3 bytes, so the top digits are zero and the
+// first partitioned digit starts lower, the parallel path starts above parallel_samplesort_stripe_threshold
+static void test_parallel_radix_sort_in_place()
+{
+    static const size_t sizes[] = { 0, 1, 2, 1000, 65537, 140001 };
+    static const unsigned threads[] = { 1, 2, 3 };
+    for (size_t si = 0; si < sizeof(sizes) / sizeof(sizes[0]); ++si)
+    {
+        for (int kind = 0; kind < 6; ++kind)
+        {
+            std::vector<int> in;
+            std::vector<double> in_double;
+            std::vector<baobao::TestClass> in_class;
+            test_fill_keys(sizes[si], kind, in, in_double, in_class);
+            std::vector<unsigned> in_unsigned(in.size());
+            for (size_t i = 0; i < in.size(); ++i)
+                in_unsigned[i] = (unsigned)in[i] & (0xffffffu >> (8 * (kind % 4)));
+            for (size_t ti = 0; ti < sizeof(threads) / sizeof(threads[0]); ++ti)
+            {
+                std::vector<int> v(in);
+                std::vector<unsigned> u(in_unsigned);
+                std::vector<baobao::TestClass> c(in_class);
+                baobao::sort::parallel_radix_sort_in_place<uint32_t>(v.begin(), v.end(), std::less<int>(), threads[ti]);
+                baobao::sort::parallel_radix_sort_in_place<uint32_t>(u.begin(), u.end(), std::less<unsigned>(), threads[ti]);
+                baobao::sort::parallel_radix_sort_in_place<uint32_t>(c.begin(), c.end(), std::less<baobao::TestClass>(), threads[ti]);
+                TEST_CHECK(test_same_as_std_sort(in, v));
+                TEST_CHECK(test_same_as_std_sort(in_unsigned, u));
+                TEST_CHECK(test_class_permutation(in_class, c));
+            }
+        }
+    }
+}
+
+struct test_radix_index
+{
+    uint32_t operator()(int v) const
+    {
+        return (uint32_t)v + (1U << 31);
+    }
+
+    uint32_t operator()(const baobao::TestClass& v) const
+    {
+        return v.get_index();
+    }
+
+#if __cplusplus >= 201103L
+    uint64_t operator()(int64_t v) const
+    {
+        return (uint64_t)v + ((uint64_t)1 << 63);
+    }
+#endif
+};
+
+// shape 0 keeps the key, 1 keeps its low byte so only the first digit is sorted, 2 keeps the low byte
+// and the top two bits, with constant digits in between for both the 8 and the 11 bit digits,
+// 3 shifts the key past the first digit so the first pass is a later digit
+static int test_radix_shape(int key, int shape)
+{
+    if (shape == 1)
+        return key & 0xff;
+    if (shape == 2)
+        return (int)(((unsigned)key & 0xff) | (((unsigned)key & 0x300) << 22));
+    if (shape == 3)
+        return (int)((unsigned)key << 11);
+    return key;
+}
+
+// an odd number of scatter passes ends in the buffer and copies back, all digits constant allocates nothing,
+// the parallel path starts above parallel_radix_lsd_threshold
+static void test_radix_sort_lsd()
+{
+    static const size_t sizes[] = { 0, 1, 2, 1000, 65537, 140001 };
+    static const unsigned threads[] = { 1, 2, 3 };
+    for (size_t si = 0; si < sizeof(sizes) / sizeof(sizes[0]); ++si)
+    {
+        for (int kind = 0; kind < 6; ++kind)
+        {
+            for (int shape = 0; shape < 4; ++shape)
+            {
+                std::vector<int> in;
+                std::vector<double> in_double;
+                std::vector<baobao::TestClass> in_class;
+                test_fill_keys(sizes[si], kind, in, in_double, in_class);
+                for (size_t i = 0; i < in.size(); ++i)
+                {
+                    in[i] = in_class[i].val = test_radix_shape(in[i], shape);
+                }
+#if __cplusplus >= 201103L
+                // 64 bit keys with the int in the high half and its low byte in the low half
+                std::vector<int64_t> in_wide(in.size());
+                for (size_t i = 0; i < in.size(); ++i)
+                {
+                    in_wide[i] = (int64_t)in[i] * 65536 * 65536 + (in[i] & 0xff);
+                }
+#endif
+                for (size_t ti = 0; ti < sizeof(threads) / sizeof(threads[0]); ++ti)
+                {
+                    for (int safecopy = 0; safecopy < 2; ++safecopy)
+                    {
+                        std::vector<int> v(in);
+                        std::vector<baobao::TestClass> c(in_class);
+                        if (safecopy)
+                        {
+                            baobao::sort::radix_sort_lsd_s(v.begin(), v.end(), test_radix_index(), threads[ti]);
+                            baobao::sort::radix_sort_lsd_s(c.begin(), c.end(), test_radix_index(), threads[ti]);
+                        }
+                        else
+                        {
+                            baobao::sort::radix_sort_lsd(v.begin(), v.end(), test_radix_index(), threads[ti]);
+                            baobao::sort::radix_sort_lsd(c.begin(), c.end(), test_radix_index(), threads[ti]);
+                        }
+                        TEST_CHECK(test_same_as_std_sort(in, v));
+                        TEST_CHECK(test_class_stable(in_class, c));
+#if __cplusplus >= 201103L
+                        std::vector<int64_t> w(in_wide);
+                        baobao::sort::radix_sort_lsd(w.begin(), w.end(), test_radix_index(), threads[ti]);
+                        TEST_CHECK(test_same_as_std_sort(in_wide, w));
+#endif
+                    }
+                }
+            }
+        }
+    }
+}
+
+// threads 0 is sample_sort, sizes around the block of 512 ints, 256 doubles and 64 TestClass,
+// the rest only takes the parallel path above parallel_samplesort_stripe_threshold
+static void test_sample_sort()
+{
+    static const size_t sizes[] = { 0, 1, 2, 3, 17, 63, 64, 65, 255, 257, 511, 512, 513, 4097, 65537, 140001 };
+    static const unsigned threads[] = { 0, 1, 2, 3, 4, 7 };
+    for (size_t si = 0; si < sizeof(sizes) / sizeof(sizes[0]); ++si)
+    {
+        size_t n = sizes[si];
+        for (int kind = 0; kind < 6; ++kind)
+        {
+            std::vector<int> in;
+            std::vector<double> in_double;
+            std::vector<baobao::TestClass> in_class;
+            test_fill_keys(n, kind, in, in_double, in_class);
+            for (size_t ti = 0; ti < sizeof(threads) / sizeof(threads[0]); ++ti)
+            {
+                // below the parallel threshold only threads > n is worth a run
+                unsigned t = threads[ti];
+                if (n <= (size_t)baobao::parallel_samplesort_stripe_threshold && t != 0 && t != 7)
+                    continue;
+                std::vector<int> v(in);
+                std::vector<double> d(in_double);
+                std::vector<baobao::TestClass> c(in_class);
+                if (t == 0)
+                {
+                    baobao::sort::sample_sort(v.begin(), v.end());
+                    baobao::sort::sample_sort(d.begin(), d.end());
+                    baobao::sort::sample_sort(c.begin(), c.end());
+                }
+                else
+                {
+                    baobao::sort::parallel_sample_sort(v.begin(), v.end(), std::less<int>(), t);
+                    baobao::sort::parallel_sample_sort(d.begin(), d.end(), std::less<double>(), t);
+                    baobao::sort::parallel_sample_sort(c.begin(), c.end(), std::less<baobao::TestClass>(), t);
+                }
+                TEST_CHECK(test_same_as_std_sort(in, v));
+                TEST_CHECK(test_same_as_std_sort(in_double, d));
+                TEST_CHECK(test_class_permutation(in_class, c));
+            }
+        }
+    }
+}
+
+// orders ints by the bits above the low 16
+struct test_high_bits_less
+{
+    bool operator()(int a, int b) const
+    {
+        return (a >> 16) < (b >> 16);
+    }
+};
+
+// block partitioning of types without SIMD keys, sizes around the insertion sort threshold of 40
+// and the 64 offsets of a block
+static void test_quick_sort_branchless()
+{
+    static const size_t sizes[] = { 0, 1, 2, 40, 41, 63, 64, 65, 127, 128, 129, 200, 1000, 50000 };
+    for (size_t si = 0; si < sizeof(sizes) / sizeof(sizes[0]); ++si)
+    {
+        for (int kind = 0; kind < 6; ++kind)
+        {
+            std::vector<int> in;
+            std::vector<double> in_double;
+            std::vector<baobao::TestClass> in_class;
+            test_fill_keys(sizes[si], kind, in, in_double, in_class);
+            std::vector<std::string> in_string(in.size());
+            for (size_t i = 0; i < in.size(); ++i)
+                in_string[i] = test_string((uint32_t)in[i]);
+
+            std::vector<std::string> s(in_string);
+            std::vector<baobao::TestClass> c(in_class);
+            std::vector<int> v(in), expect(in);
+            baobao::sort::quick_sort_branchless(s.begin(), s.end());
+            baobao::sort::quick_sort_branchless(c.begin(), c.end());
+            baobao::sort::quick_sort_branchless(v.begin(), v.end(), test_high_bits_less());
+            std::stable_sort(expect.begin(), expect.end(), test_high_bits_less());
+            TEST_CHECK(test_same_as_std_sort(in_string, s));
+            TEST_CHECK(test_class_permutation(in_class, c));
+            // only the order of the high bits is defined
+            bool same_high = true;
+            for (size_t i = 0; i < v.size(); ++i)
+                same_high = same_high && (v[i] >> 16) == (expect[i] >> 16);
+            TEST_CHECK(same_high);
+            std::sort(v.begin(), v.end());
+            TEST_CHECK(test_same_as_std_sort(in, v));
+        }
+    }
+}
+
+// McIlroy's adversary for quicksort: the keys start as gas, bigger than any solid key, and one of two
+// gas keys compared becomes solid, preferring the pivot candidate, so every partition is as bad as it can be
+struct test_adversary
+{
+    std::vector<int> key;
+    int solid, candidate;
+    size_t compares;
+
+    explicit test_adversary(size_t n)
+        : key(n, (int)n)
+        , solid(0)
+        , candidate(0)
+        , compares(0)
+    {
+    }
+};
+
+struct test_adversary_less
+{
+    test_adversary* a;
+
+    bool operator()(int x, int y) const
+    {
+        int gas = (int)a->key.size();
+        ++a->compares;
+        if (a->key[x] == gas && a->key[y] == gas)
+            a->key[x == a->candidate ? x : y] = a->solid++;
+        if (a->key[x] == gas)
+            a->candidate = x;
+        else if (a->key[y] == gas)
+            a->candidate = y;
+        return a->key[x] < a->key[y];
+    }
+};
+
+// the adversary makes every partition bad, so only the heap_sort fallback keeps pdq_sort at O(n log n)
+static void test_pdq_sort_fallback()
+{
+    static const size_t sizes[] = { 100, 1000, 30000 };
+    for (size_t si = 0; si < sizeof(sizes) / sizeof(sizes[0]); ++si)
+    {
+        size_t n = sizes[si], log_n = 0;
+        while (((size_t)1 << log_n) < n)
+            ++log_n;
+        std::vector<int> v(n);
+        for (size_t i = 0; i < n; ++i)
+            v[i] = (int)i;
+        test_adversary adversary(n);
+        test_adversary_less compare = { &adversary };
+        baobao::sort::pdq_sort(v.begin(), v.end(), compare);
+
+        std::vector<char> seen(n, 0);
+        bool sorted = true;
+        for (size_t i = 0; i < n; ++i)
+        {
+            sorted = sorted && !seen[v[i]] && (i == 0 || adversary.key[v[i - 1]] <= adversary.key[v[i]]);
+            seen[v[i]] = 1;
+        }
+        TEST_CHECK(sorted);
+        TEST_CHECK(adversary.compares < 8 * n * log_n);
+    }
+}
+
+// runs of random length, ascending, descending or equal, the merge policies differ in the run order they merge
+static void test_class_fill_runs(std::vector<baobao::TestClass>& v, size_t n, int keys)
+{
+    v.resize(n);
+    for (size_t i = 0; i < n;)
+    {
+        size_t len = std::min(n - i, (size_t)baobao::util::rand_uint32(i % 3 == 0 ? 3000 : 200) + 1);
+        int shape = (int)baobao::util::rand_uint32(2), key = (int)baobao::util::rand_uint32(keys);
+        for (size_t j = 0; j < len; ++j)
+        {
+            v[i + j] = shape == 0 ? key + (int)(j * keys / len) : shape == 1 ? key - (int)(j * keys / len) : key;
+        }
+        i += len;
+    }
+    for (size_t i = 0; i < n; ++i)
+        v[i].index = (int)i;
+}
+
+// a stable sort has one result, so both merge policies give the same order
+static void test_tim_sort_powersort()
+{
+    static const size_t sizes[] = { 0, 1, 2, 31, 64, 65, 1000, 20000, 100000 };
+    for (size_t si = 0; si < sizeof(sizes) / sizeof(sizes[0]); ++si)
+    {
+        for (int kind = 0; kind < 7; ++kind)
+        {
+            std::vector<int> in;
+            std::vector<double> in_double;
+            std::vector<baobao::TestClass> in_class;
+            if (kind < 6)
+                test_fill_keys(sizes[si], kind, in, in_double, in_class);
+            else
+                test_class_fill_runs(in_class, sizes[si], 50);
+
+            std::vector<baobao::TestClass> tim(in_class), power(in_class), power_buffer(in_class), power_caller(in_class);
+            baobao::sort::tim_sort<baobao::sort::timsort_policy>(tim.begin(), tim.end());
+            baobao::sort::tim_sort<baobao::sort::powersort_policy>(power.begin(), power.end());
+            baobao::sort::tim_sort_buffer<baobao::sort::powersort_policy>(power_buffer.begin(), power_buffer.end());
+            std::vector<baobao::TestClass> buf(power_caller.size() / 4 + 1);
+            baobao::sort::tim_sort_buffer<baobao::sort::powersort_policy>(power_caller.begin(), power_caller.end(),
+                std::less<baobao::TestClass>(), &buf[0], buf.size());
+            TEST_CHECK(test_class_stable(in_class, tim));
+            TEST_CHECK(test_class_stable(in_class, power));
+            bool same = true;
+            for (size_t i = 0; i < tim.size(); ++i)
+            {
+                same = same && tim[i].index == power[i].index && tim[i].index == power_buffer[i].index
+                    && tim[i].index == power_caller[i].index;
+            }
+            TEST_CHECK(same);
+        }
+    }
+}
+
+// keys of T for the SIMD kernels: the limits, zero, one, minus one, for floating point also
+// infinities, the smallest normal and denormal and -0.0, then random values with repeats
+template <class T>
+static std::vector<T> test_simd_pool()
+{
+    typedef std::numeric_limits<T> limits;
+    std::vector<T> pool;
+    pool.push_back(limits::is_integer ? limits::min() : -limits::max());
+    pool.push_back(limits::max());
+    pool.push_back((T)0);
+    pool.push_back((T)1);
+    pool.push_back((T)-1);
+    if (!limits::is_integer)
+    {
+        pool.push_back(limits::infinity());
+        pool.push_back(-limits::infinity());
+        pool.push_back(limits::min());
+        pool.push_back(limits::denorm_min());
+        pool.push_back(-limits::denorm_min());
+        pool.push_back(-(T)0);
+    }
+    for (int i = 0; i < 100; ++i)
+    {
+        int x = (int)baobao::util::rand_uint32(2000000) - 1000000;
+        // 32 bit keys wrap through unsigned, a signed overflow would be undefined
+        pool.push_back(!limits::is_integer ? (T)x / (T)3 : sizeof(T) > 4 ? (T)((T)x * (T)4093) : (T)((unsigned)x * 4093u));
+    }
+    return pool;
+}
+
+template <class T>
+static std::vector<T> test_simd_values(const std::vector<T>& pool, size_t n)
+{
+    std::vector<T> v(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        v[i] = pool[baobao::util::rand_uint32((int32_t)pool.size() - 1)];
+    }
+    return v;
+}
+
+// lengths around the register widths of 4 to 16 lanes and the 64 element cutoffs of the kernels
+static const size_t test_simd_lengths[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 1000, 5000 };
+
+// the engines that take the SIMD kernels for arithmetic keys under std::less and std::greater,
+// against std::sort, the same checks run with and without BAO_SORT_LIB_NO_SIMD
+template <class T, class Comp>
+static void test_simd_sorts(Comp compare)
+{
+    std::vector<T> pool = test_simd_pool<T>();
+    for (size_t li = 0; li < sizeof(test_simd_lengths) / sizeof(test_simd_lengths[0]); ++li)
+    {
+        for (int round = 0; round < 4; ++round)
+        {
+            std::vector<T> in = test_simd_values(pool, test_simd_lengths[li]), expect(in);
+            if (round == 3)
+                std::sort(in.begin(), in.begin() + in.size() / 2, compare);
+            std::sort(expect.begin(), expect.end(), compare);
+            for (int engine = 0; engine < 6; ++engine)
+            {
+                std::vector<T> v(in);
+                switch (engine)
+                {
+                case 0: baobao::sort::quick_sort(v.begin(), v.end(), compare); break;
+                case 1: baobao::sort::quick_sort_branchless(v.begin(), v.end(), compare); break;
+                case 2: baobao::sort::pdq_sort(v.begin(), v.end(), compare); break;
+                case 3: baobao::sort::merge_sort(v.begin(), v.end(), compare); break;
+                case 4: baobao::sort::tim_sort(v.begin(), v.end(), compare); break;
+                default: baobao::sort::merge_sort_ping_pong(v.begin(), v.end(), compare); break;
+                }
+                TEST_CHECK(v == expect);
+            }
+        }
+    }
+}
+
+#ifdef BAO_SORT_LIB_SIMD
+template <class T, bool greater>
+struct test_simd_compare
+{
+    typedef std::less<T> type;
+};
+
+template <class T>
+struct test_simd_compare<T, true>
+{
+    typedef std::greater<T> type;
+};
+
+// simd_partition and the bitonic network of simd_small_sort against the scalar results
+template <class T, bool greater>
+static void test_simd_kernels()
+{
+    typedef typename test_simd_compare<T, greater>::type Comp;
+    const int kind = baobao::internal::simd_key_kind<T>::value;
+    Comp compare;
+    std::vector<T> pool = test_simd_pool<T>();
+    for (size_t li = 0; li < sizeof(test_simd_lengths) / sizeof(test_simd_lengths[0]); ++li)
+    {
+        size_t n = test_simd_lengths[li];
+        for (int round = 0; round < 8; ++round)
+        {
+            std::vector<T> in = test_simd_values(pool, n + 1), v(in);
+            T pivot = in[n];
+            T* first = &v[0];
+            T* mid = baobao::internal::simd_partition<T, kind, greater>(first, first + n, pivot);
+            bool split = mid >= first && mid <= first + n;
+            for (T* i = first; split && i < first + n; ++i)
+            {
+                split = compare(*i, pivot) == (i < mid);
+            }
+            TEST_CHECK(split);
+            std::sort(v.begin(), v.begin() + n);
+            std::sort(in.begin(), in.begin() + n);
+            TEST_CHECK(v == in);
+
+            if (n > 0 && n <= (size_t)baobao::simd_network_max_size)
+            {
+                v = test_simd_values(pool, n);
+                std::vector<T> expect(v);
+                std::sort(expect.begin(), expect.end(), compare);
+                baobao::internal::simd_small_sort<T, kind, greater>(&v[0], n);
+                TEST_CHECK(v == expect);
+            }
+        }
+    }
+}
+
+// the merge kernel only takes integers, it leaves runs shorter than a register to the caller
+template <class T, bool greater>
+static void test_simd_merge()
+{
+    typedef typename test_simd_compare<T, greater>::type Comp;
+    Comp compare;
+    std::vector<T> pool = test_simd_pool<T>();
+    for (size_t ai = 0; ai < sizeof(test_simd_lengths) / sizeof(test_simd_lengths[0]); ++ai)
+    {
+        for (size_t bi = 0; bi < sizeof(test_simd_lengths) / sizeof(test_simd_lengths[0]); ++bi)
+        {
+            size_t na = test_simd_lengths[ai], nb = test_simd_lengths[bi];
+            if (na < 4 || nb < 4 || na > 1000 || nb > 1000)
+                continue;
+            for (int backward = 0; backward < 2; ++backward)
+            {
+                std::vector<T> v = test_simd_values(pool, na + nb), expect(na + nb);
+                std::sort(v.begin(), v.begin() + na, compare);
+                std::sort(v.begin() + na, v.end(), compare);
+                std::merge(v.begin(), v.begin() + na, v.begin() + na, v.end(), expect.begin(), compare);
+                T* first = &v[0];
+                std::vector<T> buf = backward ? std::vector<T>(v.begin() + na, v.end()) : std::vector<T>(v.begin(), v.begin() + na);
+                bool done = backward
+                    ? baobao::internal::merge_2_part_kernel<true>::run<true>(&buf[0], first, first + na, first + na + nb, compare)
+                    : baobao::internal::merge_2_part_kernel<true>::run<false>(&buf[0], first, first + na, first + na + nb, compare);
+                TEST_CHECK(!done || v == expect);
+            }
+        }
+    }
+}
+#endif
+
+static void test_simd()
+{
+    test_simd_sorts<int>(std::less<int>());
+    test_simd_sorts<int>(std::greater<int>());
+    test_simd_sorts<unsigned>(std::less<unsigned>());
+    test_simd_sorts<float>(std::less<float>());
+    test_simd_sorts<float>(std::greater<float>());
+    test_simd_sorts<double>(std::less<double>());
+    test_simd_sorts<double>(std::greater<double>());
+#if __cplusplus >= 201103L
+    test_simd_sorts<long long>(std::less<long long>());
+    test_simd_sorts<unsigned long long>(std::greater<unsigned long long>());
+#endif
+#ifdef BAO_SORT_LIB_SIMD
+    test_simd_kernels<int, false>();
+    test_simd_kernels<int, true>();
+    test_simd_kernels<unsigned, false>();
+    test_simd_kernels<unsigned, true>();
+    test_simd_kernels<long long, false>();
+    test_simd_kernels<long long, true>();
+    test_simd_kernels<unsigned long long, false>();
+    test_simd_kernels<float, false>();
+    test_simd_kernels<float, true>();
+    test_simd_kernels<double, false>();
+    test_simd_kernels<double, true>();
+    test_simd_merge<int, false>();
+    test_simd_merge<int, true>();
+    test_simd_merge<unsigned, false>();
+    test_simd_merge<long long, false>();
+    test_simd_merge<unsigned long long, true>();
+#endif
+}
+
+#if __cplusplus >= 201103L
+struct test_ptr_less
+{
+    bool operator()(const std::unique_ptr<int>& a, const std::unique_ptr<int>& b) const
+    {
+        return *a < *b;
+    }
+};
+
+// the engines the README lists for move-only types, odd ones are stable
+static void test_move_only_sort(int engine, std::vector<std::unique_ptr<int> >& v)
+{
+    switch (engine)
+    {
+    case 0: baobao::sort::insert_sort(v.begin(), v.end(), test_ptr_less()); break;
+    case 1: baobao::sort::indirect_qsort(v.begin(), v.end(), test_ptr_less()); break;
+    case 2: baobao::sort::shell_sort(v.begin(), v.end(), test_ptr_less()); break;
+    case 3: baobao::sort::merge_sort_in_place(v.begin(), v.end(), test_ptr_less()); break;
+    case 4: baobao::sort::heap_sort(v.begin(), v.end(), test_ptr_less()); break;
+    case 5: baobao::sort::merge_sort_s(v.begin(), v.end(), test_ptr_less()); break;
+    case 6: baobao::sort::quick_sort(v.begin(), v.end(), test_ptr_less()); break;
+    case 7: baobao::sort::tim_sort_s(v.begin(), v.end(), test_ptr_less()); break;
+    case 8: baobao::sort::quick_sort_branchless(v.begin(), v.end(), test_ptr_less()); break;
+    case 9: baobao::sort::merge_sort_buffer_s(v.begin(), v.end(), test_ptr_less()); break;
+    case 10: baobao::sort::pdq_sort(v.begin(), v.end(), test_ptr_less()); break;
+    default: baobao::sort::tim_sort_buffer_s(v.begin(), v.end(), test_ptr_less()); break;
+    }
+}
+
+// every pointer comes out once and none is lost to a copy, stable engines keep equal keys in input order
+static void test_move_only()
+{
+    static const size_t sizes[] = { 0, 1, 2, 40, 65, 1000, 20000 };
+    for (size_t si = 0; si < sizeof(sizes) / sizeof(sizes[0]); ++si)
+    {
+        size_t n = sizes[si];
+        for (int kind = 0; kind < 6; ++kind)
+        {
+            std::vector<int> keys(n);
+            for (size_t i = 0; i < n; ++i)
+                keys[i] = test_key(i, n, kind);
+            for (int engine = 0; engine < 12; ++engine)
+            {
+                if (engine == 0 && n > 1000)
+                    continue;
+                std::vector<std::unique_ptr<int> > v;
+                std::vector<std::pair<int, const int*> > expect;
+                for (size_t i = 0; i < n; ++i)
+                {
+                    v.push_back(std::unique_ptr<int>(new int(keys[i])));
+                    expect.push_back(std::make_pair(keys[i], v.back().get()));
+                }
+                // by key only, equal keys keep their input order and with it their pointers
+                std::stable_sort(expect.begin(), expect.end(),
+                    [](const std::pair<int, const int*>& a, const std::pair<int, const int*>& b) { return a.first < b.first; });
+                test_move_only_sort(engine, v);
+
+                bool ok = v.size() == n;
+                std::vector<const int*> got, want;
+                for (size_t i = 0; ok && i < n; ++i)
+                {
+                    ok = v[i] && *v[i] == expect[i].first;
+                    got.push_back(v[i].get());
+                    want.push_back(expect[i].second);
+                }
+                if (ok && engine % 2 == 0)
+                {
+                    std::sort(got.begin(), got.end());
+                    std::sort(want.begin(), want.end());
+                }
+                TEST_CHECK(ok && got == want);
+            }
+        }
+    }
+}
+#endif
+
+// nearly sorted strings take the tim_sort branch, its merges must copy and not memcpy
+static void test_auto_sort_string()
+{
+    std::vector<std::string> v;
+    for (uint32_t i = 0; i < 100000; ++i)
+    {
+        v.push_back(test_string(i));
+    }
+    for (size_t i = 0; i + 40 < v.size(); i += 97)
+    {
+        std::swap(v[i], v[i + 40]);
+    }
+    std::vector<std::string> r = v;
+    std::sort(r.begin(), r.end());
+
+    TEST_CHECK(baobao::sort::auto_sort_plan(v.begin(), v.end(), std::less<std::string>()).engine == baobao::sort::auto_sort_decision::tim_sort);
+    baobao::sort::auto_sort(v.begin(), v.end());
+    TEST_CHECK(v == r);
+}
+
+static void test_class_fill(std::vector<baobao::TestClass>& v, size_t n, int keys, bool presorted)
+{
+    v.resize(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        v[i] = presorted ? (int)(i * keys / n) : (int)baobao::util::rand_uint32(keys);
+        v[i].index = (int)i;
+    }
+}
+
+template <class RandomAccessIterator>
+static bool test_sorted_stable(RandomAccessIterator beg, RandomAccessIterator end)
+{
+    return beg == end || baobao::check_sorted_stable(beg, end, std::less<baobao::TestClass>());
+}
+
+static void test_merge_sort_ping_pong()
+{
+    std::vector<baobao::TestClass> v;
+    for (int presorted = 0; presorted < 2; ++presorted)
+    {
+        for (size_t n = 0; n < 5000; n = n * 3 + 1)
+        {
+            test_class_fill(v, n, 100, presorted != 0);
+            baobao::sort::merge_sort_ping_pong(v.begin(), v.end());
+            TEST_CHECK(test_sorted_stable(v.begin(), v.end()));
+            test_class_fill(v, n, 100, presorted != 0);
+            baobao::sort::merge_sort_ping_pong_s(v.begin(), v.end());
+            TEST_CHECK(test_sorted_stable(v.begin(), v.end()));
+        }
+    }
+}
+
+static void test_merge_ranges()
+{
+    typedef std::list<baobao::TestClass>::const_iterator list_iterator;
+    typedef std::vector<baobao::TestClass>::const_iterator vector_iterator;
+    for (size_t k = 1; k <= 40; k += 3)
+    {
+        std::vector<baobao::TestClass> all;
+        std::vector<std::list<baobao::TestClass> > runs(k);
+        std::vector<std::pair<vector_iterator, vector_iterator> > ranges;
+        std::vector<std::pair<list_iterator, list_iterator> > list_ranges;
+        for (size_t i = 0; i < k; ++i)
+        {
+            std::vector<baobao::TestClass> run;
+            test_class_fill(run, baobao::util::rand_uint32(i % 4 == 3 ? 1 : 2000), 50, false);
+            std::sort(run.begin(), run.end());
+            for (size_t j = 0; j < run.size(); ++j)
+            {
+                run[j].index = (int)all.size();
+                all.push_back(run[j]);
+            }
+            runs[i].assign(run.begin(), run.end());
+            list_ranges.push_back(std::make_pair(runs[i].begin(), runs[i].end()));
+        }
+        size_t pos = 0;
+        for (size_t i = 0; i < k; ++i)
+        {
+            ranges.push_back(std::make_pair(all.begin() + pos, all.begin() + pos + runs[i].size()));
+            pos += runs[i].size();
+        }
+
+        std::vector<baobao::TestClass> out(all.size());
+        TEST_CHECK(baobao::sort::merge_ranges(ranges.begin(), k, out.begin()) == out.end());
+        TEST_CHECK(test_sorted_stable(out.begin(), out.end()));
+        std::list<baobao::TestClass> list_out;
+        baobao::sort::merge_ranges(list_ranges.begin(), k, std::back_inserter(list_out));
+        std::vector<baobao::TestClass> list_sorted(list_out.begin(), list_out.end());
+        TEST_CHECK(list_sorted.size() == all.size() && test_sorted_stable(list_sorted.begin(), list_sorted.end()));
+    }
+
+    // scalar keys are kept in the tree by value, ints of key * 65536 + the position in the input
+    // compared by the key alone show if equal keys keep the order of the ranges
+    for (size_t k = 1; k <= 300; k = k * 2 + 1)
+    {
+        std::vector<int> all;
+        std::vector<std::pair<std::vector<int>::const_iterator, std::vector<int>::const_iterator> > ranges;
+        std::vector<size_t> bounds(1, 0);
+        for (size_t i = 0; i < k; ++i)
+        {
+            std::vector<int> run;
+            for (size_t n = baobao::util::rand_uint32(i % 5 == 4 ? 1 : 200); n > 0; --n)
+            {
+                run.push_back((int)baobao::util::rand_uint32(30));
+            }
+            std::sort(run.begin(), run.end());
+            for (size_t j = 0; j < run.size(); ++j)
+            {
+                all.push_back(run[j] * 65536 + (int)all.size());
+            }
+            bounds.push_back(all.size());
+        }
+        for (size_t i = 0; i < k; ++i)
+        {
+            ranges.push_back(std::make_pair(all.begin() + bounds[i], all.begin() + bounds[i + 1]));
+        }
+        std::vector<int> out(all.size()), expect(all);
+        std::sort(expect.begin(), expect.end());
+        baobao::sort::merge_ranges(ranges.begin(), k, out.begin(), test_high_bits_less());
+        TEST_CHECK(out == expect);
+    }
+}
+
+// the split at every rank against the one read off the stable merge
+static void test_multi_sequence_split()
+{
+    const size_t k = 7;
+    std::vector<std::vector<int> > runs(k);
+    std::vector<std::pair<int, size_t> > merged;
+    std::vector<std::vector<int>::const_iterator> first;
+    std::vector<size_t> len;
+    for (size_t i = 0; i < k; ++i)
+    {
+        for (size_t n = i == 2 ? 0 : baobao::util::rand_uint32(300); n > 0; --n)
+        {
+            runs[i].push_back((int)baobao::util::rand_uint32(i < 4 ? 5 : 1000));
+        }
+        std::sort(runs[i].begin(), runs[i].end());
+        for (size_t j = 0; j < runs[i].size(); ++j)
+        {
+            merged.push_back(std::make_pair(runs[i][j], i));
+        }
+        first.push_back(runs[i].begin());
+        len.push_back(runs[i].size());
+    }
+    // pairs order by run on equal keys, the same tie rule as the stable merge
+    std::sort(merged.begin(), merged.end());
+    std::vector<size_t> expect(k, 0), split(k);
+    for (size_t rank = 0; rank <= merged.size(); ++rank)
+    {
+        baobao::internal::multi_sequence_split(&first[0], &len[0], k, rank, &split[0], std::less<int>());
+        TEST_CHECK(split == expect);
+        if (rank < merged.size())
+        {
+            ++expect[merged[rank].second];
+        }
+    }
+}
+
+// the parallel merge must give the sequential result for any order of the shards and any thread count,
+// multi_sequence_split has to send the equal keys to the earlier shards first
+static void test_parallel_merge_ranges()
+{
+    typedef std::vector<baobao::TestClass>::const_iterator vector_iterator;
+    const size_t k = 12;
+    std::vector<std::vector<baobao::TestClass> > shards(k);
+    for (size_t i = 0; i < k; ++i)
+    {
+        test_class_fill(shards[i], i % 5 == 4 ? 0 : 4000 + baobao::util::rand_uint32(8000), i % 3 == 0 ? 3 : 64, false);
+        std::sort(shards[i].begin(), shards[i].end());
+    }
+    std::vector<size_t> order(k);
+    for (size_t i = 0; i < k; ++i)
+    {
+        order[i] = i;
+    }
+    for (int round = 0; round < 4; ++round)
+    {
+        std::vector<std::pair<vector_iterator, vector_iterator> > ranges;
+        size_t total = 0;
+        for (size_t i = 0; i < k; ++i)
+        {
+            std::vector<baobao::TestClass>& shard = shards[order[i]];
+            for (size_t j = 0; j < shard.size(); ++j)
+            {
+                shard[j].index = (int)(total + j);
+            }
+            total += shard.size();
+            ranges.push_back(std::make_pair(shard.begin(), shard.end()));
+        }
+        std::vector<baobao::TestClass> expect(total);
+        baobao::sort::merge_ranges(ranges.begin(), k, expect.begin());
+        TEST_CHECK(test_sorted_stable(expect.begin(), expect.end()));
+        for (unsigned threads = 1; threads <= 8; ++threads)
+        {
+            std::vector<baobao::TestClass> out(total);
+            TEST_CHECK(baobao::sort::parallel_merge_ranges(ranges.begin(), k, out.begin(), std::less<baobao::TestClass>(), threads) == out.end());
+            bool same = true;
+            for (size_t i = 0; i < total; ++i)
+            {
+                same = same && out[i].val == expect[i].val && out[i].index == expect[i].index;
+            }
+            TEST_CHECK(same);
+        }
+        baobao::random_shuffle(order.begin(), order.end());
+    }
+}
+
+#ifdef BAO_SORT_LIB_MMAP
+#include <dirent.h>
+
+static size_t test_count_files(const char* dir)
+{
+    size_t count = 0;
+    DIR* d = opendir(dir);
+    for (struct dirent* e = d ? readdir(d) : NULL; e; e = readdir(d))
+    {
+        count += e->d_name[0] != '.';
+    }
+    if (d)
+    {
+        closedir(d);
+    }
+    return count;
+}
+
+// 200000 records of 32 bytes in 16 KB of memory give runs of 256 records, merged two at a time in ten passes,
+// the temporary files are made in a directory of their own, which must be empty again afterwards
+static void test_external_sort()
+{
+    char dir[] = "/tmp/baosort_unittest_XXXXXX";
+    TEST_CHECK(mkdtemp(dir) != NULL);
+    std::string input = std::string(dir) + "/in", output = std::string(dir) + "/out", temp = std::string(dir) + "/temp";
+    TEST_CHECK(mkdir(temp.c_str(), 0700) == 0);
+
+    std::vector<baobao::TestClass> v;
+    test_class_fill(v, 200000, 5000, false);
+    FILE* file = fopen(input.c_str(), "wb");
+    TEST_CHECK(file && fwrite(&v[0], sizeof(v[0]), v.size(), file) == v.size());
+    if (file)
+    {
+        fclose(file);
+    }
+    TEST_CHECK(baobao::sort::external_sort<baobao::TestClass>(input.c_str(), output.c_str(), temp.c_str(), 16384));
+    TEST_CHECK(test_count_files(temp.c_str()) == 0);
+
+    std::vector<baobao::TestClass> out(v.size() + 1);
+    file = fopen(output.c_str(), "rb");
+    TEST_CHECK(file && fread(&out[0], sizeof(out[0]), out.size(), file) == v.size());
+    if (file)
+    {
+        fclose(file);
+    }
+    out.pop_back();
+    TEST_CHECK(test_sorted_stable(out.begin(), out.end()));
+
+    // an output path longer than any path buffer fails to open, from a single run and from the merge
+    std::string long_output = std::string(dir) + "/" + std::string(5000, 'x');
+    TEST_CHECK(!baobao::sort::external_sort<baobao::TestClass>(input.c_str(), long_output.c_str(), temp.c_str(), 1 << 24));
+    TEST_CHECK(!baobao::sort::external_sort<baobao::TestClass>(input.c_str(), long_output.c_str(), temp.c_str(), 16384));
+    TEST_CHECK(test_count_files(temp.c_str()) == 0);
+    std::string long_temp = temp + "/" + std::string(5000, 'x');
+    TEST_CHECK(!baobao::sort::external_sort<baobao::TestClass>(input.c_str(), output.c_str(), long_temp.c_str(), 16384));
+    TEST_CHECK(test_count_files(temp.c_str()) == 0);
+
+    remove(input.c_str());
+    remove(output.c_str());
+    rmdir(temp.c_str());
+    rmdir(dir);
+}
+#endif
+
+// records of 12 bytes keyed by bytes [2, 8), the first two key bytes are the same everywhere
+static std::vector<unsigned char> test_records(size_t n)
+{
+    std::vector<unsigned char> data(n * 12);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        size_t b = i % 12;
+        data[i] = (unsigned char)(b == 2 ? 7 : b == 3 ? 9 : baobao::util::rand_uint32(b < 6 ? 4 : 256));
+    }
+    return data;
+}
+
+static bool test_records_sorted(const std::vector<unsigned char>& data, std::vector<unsigned char> input)
+{
+    std::vector<std::string> a, b;
+    for (size_t i = 0; i < data.size(); i += 12)
+    {
+        if (i > 0 && memcmp(&data[i + 2], &data[i - 10], 6) < 0)
+        {
+            return false;
+        }
+        a.push_back(std::string((const char*)&data[i], 12));
+        b.push_back(std::string((const char*)&input[i], 12));
+    }
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+    return a == b;
+}
+
+static void test_sort_file()
+{
+    std::vector<unsigned char> input = test_records(30000), data = input, tmp(12), scratch;
+    baobao::internal::sort_file_records rec;
+    rec.record_size = 12;
+    rec.key_offset = 2;
+    rec.key_len = 6;
+    rec.tmp = &tmp[0];
+    // a scratch limit of 4 KB takes the distribution, it skips the two constant bytes
+    baobao::internal::sort_file_blocks(&data[0], data.size() / 12, 0, rec, scratch, 4096);
+    TEST_CHECK(test_records_sorted(data, input));
+
+    const char* path = "unittest_sort_file.bin";
+    FILE* file = fopen(path, "wb");
+    TEST_CHECK(file && fwrite(&input[0], 1, input.size(), file) == input.size());
+    if (file)
+    {
+        fclose(file);
+    }
+    TEST_CHECK(baobao::sort::sort_file(path, 12, 2, 6));
+    file = fopen(path, "rb");
+    TEST_CHECK(file && fread(&data[0], 1, data.size(), file) == data.size());
+    if (file)
+    {
+        fclose(file);
+    }
+    TEST_CHECK(test_records_sorted(data, input));
+    remove(path);
+}
+
+// bytes handed out in order from a fixed block, every allocation aligned to 16 bytes
+struct test_byte_arena
+{
+    unsigned char* mem;
+    size_t used;
+    size_t cap;
+    int blocks;
+};
+
+template <class T>
+struct test_arena_allocator
+{
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <class U>
+    struct rebind
+    {
+        typedef test_arena_allocator<U> other;
+    };
+
+    test_byte_arena* arena;
+
+    explicit test_arena_allocator(test_byte_arena* a)
+        : arena(a)
+    {
+    }
+
+    template <class U>
+    test_arena_allocator(const test_arena_allocator<U>& a)
+        : arena(a.arena)
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        size_t beg = (arena->used + 15) / 16 * 16;
+        if (beg + n * sizeof(T) > arena->cap)
+        {
+            throw std::bad_alloc();
+        }
+        arena->used = beg + n * sizeof(T);
+        ++arena->blocks;
+        return (T*)(arena->mem + beg);
+    }
+
+    void deallocate(T*, size_t)
+    {
+        --arena->blocks;
+    }
+};
+
+// the scratch is counted in elements of the range, an allocator of bytes has to be rebound to them
+static void test_buffer_allocator()
+{
+    std::vector<unsigned char> block(200000 * sizeof(baobao::TestClass));
+    test_byte_arena arena = { &block[0], 0, block.size(), 0 };
+    test_arena_allocator<char> bytes(&arena);
+    std::allocator<char> std_bytes;
+    std::vector<baobao::TestClass> v;
+    for (int k = 0; k < 4; ++k)
+    {
+        test_class_fill(v, 100000, 1000, false);
+        arena.used = 0;
+        if (k == 0)
+            baobao::sort::merge_sort_buffer(v.begin(), v.end(), std::less<baobao::TestClass>(), bytes);
+        else if (k == 1)
+            baobao::sort::tim_sort_buffer_s(v.begin(), v.end(), std::less<baobao::TestClass>(), bytes);
+        else if (k == 2)
+            baobao::sort::merge_sort_buffer_s(v.begin(), v.end(), std::less<baobao::TestClass>(), std_bytes);
+        else
+            baobao::sort::tim_sort_buffer(v.begin(), v.end(), std::less<baobao::TestClass>(), std_bytes);
+        TEST_CHECK(test_sorted_stable(v.begin(), v.end()));
+        TEST_CHECK(k >= 2 || arena.used == baobao::sort::required_buffer_size(v.size()) * sizeof(baobao::TestClass));
+    }
+
+    std::vector<std::string> s, r;
+    for (uint32_t i = 0; i < 20000; ++i)
+    {
+        s.push_back(test_string(baobao::util::rand_uint32(5000)) + "-a-string-too-long-for-the-small-buffer");
+    }
+    r = s;
+    std::stable_sort(r.begin(), r.end());
+    arena.used = 0;
+    baobao::sort::merge_sort_buffer_s(s.begin(), s.end(), std::less<std::string>(), bytes);
+    TEST_CHECK(s == r);
+    TEST_CHECK(arena.blocks == 0);
+}
+
+// a copy constructor that throws once copies_left runs out, live counts the objects
+struct test_throwing_copy
+{
+    int key;
+    static int copies_left;
+    static int live;
+
+    test_throwing_copy() : key(0) { ++live; }
+    explicit test_throwing_copy(int k) : key(k) { ++live; }
+    test_throwing_copy(const test_throwing_copy& o) : key(o.key)
+    {
+        if (copies_left-- == 0)
+            throw std::runtime_error("copy");
+        ++live;
+    }
+    test_throwing_copy& operator=(const test_throwing_copy& o)
+    {
+        key = o.key;
+        return *this;
+    }
+    ~test_throwing_copy() { --live; }
+    bool operator<(const test_throwing_copy& o) const { return key < o.key; }
+};
+
+int test_throwing_copy::copies_left = -1;
+int test_throwing_copy::live = 0;
+
+// the safe copy scratch is freed and its constructed slots destroyed when a copy throws,
+// unittest_asan reports the leak of a buffer from new
+static void test_buffer_copy_throws()
+{
+    std::vector<unsigned char> block(1 << 20);
+    test_byte_arena arena = { &block[0], 0, block.size(), 0 };
+    test_arena_allocator<char> bytes(&arena);
+    for (int k = 0; k < 4; ++k)
+    {
+        std::vector<test_throwing_copy> v;
+        for (int i = 0; i < 10000; ++i)
+        {
+            v.push_back(test_throwing_copy((int)baobao::util::rand_uint32(1000)));
+        }
+        int live = test_throwing_copy::live;
+        bool thrown = false;
+        test_throwing_copy::copies_left = 100;
+        arena.used = 0;
+        try
+        {
+            if (k == 0)
+                baobao::sort::merge_sort_buffer_s(v.begin(), v.end(), std::less<test_throwing_copy>(), bytes);
+            else if (k == 1)
+                baobao::sort::tim_sort_buffer_s(v.begin(), v.end(), std::less<test_throwing_copy>(), bytes);
+            else if (k == 2)
+                baobao::sort::merge_sort_s(v.begin(), v.end(), std::less<test_throwing_copy>());
+            else
+                baobao::sort::tim_sort_s(v.begin(), v.end(), std::less<test_throwing_copy>());
+        }
+        catch (const std::runtime_error&)
+        {
+            thrown = true;
+        }
+        test_throwing_copy::copies_left = -1;
+        TEST_CHECK(thrown);
+        TEST_CHECK(test_throwing_copy::live == live);
+        TEST_CHECK(arena.blocks == 0);
+    }
+}
+
+#ifdef BAO_SORT_LIB_SCRATCH_CACHE
+// sorts its own vectors over and over, results[id] tells if all of them came out sorted
+static void test_scratch_cache_thread(int id, std::vector<char>* results)
+{
+    uint32_t x = 12345u + (uint32_t)id;
+    bool ok = true;
+    for (int round = 0; round < 20; ++round)
+    {
+        std::vector<int> v(20000 + 5000 * ((round + id) % 4));
+        for (size_t i = 0; i < v.size(); ++i)
+        {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            v[i] = (int)(x % 100000);
+        }
+        if (round % 2)
+            baobao::sort::tim_sort(v.begin(), v.end());
+        else
+            baobao::sort::merge_sort(v.begin(), v.end());
+        ok = ok && std::is_sorted(v.begin(), v.end());
+    }
+    (*results)[id] = ok;
+}
+
+static void test_scratch_cache()
+{
+    typedef baobao::util::scratch_cache cache;
+    cache::trim();
+    TEST_CHECK(cache::held() == 0);
+
+    std::vector<baobao::TestClass> v;
+    test_class_fill(v, 100000, 1000, false);
+    baobao::sort::merge_sort(v.begin(), v.end());
+    TEST_CHECK(test_sorted_stable(v.begin(), v.end()));
+    size_t held = cache::held();
+    TEST_CHECK(held > 0);
+
+    // a smaller sort reuses the block
+    test_class_fill(v, 50000, 1000, false);
+    baobao::sort::tim_sort(v.begin(), v.end());
+    TEST_CHECK(test_sorted_stable(v.begin(), v.end()));
+    TEST_CHECK(cache::held() == held);
+    cache::trim();
+    TEST_CHECK(cache::held() == 0);
+
+    // nothing is kept over the limit
+    size_t limit = cache::limit();
+    cache::set_limit(0);
+    test_class_fill(v, 100000, 1000, false);
+    baobao::sort::merge_sort(v.begin(), v.end());
+    TEST_CHECK(test_sorted_stable(v.begin(), v.end()));
+    TEST_CHECK(cache::held() == 0);
+    cache::set_limit(limit);
+
+    // every thread has its own block, freed when it exits
+    std::vector<char> results(4, 0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.push_back(std::thread(test_scratch_cache_thread, i, &results));
+    }
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        threads[i].join();
+    }
+    TEST_CHECK(std::count(results.begin(), results.end(), 1) == 4);
+    TEST_CHECK(cache::held() == 0);
+}
+#endif
+
+int main(void)
+{
+#ifdef BAO_SORT_LIB_PARALLEL
+    test_task_pool_exception();
+#endif
+    test_parallel_quick_sort();
+    test_parallel_stable_sort(test_parallel_merge_sorter());
+    test_parallel_stable_sort(test_parallel_tim_sorter());
+    test_parallel_radix_sort_in_place();
+    test_radix_sort_lsd();
+    test_sample_sort();
+    test_quick_sort_branchless();
+    test_pdq_sort_fallback();
+    test_tim_sort_powersort();
+#if __cplusplus >= 201103L
+    test_move_only();
+#endif
+    test_simd();
+    test_auto_sort_string();
+    test_buffer_allocator();
+    test_buffer_copy_throws();
+#ifdef BAO_SORT_LIB_SCRATCH_CACHE
+    test_scratch_cache();
+#endif
+    test_merge_sort_ping_pong();
+    test_merge_ranges();
+    test_multi_sequence_split();
+    test_parallel_merge_ranges();
+#ifdef BAO_SORT_LIB_MMAP
+    test_external_sort();
+#endif
+    test_sort_file();
+
+    if (test_failures)
+    {
+        printf("%d checks failed\n", test_failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}